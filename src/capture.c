@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "header/main.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CAPTURE_SSE2
+#endif
+
+/*
+ * Frames are handed from the render thread to a writer thread through a
+ * single-producer single-consumer ring. The render thread only ever
+ * copies into a free slot; when all slots are still waiting to be
+ * written the frame is dropped and counted instead of blocking.
+ */
+
+/* Datatypes */
+typedef struct {
+    Uint32* pixels;            /* ABGR frame, or indices when indexed is set */
+    char indexed;
+    Uint32 palette[PALETTE_SIZE];
+} CaptureSlot;
+
+/* Globals */
+char captureFormat = CAPTURE_OFF;
+FILE* captureFile = NULL;
+CaptureSlot captureSlots[CAPTURE_RING_SIZE];
+SDL_atomic_t captureHead;   /* Frames published by the render thread */
+SDL_atomic_t captureTail;   /* Frames finished by the writer thread */
+SDL_sem* captureReady = NULL;
+SDL_Thread* captureThread = NULL;
+char captureQuit = FALSE;
+long capturedFrames = 0;
+long droppedFrames = 0;
+
+/* Writer thread scratch */
+Uint32* captureExpanded = NULL;
+Uint8* capturePlanes = NULL;
+
+
+/*
+ * BT.601 studio range conversion to planar 4:4:4:
+ *   Y = 16  + (( 66R + 129G +  25B + 128) >> 8)
+ *   U = 128 + ((-38R -  74G + 112B + 128) >> 8)
+ *   V = 128 + ((112R -  94G -  18B + 128) >> 8)
+ */
+void convertABGRToYUV444(const Uint32* pixels, int count, Uint8* y, Uint8* u, Uint8* v) {
+    int i = 0;
+    int r, g, b;
+
+#ifdef CAPTURE_SSE2
+    /* Pixels are split into (R, B) and (G, A) 16-bit pairs and weighted with madd */
+    const __m128i lowMask = _mm_set1_epi32(0x00FF00FF);
+    const __m128i yRB = _mm_set1_epi32((25 << 16) | 66);
+    const __m128i yG  = _mm_set1_epi32(129);
+    const __m128i uRB = _mm_set1_epi32((112 << 16) | (Uint16)-38);
+    const __m128i uG  = _mm_set1_epi32((Uint16)-74);
+    const __m128i vRB = _mm_set1_epi32(((Uint16)-18 << 16) | 112);
+    const __m128i vG  = _mm_set1_epi32((Uint16)-94);
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i yOffset = _mm_set1_epi16(16);
+    const __m128i uvOffset = _mm_set1_epi16(128);
+    __m128i rb[4], ga[4], ys[4], us[4], vs[4];
+    int k;
+
+    for(; i + 16 <= count; i += 16) {
+        for(k = 0; k < 4; k++) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(pixels + i + 4 * k));
+            rb[k] = _mm_and_si128(p, lowMask);
+            ga[k] = _mm_and_si128(_mm_srli_epi32(p, 8), lowMask);
+            ys[k] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rb[k], yRB), _mm_madd_epi16(ga[k], yG)), round), 8);
+            us[k] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rb[k], uRB), _mm_madd_epi16(ga[k], uG)), round), 8);
+            vs[k] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rb[k], vRB), _mm_madd_epi16(ga[k], vG)), round), 8);
+        }
+
+        _mm_storeu_si128((__m128i*)(y + i), _mm_packus_epi16(
+            _mm_add_epi16(_mm_packs_epi32(ys[0], ys[1]), yOffset),
+            _mm_add_epi16(_mm_packs_epi32(ys[2], ys[3]), yOffset)));
+        _mm_storeu_si128((__m128i*)(u + i), _mm_packus_epi16(
+            _mm_add_epi16(_mm_packs_epi32(us[0], us[1]), uvOffset),
+            _mm_add_epi16(_mm_packs_epi32(us[2], us[3]), uvOffset)));
+        _mm_storeu_si128((__m128i*)(v + i), _mm_packus_epi16(
+            _mm_add_epi16(_mm_packs_epi32(vs[0], vs[1]), uvOffset),
+            _mm_add_epi16(_mm_packs_epi32(vs[2], vs[3]), uvOffset)));
+    }
+#endif
+
+    for(; i < count; i++) {
+        r = pixels[i] & 0xFF;
+        g = (pixels[i] >> 8) & 0xFF;
+        b = (pixels[i] >> 16) & 0xFF;
+        y[i] = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+        u[i] = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+        v[i] = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+    }
+}
+
+void writeCaptureSlot(CaptureSlot* slot) {
+    const int count = WINDOW_WIDTH * WINDOW_HEIGHT;
+    const Uint32* pixels = slot->pixels;
+    const Uint8* indices;
+    int i;
+
+    if(slot->indexed) {
+        indices = (const Uint8*)slot->pixels;
+        for(i = 0; i < count; i++)
+            captureExpanded[i] = slot->palette[indices[i]];
+        pixels = captureExpanded;
+    }
+
+    if(captureFormat == CAPTURE_Y4M) {
+        convertABGRToYUV444(pixels, count, capturePlanes, capturePlanes + count, capturePlanes + 2 * count);
+        fputs("FRAME\n", captureFile);
+        fwrite(capturePlanes, 1, 3 * count, captureFile);
+    } else {
+        /* ABGR8888 words are R, G, B, A bytes in memory on little-endian machines */
+        fwrite(pixels, sizeof(Uint32), count, captureFile);
+    }
+}
+
+int captureWriterMain(void* data) {
+    int tail;
+    (void)data;
+
+    for(;;) {
+        SDL_SemWait(captureReady);
+
+        tail = SDL_AtomicGet(&captureTail);
+        if(tail == SDL_AtomicGet(&captureHead)) {
+            if(captureQuit) break;
+            continue;
+        }
+
+        SDL_MemoryBarrierAcquire();
+        writeCaptureSlot(&captureSlots[tail % CAPTURE_RING_SIZE]);
+        SDL_AtomicAdd(&captureTail, 1);
+    }
+
+    fflush(captureFile);
+    return 0;
+}
+
+int startCapture(const char* path, char format) {
+    int i;
+
+    if(captureFormat != CAPTURE_OFF) return FALSE;
+
+    if(!strcmp(path, "-")) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        captureFile = stdout;
+    } else {
+        captureFile = fopen(path, "wb");
+    }
+    if(!captureFile) return FALSE;
+
+    /* Everything is allocated up front so capturing never allocates; stopCapture frees whatever was */
+    for(i = 0; i < CAPTURE_RING_SIZE; i++)
+        captureSlots[i].pixels = malloc(WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(Uint32));
+    captureExpanded = malloc(WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(Uint32));
+    capturePlanes = malloc(WINDOW_WIDTH * WINDOW_HEIGHT * 3);
+    captureReady = SDL_CreateSemaphore(0);
+    for(i = 0; i < CAPTURE_RING_SIZE; i++)
+        if(!captureSlots[i].pixels) break;
+    if(i < CAPTURE_RING_SIZE || !captureExpanded || !capturePlanes || !captureReady) {
+        stopCapture();
+        return FALSE;
+    }
+
+    if(format == CAPTURE_Y4M)
+        fprintf(captureFile, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", WINDOW_WIDTH, WINDOW_HEIGHT, 1000 / TICK_MS);
+
+    SDL_AtomicSet(&captureHead, 0);
+    SDL_AtomicSet(&captureTail, 0);
+    capturedFrames = droppedFrames = 0;
+    captureQuit = FALSE;
+    captureFormat = format;
+
+    captureThread = SDL_CreateThread(captureWriterMain, "captureWriter", NULL);
+    if(!captureThread) {
+        stopCapture();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+CaptureSlot* acquireCaptureSlot() {
+    int head = SDL_AtomicGet(&captureHead);
+
+    if(head - SDL_AtomicGet(&captureTail) >= CAPTURE_RING_SIZE) {
+        droppedFrames++;
+        return NULL;
+    }
+
+    return &captureSlots[head % CAPTURE_RING_SIZE];
+}
+
+void publishCaptureSlot() {
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicAdd(&captureHead, 1);
+    SDL_SemPost(captureReady);
+    capturedFrames++;
+}
+
+void captureFrame(const Uint32* pixels) {
+    CaptureSlot* slot;
+
+    if(captureFormat == CAPTURE_OFF || !(slot = acquireCaptureSlot())) return;
+
+    memcpy(slot->pixels, pixels, WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(Uint32));
+    slot->indexed = FALSE;
+    publishCaptureSlot();
+}
+
+void captureIndexedFrame(const Uint8* pixels, const Uint32* palette) {
+    CaptureSlot* slot;
+
+    if(captureFormat == CAPTURE_OFF || !(slot = acquireCaptureSlot())) return;
+
+    /* Only a quarter of the bytes to copy; the writer expands them */
+    memcpy(slot->pixels, pixels, WINDOW_WIDTH * WINDOW_HEIGHT);
+    memcpy(slot->palette, palette, sizeof(slot->palette));
+    slot->indexed = TRUE;
+    publishCaptureSlot();
+}
+
+void stopCapture() {
+    int i;
+
+    if(captureThread) {
+        /* The writer drains whatever is still queued before exiting */
+        captureQuit = TRUE;
+        SDL_SemPost(captureReady);
+        SDL_WaitThread(captureThread, NULL);
+        captureThread = NULL;
+        fprintf(stderr, "Captured %ld frames, dropped %ld\n", capturedFrames, droppedFrames);
+    }
+
+    if(captureFile && captureFile != stdout)
+        fclose(captureFile);
+    captureFile = NULL;
+
+    for(i = 0; i < CAPTURE_RING_SIZE; i++) {
+        free(captureSlots[i].pixels);
+        captureSlots[i].pixels = NULL;
+    }
+    free(captureExpanded);
+    free(capturePlanes);
+    captureExpanded = NULL;
+    capturePlanes = NULL;
+
+    if(captureReady) SDL_DestroySemaphore(captureReady);
+    captureReady = NULL;
+    captureFormat = CAPTURE_OFF;
+}
@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "header/main.h"
+
+/*
+ * Many small, independent copies of the game for training agents. Each
+ * environment has its own pose and map reference and draws into its
+ * own slice of one observation tensor; none of them touch the player,
+ * the global rays or the screen buffers, so a whole batch is moved and
+ * drawn in one parallel pass without a window.
+ *
+ * The maps are read-only here: they are plain grids of tiles with no
+ * door or pushwall state, so a door tile is simply a wall.
+ *
+ * A panorama view sees all the way around in one pass: its columns are
+ * spread evenly over the circle and drawn on a cylinder, so wall heights
+ * follow the straight-line distance. The same cast can skip drawing and
+ * hand back just each column's range and material, as a lidar would.
+ */
+
+/* A wall found by castEnvironmentRay */
+typedef struct {
+    float distance;     /* Along the view direction */
+    Vector2f ray;       /* From the camera to the hit */
+    RayType side;
+    int material;
+} EnvironmentHit;
+
+
+int isEnvironmentWall(const Environment* env, int mapx, int mapy) {
+    if(mapx < 0 || mapy < 0 || mapx >= env->mapWidth || mapy >= env->mapHeight)
+        return TRUE;
+    return env->map[mapy * env->mapWidth + mapx] > 0;
+}
+
+int getEnvironmentMaterial(const Environment* env, int mapx, int mapy) {
+    int material;
+
+    if(mapx < 0 || mapy < 0 || mapx >= env->mapWidth || mapy >= env->mapHeight)
+        return W;
+    material = TILE_MATERIAL(env->map[mapy * env->mapWidth + mapx]);
+    return (material < 1 || material > 4) ? W : material;
+}
+
+void castEnvironmentRay(const Environment* env, Vector2f dir, float distFromViewplane, EnvironmentHit* hit) {
+    int mapx = (int)floor(env->pos.x / WALL_SIZE);
+    int mapy = (int)floor(env->pos.y / WALL_SIZE);
+    int stepx = dir.x < 0 ? -1 : 1;
+    int stepy = dir.y < 0 ? -1 : 1;
+    float deltax = fabs(WALL_SIZE / MAKE_FLOAT_NONZERO(dir.x));
+    float deltay = fabs(WALL_SIZE / MAKE_FLOAT_NONZERO(dir.y));
+    float sidex = ((mapx + (stepx > 0)) * WALL_SIZE - env->pos.x) / MAKE_FLOAT_NONZERO(dir.x);
+    float sidey = ((mapy + (stepy > 0)) * WALL_SIZE - env->pos.y) / MAKE_FLOAT_NONZERO(dir.y);
+    float t;
+
+    /*
+     * A plain grid walk: step to whichever grid line the ray reaches
+     * first. dir is not normalized; it has a forward component of
+     * distFromViewplane, so the distance along the view direction is
+     * just t * distFromViewplane. A unit dir with distFromViewplane 1
+     * gives the straight-line distance instead.
+     */
+    for(;;) {
+        if(sidex < sidey) {
+            t = sidex;
+            sidex += deltax;
+            mapx += stepx;
+            hit->side = VERTICAL_RAY;
+        } else {
+            t = sidey;
+            sidey += deltay;
+            mapy += stepy;
+            hit->side = HORIZONTAL_RAY;
+        }
+        if(isEnvironmentWall(env, mapx, mapy))
+            break;
+    }
+
+    hit->distance = t * distFromViewplane;
+    hit->ray = vec2Scale(dir, t);
+    hit->material = getEnvironmentMaterial(env, mapx, mapy);
+}
+
+void drawEnvironment(const EnvironmentBatch* batch, const Environment* env) {
+    float dist = batch->distFromViewplane;
+    Vector2f forward = vec2Scale(env->dir, dist);
+    Vector2f ray;
+    EnvironmentHit hit;
+    EnvironmentDepth* depth;
+    float drawLength, wallYStart;
+    int column, textureX = 0;
+    char darken;
+
+    for(column = 0; column < batch->width; column++) {
+        if(batch->flags & ENV_PANORAMA) {
+            ray = batch->panoramaRays[column];
+            castEnvironmentRay(env, vec2Add(vec2Scale(env->dir, ray.x), vec2Scale(env->plane, ray.y)), 1.0f, &hit);
+        } else {
+            castEnvironmentRay(env, vec2Sub(forward, vec2Scale(env->plane, (batch->width / 2) - column)), dist, &hit);
+        }
+
+        if(batch->flags & ENV_DEPTH) {
+            depth = (EnvironmentDepth*)env->observation + column;
+            depth->distance = hit.distance;
+            depth->material = (Uint8)hit.material;
+            depth->side = (Uint8)hit.side;
+            depth->unused = 0;
+            continue;
+        }
+
+        drawLength = dist * WALL_SIZE / MAKE_FLOAT_NONZERO(hit.distance);
+        wallYStart = (batch->height / 2.0f) - (drawLength / 2.0f);
+        darken = hit.side == HORIZONTAL_RAY;
+        if(batch->flags & ENV_TEXTURED)
+            textureX = getTextureColumnNumberForRay(env->pos, hit.ray, hit.side);
+
+        if(batch->flags & ENV_INDEXED) {
+            Uint8* dst = (Uint8*)env->observation + column;
+            if(batch->flags & ENV_TEXTURED)
+                drawTexturedStrip8To(dst, batch->width, batch->height, wallYStart, drawLength, textureX, INDEXED_TEXTURES[hit.material - 1], darken);
+            else
+                drawUntexturedStrip8To(dst, batch->width, batch->height, wallYStart, drawLength, INDEXED_COLORS[hit.material - 1], darken);
+        } else {
+            Uint32* dst = (Uint32*)env->observation + column;
+            if(batch->flags & ENV_TEXTURED)
+                drawTexturedStripTo(dst, batch->width, batch->height, wallYStart, drawLength, textureX, TEXTURES[hit.material - 1], darken);
+            else
+                drawUntexturedStripTo(dst, batch->width, batch->height, wallYStart, drawLength, COLORS[hit.material - 1], darken);
+        }
+    }
+}
+
+int clipEnvironmentMovement(const Environment* env, float dx, float dy) {
+    float newx = env->pos.x + dx;
+    float newy = env->pos.y + dy;
+    int x1 = (int)floor((newx - PLAYER_SIZE) / WALL_SIZE);
+    int y1 = (int)floor((newy - PLAYER_SIZE) / WALL_SIZE);
+    int x2 = (int)floor((newx + PLAYER_SIZE) / WALL_SIZE);
+    int y2 = (int)floor((newy + PLAYER_SIZE) / WALL_SIZE);
+    int i, j;
+
+    for(i = y1; i <= y2; i++)
+        for(j = x1; j <= x2; j++)
+            if(isEnvironmentWall(env, j, i))
+                return TRUE;
+    return FALSE;
+}
+
+void moveEnvironment(Environment* env, float dx, float dy) {
+    /* Slide along walls the same way movePlayer does */
+    if(!clipEnvironmentMovement(env, dx, dy)) {
+        env->pos = vec2Add(env->pos, vec2(dx, dy));
+    } else if(!clipEnvironmentMovement(env, 0.0f, dy)) {
+        env->pos.y += dy;
+    } else if(!clipEnvironmentMovement(env, dx, 0.0f)) {
+        env->pos.x += dx;
+    }
+}
+
+void turnEnvironment(Environment* env, Rotation2f rot) {
+    env->dir = vec2Rotate(env->dir, rot);
+    env->plane = vec2Rotate(env->plane, rot);
+}
+
+void applyEnvironmentInput(const EnvironmentBatch* batch, Environment* env, Uint8 held) {
+    float moveSpeed = PLAYER_MOVEMENT_SPEED;
+    int turns = 1;
+
+    /* The same moves as updatePlayer, from INPUT_* bits */
+    if(held & INPUT_RUN) {
+        moveSpeed *= 2;
+        turns = 2;
+    }
+    if(held & INPUT_FORWARD)
+        moveEnvironment(env, env->dir.x * moveSpeed, env->dir.y * moveSpeed);
+    if(held & INPUT_BACK)
+        moveEnvironment(env, -1 * env->dir.x * moveSpeed, -1 * env->dir.y * moveSpeed);
+    while(turns--) {
+        if(held & INPUT_LEFT)
+            turnEnvironment(env, batch->leftTurn);
+        if(held & INPUT_RIGHT)
+            turnEnvironment(env, batch->rightTurn);
+    }
+}
+
+/* Work shared by the jobs of a stepEnvironments call */
+typedef struct {
+    EnvironmentBatch* batch;
+    const Uint8* actions;
+} EnvironmentStep;
+
+void stepEnvironmentRange(int begin, int end, void* context) {
+    const EnvironmentStep* step = context;
+    EnvironmentBatch* batch = step->batch;
+    int i;
+
+    for(i = begin; i < end; i++) {
+        if(step->actions)
+            applyEnvironmentInput(batch, &batch->envs[i], step->actions[i]);
+        drawEnvironment(batch, &batch->envs[i]);
+    }
+}
+
+EnvironmentBatch* createEnvironmentBatch(int count, int width, int height, int flags) {
+    EnvironmentBatch* batch;
+    size_t frameSize = (size_t)width * height * ((flags & ENV_INDEXED) ? sizeof(Uint8) : sizeof(Uint32));
+    float angle;
+    int i;
+
+    if(flags & ENV_DEPTH)
+        frameSize = (size_t)width * sizeof(EnvironmentDepth);
+
+    if(count <= 0 || width <= 0 || height <= 0)
+        return NULL;
+
+    batch = calloc(1, sizeof(EnvironmentBatch));
+    if(!batch)
+        return NULL;
+    batch->envs = calloc(count, sizeof(Environment));
+    batch->observations = malloc(frameSize * count);
+    if(flags & ENV_PANORAMA)
+        batch->panoramaRays = malloc(width * sizeof(Vector2f));
+    if(!batch->envs || !batch->observations || ((flags & ENV_PANORAMA) && !batch->panoramaRays)) {
+        destroyEnvironmentBatch(batch);
+        return NULL;
+    }
+
+    batch->count = count;
+    batch->width = width;
+    batch->height = height;
+    batch->flags = flags;
+    batch->distFromViewplane = (width / 2.0f) / (float)(tan(FOV / 2.0f));
+
+    /*
+     * A panorama wraps the view around a cylinder as many pixels round as
+     * the view is wide, and its radius takes the place of the viewplane
+     * distance. Columns are centered in their slice of the circle, with
+     * the middle of the view straight ahead.
+     */
+    if(flags & ENV_PANORAMA) {
+        batch->distFromViewplane = width / (2.0f * PI);
+        for(i = 0; i < width; i++) {
+            angle = 2.0f * PI * (i + 0.5f) / width - PI;
+            batch->panoramaRays[i] = vec2((float)cos(angle), (float)sin(angle));
+        }
+    }
+    batch->leftTurn = rotation2f(-1.0f * PLAYER_ROT_SPEED);
+    batch->rightTurn = rotation2f(PLAYER_ROT_SPEED);
+
+    /* Everyone starts out in the global map where the player does */
+    for(i = 0; i < count; i++) {
+        batch->envs[i].observation = (Uint8*)batch->observations + frameSize * i;
+        setEnvironmentMap(batch, i, &MAP[0][0], MAP_GRID_WIDTH, MAP_GRID_HEIGHT);
+        placeEnvironment(batch, i, playerPos.x, playerPos.y, (float)atan2(playerDir.y, playerDir.x));
+    }
+
+    return batch;
+}
+
+void destroyEnvironmentBatch(EnvironmentBatch* batch) {
+    if(!batch)
+        return;
+    free(batch->envs);
+    free(batch->observations);
+    free(batch->panoramaRays);
+    free(batch);
+}
+
+void setEnvironmentMap(EnvironmentBatch* batch, int index, const short* map, int mapWidth, int mapHeight) {
+    Environment* env = &batch->envs[index];
+
+    env->map = map;
+    env->mapWidth = mapWidth;
+    env->mapHeight = mapHeight;
+}
+
+void placeEnvironment(EnvironmentBatch* batch, int index, float x, float y, float angle) {
+    Environment* env = &batch->envs[index];
+
+    env->pos = vec2(x, y);
+    env->dir = vec2((float)cos(angle), (float)sin(angle));
+    env->plane = vec2(-env->dir.y, env->dir.x);
+}
+
+void stepEnvironments(EnvironmentBatch* batch, const Uint8* actions) {
+    EnvironmentStep step;
+
+    step.batch = batch;
+    step.actions = actions;
+    parallelFor(batch->count, ENV_STEP_GRAIN, stepEnvironmentRange, &step);
+}
+
+float benchmarkEnvironments(int count, int steps) {
+    EnvironmentBatch* batch = createEnvironmentBatch(count, ENV_BENCH_SIZE, ENV_BENCH_SIZE, ENV_TEXTURED);
+    Uint8* actions = malloc(count);
+    Uint32 start, elapsed;
+    int i, s;
+
+    if(!batch || !actions) {
+        destroyEnvironmentBatch(batch);
+        free(actions);
+        return 0.0f;
+    }
+
+    /* Spread everyone out a little so the views differ */
+    srand(1);
+    for(i = 0; i < count; i++)
+        placeEnvironment(batch, i, playerPos.x, playerPos.y, rand() / (float)RAND_MAX * 2.0f * PI);
+
+    start = SDL_GetTicks();
+    for(s = 0; s < steps; s++) {
+        for(i = 0; i < count; i++)
+            actions[i] = (Uint8)(rand() & INPUT_HELD_MASK);
+        stepEnvironments(batch, actions);
+    }
+    elapsed = SDL_GetTicks() - start;
+
+    destroyEnvironmentBatch(batch);
+    free(actions);
+    return (float)count * steps * 1000.0f / (float)MAX(elapsed, 1);
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "header/main.h"
+
+/*
+ * Finished frames are published into a ring of slots in named shared
+ * memory. Every slot is guarded by a sequence counter (a seqlock): the
+ * renderer makes it odd, writes the slot, makes it even again, then
+ * points the ring header at the slot. Readers never take a lock and
+ * the renderer never waits for them; a reader checks the counter
+ * before and after using a slot and discards what it read if the slot
+ * was rewritten in the meantime. With several slots a frame stays
+ * intact for that many frames after it was published.
+ */
+
+/* Globals */
+MemoryMapping frameRingMapping;
+FrameRingHeader* frameRing = NULL;
+Uint64 publishedFrames = 0;
+
+
+FrameSlotHeader* getFrameSlot(const FrameRingHeader* ring, int slot) {
+    return (FrameSlotHeader*)((Uint8*)ring + ring->headerSize + (size_t)ring->slotSize * slot);
+}
+
+void* getFrameSlotPixels(const FrameSlotHeader* slot) {
+    return (Uint8*)slot + FRAME_SLOT_HEADER_SIZE;
+}
+
+int openFrameRing(const char* name, int slots) {
+    size_t pixelBytes = (WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(Uint32) + FRAME_RING_ALIGN - 1) & ~(size_t)(FRAME_RING_ALIGN - 1);
+    int i;
+
+    if(frameRing)
+        return FALSE;
+    slots = MIN(MAX(slots, 2), MAX_FRAME_RING_SLOTS);
+
+    if(!mapSharedMemory(&frameRingMapping, name, FRAME_RING_HEADER_SIZE + (FRAME_SLOT_HEADER_SIZE + pixelBytes) * slots, TRUE))
+        return FALSE;
+
+    /* New shared memory is zeroed, so every slot starts out even and empty */
+    frameRing = frameRingMapping.data;
+    frameRing->version = FRAME_RING_VERSION;
+    frameRing->slotCount = slots;
+    frameRing->headerSize = FRAME_RING_HEADER_SIZE;
+    frameRing->slotSize = (Uint32)(FRAME_SLOT_HEADER_SIZE + pixelBytes);
+    frameRing->maxWidth = WINDOW_WIDTH;
+    frameRing->maxHeight = WINDOW_HEIGHT;
+    SDL_AtomicSet(&frameRing->latest, -1);
+    for(i = 0; i < slots; i++)
+        SDL_AtomicSet(&getFrameSlot(frameRing, i)->sequence, 0);
+    publishedFrames = 0;
+
+    /* Readers check the magic last, once everything else is in place */
+    SDL_MemoryBarrierRelease();
+    frameRing->magic = FRAME_RING_MAGIC;
+    return TRUE;
+}
+
+FrameSlotHeader* beginFramePublish(int format, int width, int height, int pitch) {
+    int index = (int)(publishedFrames % frameRing->slotCount);
+    FrameSlotHeader* slot = getFrameSlot(frameRing, index);
+
+    /* Odd: readers of this slot will retry or move on */
+    SDL_AtomicAdd(&slot->sequence, 1);
+    SDL_MemoryBarrierRelease();
+
+    slot->format = format;
+    slot->width = width;
+    slot->height = height;
+    slot->pitch = pitch;
+    slot->frameIndex = publishedFrames;
+    slot->timestamp = SDL_GetPerformanceCounter() * 1000000 / SDL_GetPerformanceFrequency();
+    return slot;
+}
+
+void endFramePublish(FrameSlotHeader* slot) {
+    int index = (int)(publishedFrames % frameRing->slotCount);
+
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicAdd(&slot->sequence, 1);
+    SDL_AtomicSet(&frameRing->latest, index);
+    publishedFrames++;
+}
+
+void publishFrame(const Uint32* pixels) {
+    FrameSlotHeader* slot;
+
+    if(!frameRing)
+        return;
+    slot = beginFramePublish(FRAME_ABGR8888, WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_WIDTH * sizeof(Uint32));
+    memcpy(getFrameSlotPixels(slot), pixels, WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(Uint32));
+    endFramePublish(slot);
+}
+
+void publishIndexedFrame(const Uint8* pixels, const Uint32* palette) {
+    FrameSlotHeader* slot;
+
+    if(!frameRing)
+        return;
+    slot = beginFramePublish(FRAME_INDEXED8, WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_WIDTH);
+    memcpy(slot->palette, palette, sizeof(slot->palette));
+    memcpy(getFrameSlotPixels(slot), pixels, WINDOW_WIDTH * WINDOW_HEIGHT);
+    endFramePublish(slot);
+}
+
+void closeFrameRing() {
+    if(!frameRing)
+        return;
+    fprintf(stderr, "Published %lu frames\n", (unsigned long)publishedFrames);
+    unmapMemory(&frameRingMapping);
+    frameRing = NULL;
+}
+
+int attachFrameRing(FrameRingReader* reader, const char* name) {
+    FrameRingHeader* ring;
+
+    if(!mapSharedMemory(&reader->mapping, name, 0, FALSE))
+        return FALSE;
+
+    ring = reader->mapping.data;
+    if(reader->mapping.size < FRAME_RING_HEADER_SIZE || ring->magic != FRAME_RING_MAGIC || ring->version != FRAME_RING_VERSION
+        || reader->mapping.size < ring->headerSize + (size_t)ring->slotSize * ring->slotCount) {
+        unmapMemory(&reader->mapping);
+        return FALSE;
+    }
+    SDL_MemoryBarrierAcquire();
+
+    reader->ring = ring;
+    return TRUE;
+}
+
+const FrameSlotHeader* readLatestFrame(const FrameRingReader* reader, int* sequence) {
+    const FrameSlotHeader* slot;
+    int latest, tries;
+
+    for(tries = 0; tries < FRAME_RING_READ_TRIES; tries++) {
+        latest = SDL_AtomicGet((SDL_atomic_t*)&reader->ring->latest);
+        if(latest < 0 || latest >= (int)reader->ring->slotCount)
+            return NULL;
+
+        slot = getFrameSlot(reader->ring, latest);
+        *sequence = SDL_AtomicGet((SDL_atomic_t*)&slot->sequence);
+        SDL_MemoryBarrierAcquire();
+
+        /* Even means no write is under way */
+        if(!(*sequence & 1))
+            return slot;
+    }
+
+    return NULL;
+}
+
+int isFrameIntact(const FrameSlotHeader* slot, int sequence) {
+    SDL_MemoryBarrierAcquire();
+    return SDL_AtomicGet((SDL_atomic_t*)&slot->sequence) == sequence;
+}
+
+void detachFrameRing(FrameRingReader* reader) {
+    unmapMemory(&reader->mapping);
+    reader->ring = NULL;
+}
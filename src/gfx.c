@@ -16,8 +16,10 @@
 #include <stdio.h>
 #include "header/main.h"
 
-/* Used to identify a texture structure in memory */
-#define TEX_TAG 0x55AA
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GFX_X86_SIMD
+#endif
 
 /* Error string buffer */
 char errstr[256];
@@ -25,19 +27,34 @@ char errstr[256];
 /*
  * SDL textures are stored in VRAM, so we need to manage
  * a RAM-persistent copy of the texture's pixel data that we
- * can write to. Allocated textures are stored in a linked
- * list so we can keep track of them all easily.
+ * can write to. Pixel data is carved out of large arena chunks
+ * owned by a texture set, always TEXTURE_ALIGNMENT aligned, and
+ * described by an entry in a separate handle table. Freed blocks
+ * stay with their set and are reused by later allocations, so
+ * swapping a set of textures for one of the same sizes costs
+ * no calls to malloc at all.
  */
-typedef struct ManagedTexture_ ManagedTexture_;
-struct ManagedTexture_ {
-    void* pixelData; /* RAM copy of the texture */
-    SDL_Texture* texture;
+typedef struct {
+    void* pixelData;        /* RAM copy of the texture, NULL if the entry is unused */
+    SDL_Texture* texture;   /* NULL for memory-only blocks */
     Uint32 pitch;
-    ManagedTexture_* next;
-    ManagedTexture_* prev;
-    Uint16 magicTag;
-};
-ManagedTexture_* managedTextures = NULL;
+    size_t blockSize;       /* Bytes reserved for pixelData */
+    TextureSet set;         /* Owning set */
+    char inUse;             /* Zero for a freed block waiting for reuse */
+} TextureHandle_;
+
+typedef struct {
+    void* memory;           /* As returned by malloc, NULL if the chunk is unused */
+    Uint8* base;            /* First aligned byte */
+    size_t size;
+    size_t used;
+    TextureSet set;         /* Owning set */
+} TextureChunk_;
+
+TextureHandle_ textureHandles[MAX_TEXTURES];
+TextureChunk_ textureChunks[MAX_TEXTURE_CHUNKS];
+char textureSetUsed[MAX_TEXTURE_SETS] = {TRUE}; /* The default set always exists */
+int lastTextureHandle = 0;
 
 /* SDL Stuff */
 SDL_Window* window = NULL;
@@ -46,6 +63,9 @@ SDL_Renderer* renderer = NULL;
 unsigned int screenWidth  = -1;
 unsigned int screenHeight = -1;
 
+/* CPU features, probed once in initGFX */
+char gfxHasAVX2 = 0;
+
 /*========================================================
  * Library debug functions
  *========================================================
@@ -88,6 +108,10 @@ int initGFX(char* title, unsigned int width, unsigned int height) {
 
     SDL_SetWindowTitle(window, title);
 
+#ifdef GFX_X86_SIMD
+    gfxHasAVX2 = SDL_HasAVX2();
+#endif
+
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     SDL_RenderClear(renderer);
     SDL_RenderPresent(renderer);
@@ -95,89 +119,203 @@ int initGFX(char* title, unsigned int width, unsigned int height) {
     return 1;
 }
 
-void* createTexture(unsigned int width, unsigned int height) {
-    Uint32* data;
-    ManagedTexture_* newmtex;
+/*========================================================
+ * Texture memory
+ *========================================================
+ */
+
+TextureHandle_* findTextureHandle(void* ptr) {
+    int i;
+
+    /* The same texture tends to be looked up over and over (e.g. the screen buffer) */
+    if(ptr && textureHandles[lastTextureHandle].pixelData == ptr && textureHandles[lastTextureHandle].inUse)
+        return &textureHandles[lastTextureHandle];
+
+    for(i = 0; ptr && i < MAX_TEXTURES; i++) {
+        if(textureHandles[i].pixelData == ptr && textureHandles[i].inUse) {
+            lastTextureHandle = i;
+            return &textureHandles[i];
+        }
+    }
+
+    gfxSetError("Not a valid texture pointer", 0);
+    return NULL;
+}
+
+Uint8* allocFromChunks(TextureSet set, size_t size) {
+    TextureChunk_* chunk = NULL;
+    size_t chunkSize = MAX(size, TEXTURE_CHUNK_SIZE);
+    Uint8* block;
+    int i;
+
+    for(i = 0; i < MAX_TEXTURE_CHUNKS; i++) {
+        if(textureChunks[i].memory && textureChunks[i].set == set && textureChunks[i].size - textureChunks[i].used >= size) {
+            chunk = &textureChunks[i];
+            break;
+        }
+    }
+
+    /* Start a new chunk; oversized blocks get a chunk of their own */
+    if(!chunk) {
+        for(i = 0; i < MAX_TEXTURE_CHUNKS && textureChunks[i].memory; i++);
+        if(i == MAX_TEXTURE_CHUNKS) {
+            gfxSetError("Out of texture chunks", 0);
+            return NULL;
+        }
+
+        chunk = &textureChunks[i];
+        chunk->memory = malloc(chunkSize + TEXTURE_ALIGNMENT - 1); if(!chunk->memory) { return NULL; }
+        chunk->base = (Uint8*)(((size_t)chunk->memory + TEXTURE_ALIGNMENT - 1) & ~(size_t)(TEXTURE_ALIGNMENT - 1));
+        chunk->size = chunkSize;
+        chunk->used = 0;
+        chunk->set = set;
+    }
+
+    block = chunk->base + chunk->used;
+    chunk->used += size;
+    return block;
+}
+
+TextureHandle_* allocTextureHandle(TextureSet set, size_t bytes) {
+    TextureHandle_* handle = NULL;
+    int i;
+
+    if(set < 0 || set >= MAX_TEXTURE_SETS || !textureSetUsed[set]) {
+        gfxSetError("Not a valid texture set", 0);
+        return NULL;
+    }
+
+    /* Keep every block a whole number of alignment units so the next one stays aligned */
+    bytes = (bytes + TEXTURE_ALIGNMENT - 1) & ~(size_t)(TEXTURE_ALIGNMENT - 1);
+
+    /* Reuse a freed block from the same set if one is big enough */
+    for(i = 0; i < MAX_TEXTURES; i++) {
+        if(textureHandles[i].pixelData && !textureHandles[i].inUse && textureHandles[i].set == set && textureHandles[i].blockSize >= bytes) {
+            handle = &textureHandles[i];
+            break;
+        }
+    }
+
+    if(!handle) {
+        for(i = 0; i < MAX_TEXTURES && textureHandles[i].pixelData; i++);
+        if(i == MAX_TEXTURES) {
+            gfxSetError("Out of texture handles", 0);
+            return NULL;
+        }
+
+        handle = &textureHandles[i];
+        handle->pixelData = allocFromChunks(set, bytes); if(!handle->pixelData) { return NULL; }
+        handle->blockSize = bytes;
+        handle->set = set;
+    }
+
+    handle->texture = NULL;
+    handle->pitch = 0;
+    handle->inUse = TRUE;
+    return handle;
+}
+
+TextureSet createTextureSet() {
+    int i;
+
+    for(i = 1; i < MAX_TEXTURE_SETS; i++) {
+        if(!textureSetUsed[i]) {
+            textureSetUsed[i] = TRUE;
+            return i;
+        }
+    }
+
+    gfxSetError("Out of texture sets", 0);
+    return -1;
+}
+
+void destroyTextureSet(TextureSet set) {
+    int i;
+
+    if(set < 0 || set >= MAX_TEXTURE_SETS || !textureSetUsed[set])
+        return;
+
+    for(i = 0; i < MAX_TEXTURES; i++) {
+        if(textureHandles[i].pixelData && textureHandles[i].set == set) {
+            if(textureHandles[i].texture) SDL_DestroyTexture(textureHandles[i].texture);
+            textureHandles[i].pixelData = NULL;
+            textureHandles[i].texture = NULL;
+            textureHandles[i].inUse = FALSE;
+        }
+    }
+
+    /* All of the set's memory goes at once */
+    for(i = 0; i < MAX_TEXTURE_CHUNKS; i++) {
+        if(textureChunks[i].memory && textureChunks[i].set == set) {
+            free(textureChunks[i].memory);
+            textureChunks[i].memory = NULL;
+        }
+    }
+
+    if(set != DEFAULT_TEXTURE_SET)
+        textureSetUsed[set] = FALSE;
+}
+
+void* allocTextureMemory(TextureSet set, size_t bytes) {
+    TextureHandle_* handle = allocTextureHandle(set, bytes);
+    return handle ? handle->pixelData : NULL;
+}
+
+void* createTextureIn(TextureSet set, unsigned int width, unsigned int height) {
+    TextureHandle_* handle;
+    SDL_Texture* texture;
+
     if(!width || !height || !renderer) {
         gfxSetError("SDL window has not been initialized yet", 0);
         return NULL;
     }
 
-    newmtex = malloc(sizeof(ManagedTexture_)); if(!newmtex) { return NULL; }
-    newmtex->pitch = width * sizeof(Uint32);
-    newmtex->next = NULL;
-    newmtex->prev = NULL;
-    newmtex->magicTag  = TEX_TAG;
-
-    newmtex->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, width, height);
-    if(!(newmtex->texture)) {
-        free(newmtex);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if(!texture) {
         gfxSetError("Could not create texture", 1);
         return NULL;
     }
 
-    data = malloc((sizeof(Uint32) * width * height) + sizeof(ManagedTexture_*)); if(!data) {free(newmtex); return NULL; }
-
-    /*
-     * Hide a pointer to the managed struct before the actual pixel data.
-     *
-     * This allows the caller to only have to worry about the data they
-     * want, while still allowing this library to perform more complicated
-     * management tasks given only a reference to the pixel data.
-     */
-    *((ManagedTexture_**)data) = newmtex;
-    newmtex->pixelData = ((ManagedTexture_**)data) + 1;
-
-    /* Insert the item into the linked list */
-    if(managedTextures) {
-        newmtex->next = managedTextures;
-        managedTextures->prev = newmtex;
+    handle = allocTextureHandle(set, sizeof(Uint32) * width * height);
+    if(!handle) {
+        SDL_DestroyTexture(texture);
+        return NULL;
     }
-    managedTextures = newmtex;
 
+    handle->texture = texture;
+    handle->pitch = width * sizeof(Uint32);
+    return handle->pixelData;
+}
 
-    return newmtex->pixelData;
+void* createTexture(unsigned int width, unsigned int height) {
+    return createTextureIn(DEFAULT_TEXTURE_SET, width, height);
 }
 
 int destroyTexture(void* ptr) {
-    /* Recover the memory management structure before freeing anything */
-    ManagedTexture_* mtex = *(((ManagedTexture_**)ptr) - 1);
+    TextureHandle_* handle = findTextureHandle(ptr);
 
-    /* Don't do anything if it's not actually a managed structure */
-    if(mtex->magicTag != TEX_TAG) {
-        gfxSetError("Not a valid texture pointer", 0);
+    /* Don't do anything if it's not actually a managed texture */
+    if(!handle)
         return 0;
-    }
 
-    /* Prevent this structure from being somehow sent here again */
-    mtex->magicTag = 0;
-
-    /* Actual cleanup */
-    free(((ManagedTexture_**)ptr) - 1);
-
-    SDL_DestroyTexture(mtex->texture);
-
-    if(mtex->prev) mtex->prev->next = mtex->next;
-    if(mtex->next) mtex->next->prev = mtex->prev;
-    if(managedTextures == mtex) managedTextures = mtex->next;
-    free(mtex);
+    /* The block stays with its set for reuse */
+    if(handle->texture) SDL_DestroyTexture(handle->texture);
+    handle->texture = NULL;
+    handle->inUse = FALSE;
 
     return 1;
 }
 
 void displayFullscreenTexture(void* texture) {
-    ManagedTexture_* mtex;
+    TextureHandle_* mtex;
 
     if(!window || !renderer) {
         gfxSetError("SDL window has not been initialized yet", 0);
         return;
     }
 
-    /* Recover the managed texture structure */
-    mtex = *(((ManagedTexture_**)texture) - 1);
-
     /* Don't do anything if it's not actually a managed texture */
-    if(mtex->magicTag != TEX_TAG) {
+    if(!(mtex = findTextureHandle(texture)) || !mtex->texture) {
         gfxSetError("Not a valid texture pointer", 0);
         return;
     }
@@ -189,10 +327,91 @@ void displayFullscreenTexture(void* texture) {
     SDL_RenderPresent(renderer);
 }
 
+/*
+ * Palette expansion kernels. Each expands one row of 8-bit indices into
+ * ABGR pixels; the AVX2 variant looks up 8 entries per gather.
+ */
+#ifdef GFX_X86_SIMD
+__attribute__((target("avx2")))
+static void expandIndexedRowAVX2(Uint32* dst, const Uint8* src, int count, const Uint32* palette) {
+    int i;
+    __m256i idx;
+
+    for(i = 0; i + 8 <= count; i += 8) {
+        idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)palette, idx, 4));
+    }
+    for(; i < count; i++)
+        dst[i] = palette[src[i]];
+}
+#endif
+
+static void expandIndexedRow(Uint32* dst, const Uint8* src, int count, const Uint32* palette) {
+    int i;
+
+#if defined(GFX_X86_SIMD) && defined(__SSE2__)
+    for(i = 0; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_set_epi32(palette[src[i + 3]], palette[src[i + 2]], palette[src[i + 1]], palette[src[i]]));
+#else
+    i = 0;
+#endif
+    for(; i < count; i++)
+        dst[i] = palette[src[i]];
+}
+
+void displayFullscreenIndexedTexture(void* texture, const Uint8* pixels, const Uint32* palette) {
+    TextureHandle_* mtex;
+    void* locked;
+    int lockedPitch;
+    unsigned int y;
+
+    if(!window || !renderer) {
+        gfxSetError("SDL window has not been initialized yet", 0);
+        return;
+    }
+
+    /* Don't do anything if it's not actually a managed texture */
+    if(!(mtex = findTextureHandle(texture)) || !mtex->texture) {
+        gfxSetError("Not a valid texture pointer", 0);
+        return;
+    }
+
+    if(mtex->pitch != screenWidth * sizeof(Uint32)) {
+        gfxSetError("Texture is not the size of the window", 0);
+        return;
+    }
+
+    /* Expand straight into the streaming texture, skipping the RAM copy */
+    if(SDL_LockTexture(mtex->texture, NULL, &locked, &lockedPitch) < 0) {
+        gfxSetError("Could not lock texture", 1);
+        return;
+    }
+
+    for(y = 0; y < screenHeight; y++) {
+        Uint32* dst = (Uint32*)((Uint8*)locked + y * lockedPitch);
+        const Uint8* src = pixels + y * screenWidth;
+#ifdef GFX_X86_SIMD
+        if(gfxHasAVX2)
+            expandIndexedRowAVX2(dst, src, screenWidth, palette);
+        else
+#endif
+            expandIndexedRow(dst, src, screenWidth, palette);
+    }
+
+    SDL_UnlockTexture(mtex->texture);
+
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, mtex->texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
+
 
 void destroyGFX() {
+    int i;
+
     /* Destroy all allocated textures */
-    while(managedTextures) destroyTexture(managedTextures->pixelData);
+    for(i = 0; i < MAX_TEXTURE_SETS; i++)
+        destroyTextureSet(i);
 
     /* Clean everything else up */
     if(window && renderer) {
@@ -215,6 +434,10 @@ void setDrawColor(int r, int g, int b, int a) {
     SDL_SetRenderDrawColor(renderer, r, g, b, a);
 }
 
+void setDrawBlending(char enabled) {
+    SDL_SetRenderDrawBlendMode(renderer, enabled ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE);
+}
+
 void drawLine(int x1, int y1, int x2, int y2) {
     int xOffset = 0;
     int yOffset = 0;
@@ -234,6 +457,10 @@ void fillRect(int x, int y, int w, int h) {
     SDL_RenderFillRect(renderer, &rect);
 }
 
+void fillRects(const SDL_Rect* rects, int count) {
+    SDL_RenderFillRects(renderer, rects, count);
+}
+
 void drawRect(int x, int y, int w, int h) {
     SDL_Rect rect;
     rect.x = x;
@@ -256,30 +483,33 @@ void clearRenderer() {
  *========================================================
  */
 
-Uint32* generateXorTexture(int size, int redmask, int greenmask, int bluemask) {
+Uint32* generateXorTexture(TextureSet set, int size, int redmask, int greenmask, int bluemask) {
     int x, y;
     float factor = 256.0f / (float)size;
-    Uint32* texture = createTexture(size, size);
+    Uint32* texture = allocTextureMemory(set, sizeof(Uint32) * size * size);
+
+    if(!texture)
+        return NULL;
 
     for(x = 0; x < size; x++)
         for(y = 0; y < size; y++)
-            texture[(size * y) + x] = RGBtoABGR((int)((x ^ y) * factor) & redmask, (int)((x ^ y) * factor) & greenmask, (int)((x ^ y) * factor) & bluemask);
+            texture[(size * x) + y] = RGBtoABGR((int)((x ^ y) * factor) & redmask, (int)((x ^ y) * factor) & greenmask, (int)((x ^ y) * factor) & bluemask);
 
     return texture;
 }
 
-Uint32* generateRedXorTexture(int size) {
-    return generateXorTexture(size, 0xFF, 0x00, 0x00);
+Uint32* generateRedXorTexture(TextureSet set, int size) {
+    return generateXorTexture(set, size, 0xFF, 0x00, 0x00);
 }
 
-Uint32* generateGreenXorTexture(int size) {
-    return generateXorTexture(size, 0x00, 0xFF, 0x00);
+Uint32* generateGreenXorTexture(TextureSet set, int size) {
+    return generateXorTexture(set, size, 0x00, 0xFF, 0x00);
 }
 
-Uint32* generateBlueXorTexture(int size) {
-    return generateXorTexture(size, 0x00, 0x00, 0xFF);
+Uint32* generateBlueXorTexture(TextureSet set, int size) {
+    return generateXorTexture(set, size, 0x00, 0x00, 0xFF);
 }
 
-Uint32* generateGrayXorTexture(int size) {
-    return generateXorTexture(size, 0xFF, 0xFF, 0xFF);
+Uint32* generateGrayXorTexture(TextureSet set, int size) {
+    return generateXorTexture(set, size, 0xFF, 0xFF, 0xFF);
 }
@@ -0,0 +1,274 @@
+#ifndef LINALG_H
+#define LINALG_H
+
+#include <math.h>
+
+/*
+ * Header-only 2D vector math.
+ *
+ * Everything here is static inline and passes vectors by value so the
+ * compiler can keep them in registers inside the ray and strip loops.
+ * The Vector2fPair type packs two vectors into one SSE register, which
+ * matches how the raycaster always processes a vertical and horizontal
+ * ray side by side. Define LINALG_NO_SIMD to force the scalar fallback.
+ */
+
+#if defined(__SSE__) && !defined(LINALG_NO_SIMD)
+#include <xmmintrin.h>
+#define LINALG_SSE
+#endif
+
+#define MIN(A, B)      ((A) < (B) ? (A) : (B))
+#define MAX(A, B)      ((A) > (B) ? (A) : (B))
+
+/* Types */
+typedef struct {
+    float x;
+    float y;
+} Vector2f;
+
+/* A 2D rotation stored as its cosine and sine */
+typedef struct {
+    float c;
+    float s;
+} Rotation2f;
+
+/* Two 2D vectors laid out as {a.x, a.y, b.x, b.y} */
+typedef struct {
+#ifdef LINALG_SSE
+    __m128 v;
+#else
+    float v[4];
+#endif
+} Vector2fPair;
+
+
+/*========================================================
+ * Single vector operations
+ *========================================================
+ */
+
+/**
+ * Build a 2D vector from its components.
+ */
+static inline Vector2f vec2(float x, float y) {
+    Vector2f v;
+    v.x = x;
+    v.y = y;
+    return v;
+}
+
+/**
+ * Add two 2D vectors.
+ *
+ * Returns: a + b.
+ */
+static inline Vector2f vec2Add(Vector2f a, Vector2f b) {
+    return vec2(a.x + b.x, a.y + b.y);
+}
+
+/**
+ * Subtract one 2D vector from another.
+ *
+ * Returns: a - b.
+ */
+static inline Vector2f vec2Sub(Vector2f a, Vector2f b) {
+    return vec2(a.x - b.x, a.y - b.y);
+}
+
+/**
+ * Scale a 2D vector by a scalar.
+ *
+ * Returns: The scaled vector.
+ */
+static inline Vector2f vec2Scale(Vector2f v, float scalar) {
+    return vec2(v.x * scalar, v.y * scalar);
+}
+
+/**
+ * Find the dot product of two 2D vectors.
+ */
+static inline float vec2Dot(Vector2f a, Vector2f b) {
+    return a.x * b.x + a.y * b.y;
+}
+
+/**
+ * Get the squared magnitude of a 2D vector. Prefer this over
+ * vec2Length when only comparing lengths.
+ */
+static inline float vec2LengthSquared(Vector2f v) {
+    return v.x * v.x + v.y * v.y;
+}
+
+/**
+ * Get the magnitude (length) of a 2D vector.
+ */
+static inline float vec2Length(Vector2f v) {
+    return (float)sqrt(v.x * v.x + v.y * v.y);
+}
+
+/**
+ * Normalize a 2D vector (set its length to 1).
+ */
+static inline Vector2f vec2Normalize(Vector2f v) {
+    return vec2Scale(v, 1.0f / vec2Length(v));
+}
+
+/**
+ * Project a 2D vector onto another.
+ *
+ * v:    The vector to project.
+ * onto: The vector to project on to.
+ *
+ * Returns: The projected vector.
+ */
+static inline Vector2f vec2Project(Vector2f v, Vector2f onto) {
+    return vec2Scale(onto, vec2Dot(v, onto) / vec2LengthSquared(onto));
+}
+
+
+/*========================================================
+ * Rotations
+ *========================================================
+ */
+
+/**
+ * Build a rotation from an angle in radians.
+ */
+static inline Rotation2f rotation2f(float angle) {
+    Rotation2f r;
+    r.c = (float)cos(angle);
+    r.s = (float)sin(angle);
+    return r;
+}
+
+/**
+ * Rotate a 2D vector. Equivalent to multiplying it by the matrix
+ * {{c, -s}, {s, c}}.
+ */
+static inline Vector2f vec2Rotate(Vector2f v, Rotation2f r) {
+    return vec2(r.c * v.x - r.s * v.y, r.s * v.x + r.c * v.y);
+}
+
+/**
+ * Combine two rotations into one which applies a, then b.
+ */
+static inline Rotation2f rotation2fCompose(Rotation2f a, Rotation2f b) {
+    Rotation2f r;
+    r.c = a.c * b.c - a.s * b.s;
+    r.s = a.s * b.c + a.c * b.s;
+    return r;
+}
+
+
+/*========================================================
+ * Vector pair operations
+ *========================================================
+ */
+
+/**
+ * Pack two 2D vectors into a pair.
+ */
+static inline Vector2fPair vec2Pair(Vector2f a, Vector2f b) {
+    Vector2fPair p;
+#ifdef LINALG_SSE
+    p.v = _mm_setr_ps(a.x, a.y, b.x, b.y);
+#else
+    p.v[0] = a.x; p.v[1] = a.y; p.v[2] = b.x; p.v[3] = b.y;
+#endif
+    return p;
+}
+
+/**
+ * Get the first vector of a pair.
+ */
+static inline Vector2f vec2PairFirst(Vector2fPair p) {
+#ifdef LINALG_SSE
+    float f[4];
+    _mm_storeu_ps(f, p.v);
+    return vec2(f[0], f[1]);
+#else
+    return vec2(p.v[0], p.v[1]);
+#endif
+}
+
+/**
+ * Get the second vector of a pair.
+ */
+static inline Vector2f vec2PairSecond(Vector2fPair p) {
+#ifdef LINALG_SSE
+    float f[4];
+    _mm_storeu_ps(f, p.v);
+    return vec2(f[2], f[3]);
+#else
+    return vec2(p.v[2], p.v[3]);
+#endif
+}
+
+/**
+ * Store a pair into two vectors.
+ */
+static inline void vec2PairStore(Vector2fPair p, Vector2f* a, Vector2f* b) {
+#ifdef LINALG_SSE
+    float f[4];
+    _mm_storeu_ps(f, p.v);
+    a->x = f[0]; a->y = f[1]; b->x = f[2]; b->y = f[3];
+#else
+    a->x = p.v[0]; a->y = p.v[1]; b->x = p.v[2]; b->y = p.v[3];
+#endif
+}
+
+/**
+ * Add two pairs component-wise.
+ */
+static inline Vector2fPair vec2PairAdd(Vector2fPair a, Vector2fPair b) {
+    Vector2fPair p;
+#ifdef LINALG_SSE
+    p.v = _mm_add_ps(a.v, b.v);
+#else
+    p.v[0] = a.v[0] + b.v[0]; p.v[1] = a.v[1] + b.v[1];
+    p.v[2] = a.v[2] + b.v[2]; p.v[3] = a.v[3] + b.v[3];
+#endif
+    return p;
+}
+
+/**
+ * Scale the first vector of a pair by sa and the second by sb.
+ */
+static inline Vector2fPair vec2PairScale(Vector2fPair p, float sa, float sb) {
+#ifdef LINALG_SSE
+    p.v = _mm_mul_ps(p.v, _mm_setr_ps(sa, sa, sb, sb));
+#else
+    p.v[0] *= sa; p.v[1] *= sa; p.v[2] *= sb; p.v[3] *= sb;
+#endif
+    return p;
+}
+
+/**
+ * Find the dot products of the matching vectors of two pairs.
+ *
+ * da: Receives the dot product of the first vectors.
+ * db: Receives the dot product of the second vectors.
+ */
+static inline void vec2PairDot(Vector2fPair a, Vector2fPair b, float* da, float* db) {
+#ifdef LINALG_SSE
+    float f[4];
+    _mm_storeu_ps(f, _mm_mul_ps(a.v, b.v));
+    *da = f[0] + f[1];
+    *db = f[2] + f[3];
+#else
+    *da = a.v[0] * b.v[0] + a.v[1] * b.v[1];
+    *db = a.v[2] * b.v[2] + a.v[3] * b.v[3];
+#endif
+}
+
+/**
+ * Normalize both vectors of a pair.
+ */
+static inline Vector2fPair vec2PairNormalize(Vector2fPair p) {
+    float la, lb;
+    vec2PairDot(p, p, &la, &lb);
+    return vec2PairScale(p, 1.0f / (float)sqrt(la), 1.0f / (float)sqrt(lb));
+}
+
+#endif /* LINALG_H */
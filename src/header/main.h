@@ -4,6 +4,8 @@
 #include <SDL2/SDL.h>
 #include <math.h>
 
+#include "linalg.h"
+
 
 /* ========================================================== */
 /* ========================================================== */
@@ -15,6 +17,10 @@
 #define ONLY_FIRST_HIT 2
 extern char slowRenderMode;
 extern char rayCastMode;
+extern char indexedColorMode;
+extern char spanCastMode;
+extern char checkerboardMode;
+extern char fixedPointMode;
 
 /* Misc. constants */
 #define FALSE 0
@@ -25,6 +31,9 @@ extern char rayCastMode;
 /* Floating point operations */
 #define MAKE_FLOAT_NONZERO(A)  ((fabs((A)) < EPS) ? EPS : A) /* Make any value less than epsilon equal to epsilon */
 
+/* Game loop parameters */
+#define TICK_MS  10  /* Fixed delay between frames */
+
 /* Window parameters*/
 #define WINDOW_WIDTH  640
 #define WINDOW_HEIGHT 480
@@ -47,9 +56,13 @@ extern char rayCastMode;
 #define PLAYER_START_X    (2.5f * WALL_SIZE)
 #define PLAYER_START_Y    (2.5f * WALL_SIZE)
 
-/* Map constants */
+/* Map constants; builds streaming large worlds can widen the view of the world with -D */
+#ifndef MAP_GRID_WIDTH
 #define MAP_GRID_WIDTH    10
+#endif
+#ifndef MAP_GRID_HEIGHT
 #define MAP_GRID_HEIGHT   10
+#endif
 #define MAP_PIXEL_WIDTH   (MAP_GRID_WIDTH * WALL_SIZE)
 #define MAP_PIXEL_HEIGHT  (MAP_GRID_HEIGHT * WALL_SIZE)
 
@@ -59,13 +72,21 @@ extern char rayCastMode;
 #define G             2  /* Green wall */
 #define B             3  /* Blue wall */
 #define W             4  /* Gray wall */
+#define D             5  /* Sliding door */
+
+/* Map tile flags */
+#define PUSHWALL      0x10  /* The wall can be pushed by the player */
+#define PW(T)         ((T) | PUSHWALL)
+#define SEE_THROUGH   0x20  /* Solid, but rays carry on through it; drawn as a grate */
+#define ST(T)         ((T) | SEE_THROUGH)
+#define TILE_MATERIAL(T)  ((T) & 0x0F)
 
 #define CEILING_COLOR  RGBtoABGR(0x65, 0x65, 0x65)
 #define FLOOR_COLOR    RGBtoABGR(0xAA, 0xAA, 0xAA)
 
 
 /* Globals */
-extern const short MAP[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+extern short MAP[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
 extern char distortion;
 extern char textureMode;
 extern Uint32* screenBuffer;
@@ -90,6 +111,20 @@ extern Uint32* TEXTURES[];
  */
 #define RGBtoABGR(R,G,B)   (0xFF000000 | ((B) << 16) | ((G) << 8) | (R))
 
+/* Texture memory limits */
+#define TEXTURE_ALIGNMENT    64         /* Byte alignment of all texture memory */
+#define TEXTURE_CHUNK_SIZE   (1 << 20)  /* Bytes allocated at once for a texture set */
+#define MAX_TEXTURES         256
+#define MAX_TEXTURE_CHUNKS   64
+#define MAX_TEXTURE_SETS     16
+#define DEFAULT_TEXTURE_SET  0          /* Used by createTexture; always exists */
+
+/* A group of textures which share memory and are released together */
+typedef int TextureSet;
+
+/* CPU features, probed by initGFX */
+extern char gfxHasAVX2;
+
 
 /*========================================================
  * Library debug functions
@@ -126,7 +161,30 @@ int initGFX(char* title, unsigned int width, unsigned int height);
 void* createTexture(unsigned int width, unsigned int height);
 
 /**
- * Free a texture buffer from memory
+ * Create a texture buffer in a texture set
+ *
+ * set:    The set to allocate the texture from
+ * width:  The width of the texture buffer
+ * height: The height of the texture buffer
+ *
+ * Returns: A pointer to the texture pixel buffer
+ */
+void* createTextureIn(TextureSet set, unsigned int width, unsigned int height);
+
+/**
+ * Allocate aligned texture memory which is never drawn with SDL,
+ * e.g. mip chains and 8-bit textures. Free it with destroyTexture.
+ *
+ * set:   The set to allocate the memory from
+ * bytes: The number of bytes to allocate
+ *
+ * Returns: A pointer to the memory
+ */
+void* allocTextureMemory(TextureSet set, size_t bytes);
+
+/**
+ * Free a texture buffer from memory. The memory stays with the
+ * texture's set and is reused by later allocations from it.
  *
  * texture: A pointer to the texture to be destroyed
  *
@@ -134,6 +192,21 @@ void* createTexture(unsigned int width, unsigned int height);
  */
 int destroyTexture(void* texture);
 
+/**
+ * Create an empty texture set
+ *
+ * Returns: The new set, or -1 if there are too many sets
+ */
+TextureSet createTextureSet();
+
+/**
+ * Destroy every texture in a set and release all of its memory at once.
+ * The default set is emptied but stays usable.
+ *
+ * set: The set to destroy
+ */
+void destroyTextureSet(TextureSet set);
+
 /**
  * Draw a texture to the window's entire rendering area.
  *
@@ -143,6 +216,17 @@ int destroyTexture(void* texture);
  */
 void displayFullscreenTexture(void* texture);
 
+/**
+ * Expand an 8-bit indexed image through a palette and draw it to the
+ * window's entire rendering area. The expansion writes directly into
+ * the texture's video memory, so the texture's RAM copy is left untouched.
+ *
+ * texture: A pointer to a window-sized texture to upload into
+ * pixels:  The window-sized 8-bit indexed image
+ * palette: The 256-entry ABGR palette to expand through
+ */
+void displayFullscreenIndexedTexture(void* texture, const Uint8* pixels, const Uint32* palette);
+
 /**
  * Terminate the graphics environment and free all allocated resources
  */
@@ -164,6 +248,13 @@ void destroyGFX();
  */
 void setDrawColor(int r, int g, int b, int a);
 
+/**
+ * Turn alpha blending of primitives on or off
+ *
+ * enabled: Non-zero to blend with the draw color's alpha
+ */
+void setDrawBlending(char enabled);
+
 /**
  * Draw a line between two points on the screen
  *
@@ -184,6 +275,14 @@ void drawLine(int x1, int y1, int x2, int y2);
  */
 void fillRect(int x, int y, int w, int h);
 
+/**
+ * Draw a batch of filled rectangles to the screen in one call
+ *
+ * rects: The rectangles to draw
+ * count: The number of rectangles
+ */
+void fillRects(const SDL_Rect* rects, int count);
+
 /**
  * Draw the outline of a rectangle to the screen
  *
@@ -211,52 +310,58 @@ void clearRenderer();
  */
 
 /**
- * Generate an xor square texture
+ * Generate an xor square texture. It is plain texture memory which is
+ * never drawn with SDL, so it can be generated before there is a window.
  *
+ * set:       The set to allocate the texture from
  * size:      The size of the square texture in pixels
  * redmask:   The bitwise mask used on the red channel when picking colors to use
  * greenmask: The bitwise mask used on the green channel when picking colors to use
  * bluemask:  The bitwise mask used on the blue channel when picking colors to use
  *
- * Returns: A pointer to the generated texture
+ * Returns: A pointer to the generated texture, or NULL if it could not be allocated
  */
-Uint32* generateXorTexture(int size, int redmask, int greenmask, int bluemask);
+Uint32* generateXorTexture(TextureSet set, int size, int redmask, int greenmask, int bluemask);
 
 /**
  * Generate a red xor square texture
  *
+ * set:  The set to allocate the texture from
  * size: The size of the square texture in pixels
  *
- * Returns: A pointer to the generated texture
+ * Returns: A pointer to the generated texture, or NULL if it could not be allocated
  */
-Uint32* generateRedXorTexture(int size);
+Uint32* generateRedXorTexture(TextureSet set, int size);
 
 /**
  * Generate a green xor square texture
  *
+ * set:  The set to allocate the texture from
  * size: The size of the square texture in pixels
  *
- * Returns: A pointer to the generated texture
+ * Returns: A pointer to the generated texture, or NULL if it could not be allocated
  */
-Uint32* generateGreenXorTexture(int size);
+Uint32* generateGreenXorTexture(TextureSet set, int size);
 
 /**
  * Generate a blue xor square texture
  *
+ * set:  The set to allocate the texture from
  * size: The size of the square texture in pixels
  *
- * Returns: A pointer to the generated texture
+ * Returns: A pointer to the generated texture, or NULL if it could not be allocated
  */
-Uint32* generateBlueXorTexture(int size);
+Uint32* generateBlueXorTexture(TextureSet set, int size);
 
 /**
  * Generate a gray xor square texture
  *
+ * set:  The set to allocate the texture from
  * size: The size of the square texture in pixels
  *
- * Returns: A pointer to the generated texture
+ * Returns: A pointer to the generated texture, or NULL if it could not be allocated
  */
-Uint32* generateGrayXorTexture(int size);
+Uint32* generateGrayXorTexture(TextureSet set, int size);
 
 /* Gfx */
 /* ========================================================== */
@@ -268,140 +373,267 @@ Uint32* generateGrayXorTexture(int size);
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
-/* linalg */
+/* jobs */
 
-#define MIN(A, B)      ((A) < (B) ? (A) : (B))
-#define MAX(A, B)      ((A) > (B) ? (A) : (B))
+/* Constants */
+#define MAX_JOB_WORKERS  64
 
-/* A 3D identity matrix */
-#define IDENTITY_M     {{1,0,0},{0,1,0},{0,0,1}}
+/* Datatypes */
+typedef void (*JobFunction)(int begin, int end, void* context);
 
-/* A 2D homogeneous matrix */
-#define HOMOGENEOUS_V3 {0, 0, 1}
+/* Functions */
 
-/* Types */
-typedef struct {
-    float x;
-    float y;
-    float z;
-} Vector3f;
+/**
+ * Start the worker threads used by parallelFor.
+ *
+ * workerCount: The number of workers to start, or a negative
+ *              number to start one less than the number of CPUs.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int initJobs(int workerCount);
 
-typedef float Matrix3f[3][3];
+/**
+ * Stop all worker threads.
+ */
+void destroyJobs();
 
 /**
- * Add two 2D homogeneous vectors.
- * Since the output is homogeneous, its z component
- * is fixed to '1'.
+ * Run a function over an index range split across the worker threads.
+ * The calling thread takes part and the call returns once every index
+ * has been processed. Runs serially when there are no workers or when
+ * called from inside another parallelFor.
  *
- * vec1: The first vector.
- * vec2: The second vector.
+ * count:    The number of indices to process.
+ * grain:    The number of consecutive indices handed out at once.
+ * function: Called with each [begin, end) chunk of indices.
+ * context:  Passed through to the function.
+ */
+void parallelFor(int count, int grain, JobFunction function, void* context);
+
+/**
+ * As parallelFor, but with at most the given number of threads working
+ * on the range, counting the calling thread.
  *
- * Returns: The addition of vec1 and vec2.
+ * count:    The number of indices to process.
+ * grain:    The number of consecutive indices handed out at once.
+ * threads:  The most threads to use; zero or less to use them all.
+ * function: Called with each [begin, end) chunk of indices.
+ * context:  Passed through to the function.
  */
-Vector3f vectorAdd(Vector3f* vec1, Vector3f* vec2);
+void parallelForWorkers(int count, int grain, int threads, JobFunction function, void* context);
+
+/* jobs */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* mapping */
+
+/* Constants */
+#define MAX_MAPPING_NAME  64
+
+/* Datatypes */
+typedef struct {
+    void* data;
+    size_t size;
+    char owner;                     /* Created here; the name is removed again on unmap */
+#ifdef _WIN32
+    void* handle;
+#else
+    int fd;
+    char name[MAX_MAPPING_NAME];
+#endif
+} MemoryMapping;
+
+/* Functions */
 
 /**
- * Subtract one 2D homogeneous vector from another.
- * Since the output is homogeneous, its z component
- * is fixed to '1'.
+ * Map named shared memory which other processes can attach to.
  *
- * vec1: The first vector.
- * vec2: The second vector.
+ * mapping: Receives the mapping.
+ * name:    The name of the memory, e.g. "maze-frames".
+ * size:    The size in bytes when creating; ignored when attaching.
+ * create:  Non-zero to create the memory (replacing any left over
+ *          under the same name), zero to attach to existing memory.
  *
- * Returns: The subtraction of vec2 from vec1 (vec1 - vec2).
+ * Returns: Non-zero if successful, zero otherwise.
  */
-Vector3f vectorSubtract(Vector3f* vec1, Vector3f* vec2);
+int mapSharedMemory(MemoryMapping* mapping, const char* name, size_t size, char create);
 
 /**
- * Scale a homogeneous 2D vector by a scalar.
- * Since the output is homogeneous, its z component
- * is fixed to '1'.
+ * Map a whole file read-only. Pages are read in from the file as they
+ * are first touched and can be shared with other processes mapping it.
  *
- * vec:    The vector to scale.
- * scalar: The scalar to use.
+ * mapping: Receives the mapping.
+ * path:    The file to map.
  *
- * Returns: The scaled vector.
+ * Returns: Non-zero if successful, zero otherwise (or if the file is empty).
+ */
+int mapFile(MemoryMapping* mapping, const char* path);
+
+/**
+ * Unmap memory mapped with one of the functions above. Shared memory
+ * created by this process is removed once every process has unmapped it.
+ */
+void unmapMemory(MemoryMapping* mapping);
+
+/* mapping */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* map */
+
+/* Constants */
+#define MAX_MAP_LISTENERS   16
+#define MAX_MAP_MOVERS      512  /* Doors and pushwalls moving at once */
+#define MAP_TILE_GROUPS     6    /* Overhead map colors */
+#define DOOR_SPEED          4    /* World units a door slides per tick */
+#define PUSHWALL_TICKS      16   /* Ticks for a pushwall to move one cell */
+#define PUSHWALL_DISTANCE   2    /* Cells a pushwall moves when pushed */
+#define MAX_EMPTY_DISTANCE  255  /* Cap of the empty-space distance field */
+
+/* Datatypes */
+
+/* A rectangle of map cells */
+typedef struct {
+    int x, y;
+    int w, h;
+} MapRegion;
+
+/* Called with every region of the map which changed */
+typedef void (*MapListener)(const MapRegion* region, void* context);
+
+/* Global data */
+extern Uint16 doorOpenAmount[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];  /* 0 is closed, WALL_SIZE fully open */
+extern Uint32 mapCellVersion[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];  /* mapVersion of the last change to each cell */
+extern Uint32 mapVersion;                                       /* Bumped by every change */
+extern int seeThroughTileCount;                                 /* SEE_THROUGH cells on the map */
+
+/* Functions */
+
+/**
+ * Reset the dynamic map state and build the overhead map cache. Removes
+ * all map listeners, so call this before anything registers one.
  */
-Vector3f homogeneousVectorScale(Vector3f* vec, float scalar);
+void initMap();
 
 /**
- * Normalize a homogeneous 2D vector (set its length to 1)
- * Since the output is homogeneous, its z component
- * is fixed to '1'.
+ * Register a function to be told about map changes.
  *
- * vec: The vector to normalize.
+ * listener: The function to call.
+ * context:  Passed through to the function.
  *
- * Returns: The normalized vector.
+ * Returns: Non-zero if successful, zero if there are too many listeners.
  */
-Vector3f normalizeVector(Vector3f* vec);
+int addMapListener(MapListener listener, void* context);
 
 /**
- * Project a 2D vector onto another.
- * Since the output is homogeneous, its z component
- * is fixed to '1'.
- *
- * vec1: The vector to project.
- * vec2: The vector to project on to.
+ * Unregister a function added with addMapListener.
  *
- * Returns: The projected vector.
+ * listener: The function to remove.
+ * context:  The context it was added with.
  */
-Vector3f vectorProjection(Vector3f* vec1, Vector3f* vec2);
+void removeMapListener(MapListener listener, void* context);
 
 /**
- * Get the magnitude of a homogeneous 2D vector.
+ * Bump the version of a region of cells and report it to the map
+ * listeners. Call this after changing map state directly.
  *
- * vec: The vector to find the magnitude of.
+ * x: The leftmost cell of the region.
+ * y: The topmost cell of the region.
+ * w: The width of the region in cells.
+ * h: The height of the region in cells.
+ */
+void markMapRegionChanged(int x, int y, int w, int h);
+
+/**
+ * Change a map cell, e.g. to change a wall's material or to destroy it.
  *
- * Returns: The magnitude (length) of the vector.
+ * mapx:  The x coordinate of the cell.
+ * mapy:  The y coordinate of the cell.
+ * value: The new tile.
+ */
+void setMapCell(int mapx, int mapy, short value);
+
+/**
+ * Check whether a cell is a door which is at least partly open.
  */
-float homogeneousVectorMagnitude(Vector3f* vec);
+int isDoorOpening(int mapx, int mapy);
 
 /**
- * Find the dot product of two homogeneous 2D vectors.
+ * Check whether a point on the face of a cell falls in the gap left
+ * by an opening door.
  *
- * vec1: The first vector.
- * vec2: The second vector.
+ * mapx:  The x coordinate of the cell.
+ * mapy:  The y coordinate of the cell.
+ * along: The world coordinate of the point along the face.
  *
- * Returns: Dot product of the first and second vectors.
+ * Returns: Non-zero if a ray through the point passes the door.
  */
-float vectorDotProduct(Vector3f* vec1, Vector3f* vec2);
+int isInDoorGap(int mapx, int mapy, float along);
 
 /**
- * Multiply a 3D vector by a 3D square matrix.
+ * Get the Chebyshev distance, in cells, from a cell to the nearest wall
+ * or door. Every cell closer than that is empty. Kept up to date as the
+ * map changes.
  *
- * mat: The transformation matrix.
- * vec: The vector to be multiplied.
+ * Returns: 0 for walls, doors and cells off the map.
  */
-void matrixVectorMultiply(Matrix3f* mat, Vector3f* vec);
+int getEmptyDistance(int mapx, int mapy);
 
 /**
- * Multiply a matrix by another matrix.
- * The first matrix will hold the result.
+ * Start a door opening, or closing if it is open. A moving door is
+ * reversed.
  *
- * mat1: The first matrix.
- * mat2: The second matrix.
+ * Returns: Non-zero if the cell is a door.
  */
-void matrixMatrixMultiply(Matrix3f* mat1, Matrix3f* mat2);
+int toggleDoor(int mapx, int mapy);
 
 /**
- * Copy the values of one matrix into another.
+ * Start a pushwall sliding PUSHWALL_DISTANCE cells in a direction.
  *
- * dst: The destination matrix.
- * src: The source matrix.
+ * dx: The x step, -1, 0 or 1.
+ * dy: The y step, -1, 0 or 1.
+ *
+ * Returns: Non-zero if the cell is a pushwall which started moving.
  */
-void matrix3fCopy(Matrix3f* dst, Matrix3f* src);
+int pushWall(int mapx, int mapy, int dx, int dy);
 
-/* linalg */
-/* ========================================================== */
-/* ========================================================== */
-/* ========================================================== */
-/* ========================================================== */
+/**
+ * Use whatever is directly in front of a position: toggle a door or
+ * push a pushwall.
+ *
+ * pos: The world position to reach from.
+ * dir: The normalized direction to reach in.
+ *
+ * Returns: Non-zero if something was used.
+ */
+int interactWithMap(Vector2f pos, Vector2f dir);
 
-/* ========================================================== */
-/* ========================================================== */
-/* ========================================================== */
-/* ========================================================== */
-/* map */
+/**
+ * Advance moving doors and pushwalls by one tick.
+ */
+void updateMap();
+
+/**
+ * Move door states and moving doors and pushwalls along with map
+ * contents which were shifted so that the new cell (x, y) is the old
+ * cell (x + dx, y + dy). Anything shifted off the map is dropped. Does
+ * not touch MAP itself or report the change.
+ */
+void shiftMapState(int dx, int dy);
 
 /**
  * Render the overhead map to the screen.
@@ -418,51 +650,54 @@ void renderOverheadMap();
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
-/* player */
+/* visibility */
 
-/* Global data */
-extern Vector3f playerPos;
-extern Vector3f playerDir;
+/*
+ * Potentially visible sets for culling. The map is split into rooms,
+ * rectangles of open cells and single door cells, joined by portals.
+ * Every cell keeps a bitset of the rooms which might be seen from
+ * anywhere in it; nothing outside the set can be.
+ */
 
-/* Global toggles */
-extern char movingForward;
-extern char movingBack;
-extern char turningLeft;
-extern char turningRight;
-extern char playerIsRunning;
+/* Constants */
+#define PVS_MAX_ROOMS  256                   /* Maps with more rooms go without sets */
+#define PVS_WORDS      (PVS_MAX_ROOMS / 32)  /* Words in each cell's set */
 
-/* Functions */
+/* Global data */
+extern char visibilityEnabled;   /* Zero if the map has too many rooms */
+extern int visibilityRoomCount;
 
-/**
- * Initialize the player.
- */
-void initPlayer();
+/* Functions */
 
 /**
- * Update the player for the current frame.
+ * Split the map into rooms and build every cell's set. Registers a map
+ * listener which keeps the sets up to date: doors opening and shutting
+ * rebuild just the sets which could see them. Called by initMap.
  */
-void updatePlayer();
+void initVisibility();
 
 /**
- * Move the player by a given movement vector.
+ * Get the room a cell belongs to.
  *
- * dx: The x component of the movement vector.
- * dy: The y component of the movement vector.
+ * Returns: The room, or -1 for walls and cells off the map.
  */
-void movePlayer(float dx, float dy);
+int getCellRoom(int mapx, int mapy);
 
 /**
- * Check if a given movement vector intersects with the world
- * and should be clipped.
+ * Check whether anything in one cell might be seen from anywhere in
+ * another. Never wrong when it says no; cheap enough to call for every
+ * candidate.
  *
- * dx: The x component of the movement vector to check.
- * dy: The y component of the movement vector to check.
+ * fromx: The x coordinate of the cell looked from.
+ * fromy: The y coordinate of the cell looked from.
+ * tox:   The x coordinate of the cell looked at.
+ * toy:   The y coordinate of the cell looked at.
  *
- * Returns: Zero if the vector should not be clipped, non-zero otherwise.
+ * Returns: Zero if the cell can't be seen, non-zero if it might be.
  */
-int clipMovement(float dx, float dy);
+int isCellPotentiallyVisible(int fromx, int fromy, int tox, int toy);
 
-/* player */
+/* visibility */
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
@@ -472,173 +707,1352 @@ int clipMovement(float dx, float dy);
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
-/* raycaster */
+/* world */
 
-/* Constants */
-#define RAY_EPS   (WALL_SIZE / 3.0f)
+/*
+ * Worlds larger than the map are streamed from a file in square chunks.
+ * MAP becomes a window onto the world which follows the player; chunks
+ * are loaded on a background thread into a cache of fixed size, and
+ * the least recently wanted chunk is dropped to make room.
+ */
 
-/* Datatypes */
-typedef struct {
-    Vector3f vRay;
-    Vector3f hRay;
-} RayTuple;
+/* Constants */
+#define WORLD_CHUNK_SIZE          16          /* Cells along each side of a chunk */
+#ifndef WORLD_CACHE_BUDGET
+#define WORLD_CACHE_BUDGET        (4 << 20)   /* Bytes of decompressed chunks kept resident */
+#endif
+#define WORLD_QUEUE_SIZE          64          /* Chunk loads in flight */
+#define WORLD_PREFETCH_DISTANCE   64          /* Cells ahead of the player to load */
+#define WORLD_RECENTER_DISTANCE   (MIN(MAP_GRID_WIDTH, MAP_GRID_HEIGHT) / 4)  /* Cells off center before the window moves */
+#define WORLD_ROOM_SIZE           12          /* Room pitch of generated worlds */
 
 /* Global data */
-extern Vector3f viewplaneDir;
-extern float distFromViewplane;
-extern Matrix3f counterClockwiseRotation;
-extern Matrix3f clockwiseRotation;
-extern RayTuple rays[VIEWPLANE_LENGTH];
+extern int worldViewX;  /* World cell of MAP[0][0] */
+extern int worldViewY;
 
 /* Functions */
 
 /**
- * Initialize rays as a set of normalized vectors,
- * all pointing in their appropriate directions.
+ * Open a world file and center the map on its spawn point. Waits for
+ * the chunks under the map to load; the rest stream in as the player
+ * moves. Call after initMap and initPlayer.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
  */
-void initializeRayDirections();
+int openWorld(const char* path);
 
 /**
- * Set the length of rays in an array such that
- * they each extend from the player to their first
- * intersection in the world.
- *
- * rays: The input array of rays.
+ * Once per tick: take in loaded chunks, queue loads ahead of the
+ * player and the edges of the view, and move the map window if the
+ * player has strayed from its center. MAP only changes here, so the
+ * raycaster always sees a complete, stable window.
  */
-void extendRaysToFirstHit(RayTuple* rays);
+void updateWorld();
 
 /**
- * Find the stepping vector of a ray which will bring it
- * from one vertical world intersection to the next.
- *
- * ray: The ray to find the vertical step vector for.
- *
- * Returns: The vertical step vector.
+ * Stop the loader thread and release the chunk cache. Edits made to
+ * the map are not saved.
  */
-Vector3f findVerticalRayStepVector(Vector3f* ray);
+void closeWorld();
 
 /**
- * Find the stepping vector of a ray which will bring it
- * from one horizontal world intersection to the next.
+ * Write a procedurally generated world of rooms, open halls, pillars
+ * and doors. Written a chunk at a time, so the world never has to fit
+ * in memory.
  *
- * ray: The ray to find the horizontal step vector for.
+ * path: The file to write.
+ * size: The width and height of the world in cells.
+ * seed: Picks the layout.
  *
- * Returns: The horizontal step vector.
+ * Returns: Non-zero if successful, zero otherwise.
  */
-Vector3f findHorizontalRayStepVector(Vector3f* ray);
+int writeProceduralWorld(const char* path, Uint32 size, Uint32 seed);
 
 /**
- * Cast a list of prepared rays into the world.
+ * Little-endian reads and writes for the file formats.
+ */
+void putU16(Uint8* out, Uint32 value);
+void putU32(Uint8* out, Uint32 value);
+void putU64(Uint8* out, Uint64 value);
+Uint32 getU16(const Uint8* in);
+Uint32 getU32(const Uint8* in);
+Uint64 getU64(const Uint8* in);
+
+/* world */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* palette */
+
+/* Constants */
+#define PALETTE_SIZE         256
+#define PALETTE_RAMP_COUNT   4
+#define PALETTE_RAMP_LENGTH  (PALETTE_SIZE / PALETTE_RAMP_COUNT)
+#define LIGHT_LEVELS         32  /* Brightness steps of the light remaps */
+
+/* Macros */
+#define PALETTE_INDEX(RAMP, LEVEL)  (((RAMP) * PALETTE_RAMP_LENGTH) + (LEVEL))
+
+/* Global data */
+extern Uint32 PALETTE[PALETTE_SIZE];
+extern Uint8 darkenRemap[PALETTE_SIZE];
+extern Uint8 lightRemap[LIGHT_LEVELS][PALETTE_SIZE];   /* Each index at each light level */
+extern Uint8 INDEXED_COLORS[];
+extern Uint8 indexedCeilingColor;
+extern Uint8 indexedFloorColor;
+extern Uint8* INDEXED_TEXTURES[];
+extern Uint8* indexedScreenBuffer;
+
+/* Functions */
+
+/**
+ * Fill a palette with one brightness ramp per wall color.
  *
- * rays: The list of rays to cast.
+ * palette: The PALETTE_SIZE-entry palette to fill.
  */
-void raycast(RayTuple* rays);
+void buildRampPalette(Uint32* palette);
 
 /**
- * Get the tile coordinate (x, y) for the vertical intersection
- * point of a ray and the world.
+ * Find the palette entry closest to a given color.
  *
- * ray: The ray to find the tile coordinate for.
+ * palette:   The palette to search.
+ * ABGRColor: The color (ABGR) to match.
  *
- * Returns: The vertical intersection tile coordinate for the ray.
+ * Returns: The index of the closest palette entry.
  */
-Vector3f getTileCoordinateForVerticalRay(Vector3f* ray);
+Uint8 nearestPaletteIndex(const Uint32* palette, Uint32 ABGRColor);
 
 /**
- * Get the tile coordinate (x, y) for the horizontal intersection
- * point of a ray and the world.
+ * Quantize an ABGR texture (or a whole mip chain) to palette indices.
  *
- * ray: The ray to find the tile coordinate for.
+ * set:        The texture set to allocate the 8-bit texture from.
+ * texture:    The texture to quantize.
+ * texelCount: The number of texels in the texture.
+ * palette:    The palette to quantize against.
  *
- * Returns: The horizontal intersection tile coordinate for the ray.
+ * Returns: A pointer to the new 8-bit texture, or NULL on failure.
  */
-Vector3f getTileCoordinateForHorizontalRay(Vector3f* ray);
+Uint8* createIndexedTexture(TextureSet set, const Uint32* texture, int texelCount, const Uint32* palette);
 
 /**
- * Update the raycaster (setup and perform raycasting) for
- * the current frame.
+ * Initialize the indexed color pipeline: the palette, the shading
+ * remap tables, the 8-bit textures and the 8-bit screen buffer.
+ * TEXTURES must already be generated.
+ *
+ * set: The texture set to allocate the 8-bit textures from.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
  */
-void updateRaycaster();
+int initPalette(TextureSet set);
 
 /**
- * Initialize the raycaster.
+ * Free everything allocated by initPalette.
  */
-void initRaycaster();
+void destroyPalette();
 
-/* raycaster */
+/* palette */
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
 
-
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
-/* renderer */
+/* texture */
+
+/*
+ * Wall textures are stored column-major as mip chains: TEXTURE_SIZE
+ * squared texels for level 0, followed by each half-sized level down
+ * to 1x1. Walls are drawn one vertical strip at a time, so a column of
+ * any level is a contiguous run of texels.
+ */
+
+/* Constants */
+#define MAX_TEXTURE_MIP_LEVELS  16
 
 /* Macros */
-#define XY_TO_SCREEN_INDEX(X, Y)   (((Y) * WINDOW_WIDTH) + (X))
-#define XY_TO_TEXTURE_INDEX(X, Y)   (((Y) * TEXTURE_SIZE) + (X))
-#define DARKEN_COLOR(C)     ((((C) >> 1) & 0x7F7F7F7F) | 0xFF000000)
+#define MIP_COLUMN_OFFSET(LEVEL, X)  (textureMipOffsets[LEVEL] + ((X) * (TEXTURE_SIZE >> (LEVEL))))
 
-/* Enums */
-typedef enum {HORIZONTAL_RAY, VERTICAL_RAY} RayType;
+/* Global data */
+extern int textureMipLevels;
+extern int textureMipOffsets[MAX_TEXTURE_MIP_LEVELS];
+extern int textureChainLength;
 
 /* Functions */
 
 /**
- * Calculate the draw height of a pixel column for a given
- * ray length.
- *
- * rayLength: The ray length to use.
- *
- * Returns: The pixel height of a vertical column to draw.
+ * Compute the mip chain layout for TEXTURE_SIZE textures.
  */
-float calculateDrawHeight(float rayLength);
+void initMipLayout();
 
 /**
- * Draw a textured pixel column on the screen.
+ * Build a mip chain from a column-major TEXTURE_SIZE texture.
  *
- * x:          The x coordinate of the column.
- * wallYStart: The starting y coordinate of the pixel column.
- * length:     The length of the column.
- * textureX:   The texture column number to use for the strip.
- * texture:    The texture to use.
- * darken:     Non-zero if the strip should be darkened, zero otherwise.
+ * set:     The texture set to allocate the chain from.
+ * texture: The texture to use as level 0.
+ *
+ * Returns: A pointer to the new mip chain, or NULL on failure.
  */
-void drawTexturedStrip(int x, float wallYStart, float length, int textureX, Uint32* texture, char darken);
+Uint32* createMipChain(TextureSet set, const Uint32* texture);
 
 /**
- * Draw an un-textured pixel column on the screen.
+ * Free a mip chain created by createMipChain.
  *
- * x:          The x coordinate of the column.
- * wallYStart: The starting y coordinate of the pixel column.
- * length:     The length of the column.
- * ABGRColor:  The color (ABGR) to use.
- * darken:     Non-zero if the strip should be darkened, zero otherwise.
+ * chain: The mip chain to free.
  */
-void drawUntexturedStrip(int x, float wallYStart, float length, Uint32 ABGRColor, char darken);
+void destroyMipChain(void* chain);
 
 /**
- * Find the texture column number to use for a given ray.
+ * Pick the mip level to sample for a wall strip.
  *
- * ray:   The ray to use.
- * rtype: The type of ray intersection (see above definition of RayType)
+ * length: The projected height of the strip in pixels.
  *
- * Returns: The texture column number to use.
+ * Returns: The largest level with no more than two texels per pixel.
  */
-int getTextureColumnNumberForRay(Vector3f* ray, RayType rtype);
+int selectMipLevel(float length);
 
-/**
- * Get the barrel-distortion corrected ray length for a given ray.
+/* texture */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* player */
+
+/* Global data */
+extern Vector2f playerPos;
+extern Vector2f playerDir;
+
+/* Global toggles */
+extern char movingForward;
+extern char movingBack;
+extern char turningLeft;
+extern char turningRight;
+extern char playerIsRunning;
+
+/* Functions */
+
+/**
+ * Initialize the player.
+ */
+void initPlayer();
+
+/**
+ * Update the player for the current frame.
+ */
+void updatePlayer();
+
+/**
+ * Move the player by a given movement vector.
+ *
+ * dx: The x component of the movement vector.
+ * dy: The y component of the movement vector.
+ */
+void movePlayer(float dx, float dy);
+
+/**
+ * Check if a given movement vector intersects with the world
+ * and should be clipped.
+ *
+ * dx: The x component of the movement vector to check.
+ * dy: The y component of the movement vector to check.
+ *
+ * Returns: Zero if the vector should not be clipped, non-zero otherwise.
+ */
+int clipMovement(float dx, float dy);
+
+/* player */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* replay */
+
+/* Held input bits */
+#define INPUT_FORWARD    0x01
+#define INPUT_BACK       0x02
+#define INPUT_LEFT       0x04
+#define INPUT_RIGHT      0x08
+#define INPUT_RUN        0x10
+#define INPUT_HELD_MASK  0x1F
+
+/* One-shot actions */
+#define ACTION_TOGGLE_TEXTURE       0x0001UL
+#define ACTION_TOGGLE_INDEXED       0x0002UL
+#define ACTION_TOGGLE_MAP           0x0004UL
+#define ACTION_TOGGLE_DISTORTION    0x0008UL
+#define ACTION_CYCLE_CAST_MODE      0x0010UL
+#define ACTION_NARROW_FOV           0x0020UL
+#define ACTION_WIDEN_FOV            0x0040UL
+#define ACTION_QUIT                 0x0080UL
+#define ACTION_CYCLE_VIEWS          0x0100UL
+#define ACTION_TOGGLE_SPAN_CAST     0x0200UL
+#define ACTION_INTERACT             0x0400UL
+#define ACTION_TOGGLE_CHECKERBOARD  0x0800UL
+#define ACTION_TOGGLE_FIXED_POINT   0x1000UL
+#define ACTION_TOGGLE_LIGHTING      0x2000UL
+
+/* Replay modes */
+#define REPLAY_OFF        0
+#define REPLAY_RECORDING  1
+#define REPLAY_PLAYING    2
+
+/* Datatypes */
+typedef struct {
+    Uint8 held;     /* INPUT_* bits held down during the tick */
+    Uint32 actions; /* ACTION_* bits triggered during the tick */
+} InputFrame;
+
+/* Global data */
+extern char replayMode;
+
+/* Functions */
+
+/**
+ * Start recording input to a file. Every tick passed to
+ * recordInputFrame is appended until stopReplay is called.
+ *
+ * path: The file to record to.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int startRecording(const char* path);
+
+/**
+ * Start playing back input from a recorded file.
+ *
+ * path: The file to play back.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int startPlayback(const char* path);
+
+/**
+ * Append one tick of input to the recording, if recording.
+ *
+ * frame: The input state for the tick.
+ */
+void recordInputFrame(InputFrame* frame);
+
+/**
+ * Read the next tick of input from the replay.
+ *
+ * frame: Receives the input state for the tick.
+ *
+ * Returns: Non-zero if a tick was read, zero at the end of the replay.
+ */
+int readInputFrame(InputFrame* frame);
+
+/**
+ * Finish the current recording or playback and close its file.
+ */
+void stopReplay();
+
+/**
+ * Mark the start of a timed frame.
+ */
+void beginFrameTiming();
+
+/**
+ * Mark the end of a timed frame and store its duration.
+ */
+void endFrameTiming();
+
+/**
+ * Print the total and per-frame timing of all timed frames.
+ */
+void printFrameTimingReport();
+
+/* replay */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* capture */
+
+/* Capture formats */
+#define CAPTURE_OFF  0
+#define CAPTURE_Y4M  1  /* YUV4MPEG2, 4:4:4 planar */
+#define CAPTURE_RAW  2  /* Headerless RGBA frames */
+
+/* Number of frames which can wait for the writer before frames are dropped */
+#define CAPTURE_RING_SIZE  8
+
+/* Global data */
+extern char captureFormat;
+
+/* Functions */
+
+/**
+ * Start streaming frames to a file on a writer thread.
+ *
+ * path:   The file to write, or "-" for stdout.
+ * format: CAPTURE_Y4M or CAPTURE_RAW.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int startCapture(const char* path, char format);
+
+/**
+ * Queue a finished ABGR frame for the writer. The frame is copied, so
+ * the buffer can be reused as soon as this returns. The frame is
+ * dropped if the writer has fallen CAPTURE_RING_SIZE frames behind.
+ *
+ * pixels: The WINDOW_WIDTH x WINDOW_HEIGHT frame.
+ */
+void captureFrame(const Uint32* pixels);
+
+/**
+ * Queue a finished 8-bit frame for the writer, which expands it
+ * through the palette. Dropped under the same rule as captureFrame.
+ *
+ * pixels:  The WINDOW_WIDTH x WINDOW_HEIGHT frame of palette indices.
+ * palette: The palette to expand with.
+ */
+void captureIndexedFrame(const Uint8* pixels, const Uint32* palette);
+
+/**
+ * Convert ABGR pixels to BT.601 studio range Y, U and V planes.
+ *
+ * pixels: The pixels to convert.
+ * count:  The number of pixels.
+ * y:      Receives count luma samples.
+ * u:      Receives count blue-difference samples.
+ * v:      Receives count red-difference samples.
+ */
+void convertABGRToYUV444(const Uint32* pixels, int count, Uint8* y, Uint8* u, Uint8* v);
+
+/**
+ * Write out every queued frame, stop the writer thread and close the
+ * capture file. Prints how many frames were captured and dropped.
+ */
+void stopCapture();
+
+/* capture */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* frame ring */
+
+/*
+ * Layout of the shared memory, for readers in other processes: a
+ * FrameRingHeader, then slotCount slots of slotSize bytes starting at
+ * headerSize. Each slot is a FrameSlotHeader followed by its pixels at
+ * FRAME_SLOT_HEADER_SIZE. A slot is only consistent while its sequence
+ * is even and unchanged from before it was read.
+ */
+
+/* Constants */
+#define FRAME_RING_MAGIC         0x52465A4D  /* "MZFR" */
+#define FRAME_RING_VERSION       1
+#define FRAME_RING_ALIGN         64
+#define FRAME_RING_HEADER_SIZE   FRAME_RING_ALIGN
+#define FRAME_SLOT_HEADER_SIZE   ((sizeof(FrameSlotHeader) + FRAME_RING_ALIGN - 1) & ~(size_t)(FRAME_RING_ALIGN - 1))
+#define DEFAULT_FRAME_RING_SLOTS 3
+#define MAX_FRAME_RING_SLOTS     64
+#define FRAME_RING_READ_TRIES    16
+
+/* Pixel formats */
+#define FRAME_ABGR8888  0
+#define FRAME_INDEXED8  1   /* Palette indices; the slot carries the palette */
+
+/* Datatypes */
+typedef struct {
+    Uint32 magic;               /* Written last */
+    Uint32 version;
+    Uint32 slotCount;
+    Uint32 slotSize;            /* Bytes from one slot to the next */
+    Uint32 headerSize;          /* Bytes before the first slot */
+    Uint32 maxWidth, maxHeight;
+    SDL_atomic_t latest;        /* Slot of the newest frame, -1 before the first */
+} FrameRingHeader;
+
+typedef struct {
+    SDL_atomic_t sequence;      /* Odd while the slot is being written */
+    Uint32 format;              /* FRAME_* */
+    Uint32 width, height;
+    Uint32 pitch;               /* Bytes per row */
+    Uint32 reserved;
+    Uint64 frameIndex;
+    Uint64 timestamp;           /* Microseconds on the performance counter */
+    Uint32 palette[PALETTE_SIZE];
+} FrameSlotHeader;
+
+typedef struct {
+    MemoryMapping mapping;
+    const FrameRingHeader* ring;
+} FrameRingReader;
+
+/* Functions */
+
+/**
+ * Create a named shared memory ring and publish every rendered frame
+ * into it from now on.
+ *
+ * name:  The name of the shared memory.
+ * slots: The number of frames in the ring.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int openFrameRing(const char* name, int slots);
+
+/**
+ * Publish a finished ABGR frame into the next slot of the ring. Never
+ * waits for readers. Does nothing without an open ring.
+ *
+ * pixels: The WINDOW_WIDTH x WINDOW_HEIGHT frame.
+ */
+void publishFrame(const Uint32* pixels);
+
+/**
+ * Publish a finished 8-bit frame and its palette, as publishFrame.
+ *
+ * pixels:  The WINDOW_WIDTH x WINDOW_HEIGHT frame of palette indices.
+ * palette: The palette the indices refer to.
+ */
+void publishIndexedFrame(const Uint8* pixels, const Uint32* palette);
+
+/**
+ * Stop publishing and remove the ring's shared memory.
+ */
+void closeFrameRing();
+
+/**
+ * Attach to a ring published by another process.
+ *
+ * reader: Receives the attached ring.
+ * name:   The name the ring was opened with.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int attachFrameRing(FrameRingReader* reader, const char* name);
+
+/**
+ * Find the newest published frame. Its pixels can be used in place
+ * (see getFrameSlotPixels); check isFrameIntact afterwards.
+ *
+ * reader:   The attached ring.
+ * sequence: Receives the slot's sequence, for isFrameIntact.
+ *
+ * Returns: The frame's slot, or NULL if there is no frame yet.
+ */
+const FrameSlotHeader* readLatestFrame(const FrameRingReader* reader, int* sequence);
+
+/**
+ * Returns: Non-zero if a slot wasn't rewritten since readLatestFrame
+ *          returned it, i.e. whatever was read from it is consistent.
+ */
+int isFrameIntact(const FrameSlotHeader* slot, int sequence);
+
+/**
+ * Returns: The pixels of a slot.
+ */
+void* getFrameSlotPixels(const FrameSlotHeader* slot);
+
+/**
+ * Detach from a ring attached with attachFrameRing.
+ */
+void detachFrameRing(FrameRingReader* reader);
+
+/* frame ring */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* raycaster */
+
+/* Constants */
+#define RAY_EPS   (WALL_SIZE / 3.0f)
+#define SKIP_SLOPE_MARGIN  1.001f  /* Safety factor on the slope when skipping empty cells */
+#define SPAN_CORNER_SLACK  0.01f   /* Filled hits closer than this to a corner are traced instead */
+
+/* Fixed-point casting */
+#define FIXED_SHIFT            16
+#define FIXED_ONE              (1 << FIXED_SHIFT)
+#define FIXED_MAX_SLOPE        4096  /* Steeper rays are taken as parallel to the lines they'd cross */
+#define RECIPROCAL_TABLE_BITS  8
+#define RECIPROCAL_TABLE_SIZE  (1 << RECIPROCAL_TABLE_BITS)
+
+/* Batch queries */
+#define RAY_BATCH_GRAIN    256     /* Queries handed to a worker at once */
+#define LINE_OF_SIGHT_EPS  0.01f   /* Walls this close behind a target don't block it */
+
+/* Camera ray tables */
+#define CAMERA_RAY_TABLES  4       /* View width and viewplane distance pairs kept at once */
+
+/* Datatypes */
+typedef struct {
+    Vector2f vRay;
+    Vector2f hRay;
+} RayTuple;
+
+typedef struct {
+    Vector2f pos;
+    Vector2f dir;               /* Unit length, and perpendicular to plane */
+    Vector2f plane;             /* Unit viewplane direction */
+    float distFromViewplane;    /* For a VIEWPLANE_LENGTH wide view */
+} Camera;
+
+/* Each column's ray direction for a view, in camera space */
+typedef struct {
+    float distFromViewplane;            /* The view the table was built for */
+    int width;                          /* Zero while the table is unused */
+    float forward[VIEWPLANE_LENGTH];    /* Unit ray along the view direction; the cosine off it */
+    float side[VIEWPLANE_LENGTH];       /* Unit ray against the viewplane direction */
+} CameraRays;
+
+/* The answer to one ray query */
+typedef struct {
+    float distance;     /* To the hit, or the max distance if nothing was hit within it */
+    int mapx, mapy;     /* The cell hit, or -1 if nothing was */
+    char vertical;      /* Hit a face on a vertical grid line */
+    float u;            /* Position across the face in [0, 1), oriented like the textures */
+} RayHit;
+
+/* Global data */
+extern Vector2f viewplaneDir;
+extern float distFromViewplane;
+extern Rotation2f counterClockwiseRotation;
+extern Rotation2f clockwiseRotation;
+extern RayTuple rays[VIEWPLANE_LENGTH];
+
+/* Functions */
+
+/**
+ * Initialize rays as a set of normalized vectors,
+ * all pointing in their appropriate directions.
+ *
+ * camera: The camera to point the rays for.
+ */
+void initializeRayDirections(const Camera* camera);
+
+/**
+ * Set the length of a ray such that it extends from
+ * an origin to its first intersection in the world.
+ *
+ * origin: The world position the ray is cast from.
+ * ray:    The ray to extend.
+ */
+void extendRayToFirstHit(Vector2f origin, RayTuple* ray);
+
+/**
+ * Set the length of rays in an array such that
+ * they each extend from the player to their first
+ * intersection in the world.
+ *
+ * rays: The input array of rays.
+ */
+void extendRaysToFirstHit(RayTuple* rays);
+
+/**
+ * Find the stepping vector of a ray which will bring it
+ * from one vertical world intersection to the next.
+ *
+ * ray: The ray to find the vertical step vector for.
+ *
+ * Returns: The vertical step vector.
+ */
+Vector2f findVerticalRayStepVector(Vector2f ray);
+
+/**
+ * Find the stepping vector of a ray which will bring it
+ * from one horizontal world intersection to the next.
+ *
+ * ray: The ray to find the horizontal step vector for.
+ *
+ * Returns: The horizontal step vector.
+ */
+Vector2f findHorizontalRayStepVector(Vector2f ray);
+
+/**
+ * Check whether a map tile is solid. Tiles on or outside the map
+ * border always are, and doors are until they are fully open. Rays can
+ * still pass the gap of a partly open door (see isInDoorGap).
+ *
+ * mapx: The x coordinate of the tile.
+ * mapy: The y coordinate of the tile.
+ *
+ * Returns: Non-zero if the tile is solid.
+ */
+int isSolidTile(int mapx, int mapy);
+
+/**
+ * Check whether a map tile stops rays: a solid tile that isn't a
+ * SEE_THROUGH wall.
+ */
+int isOpaqueTile(int mapx, int mapy);
+
+/**
+ * Cast a ray which was already extended to its first
+ * intersection further into the world until it hits something.
+ * This only reads the map, so it is safe to call from any thread.
+ *
+ * origin: The world position the ray is cast from.
+ * ray:    The ray to cast.
+ */
+void castRay(Vector2f origin, RayTuple* ray);
+
+/**
+ * Cast a list of prepared rays into the world.
+ *
+ * rays: The list of rays to cast.
+ */
+void raycast(RayTuple* rays);
+
+/**
+ * Extend and cast a ray holding a normalized direction.
+ *
+ * origin: The world position the ray is cast from.
+ * ray:    The ray to trace.
+ */
+void traceRay(Vector2f origin, RayTuple* ray);
+
+/**
+ * Get the tile coordinate (x, y) for the vertical intersection
+ * point of a ray and the world.
+ *
+ * origin: The world position the ray was cast from.
+ * ray:    The ray to find the tile coordinate for.
+ *
+ * Returns: The vertical intersection tile coordinate for the ray.
+ */
+Vector2f getTileCoordinateForVerticalRay(Vector2f origin, Vector2f ray);
+
+/**
+ * Get the tile coordinate (x, y) for the horizontal intersection
+ * point of a ray and the world.
+ *
+ * origin: The world position the ray was cast from.
+ * ray:    The ray to find the tile coordinate for.
+ *
+ * Returns: The horizontal intersection tile coordinate for the ray.
+ */
+Vector2f getTileCoordinateForHorizontalRay(Vector2f origin, Vector2f ray);
+
+/**
+ * Update the raycaster (setup and perform raycasting) for
+ * the current frame.
+ */
+void updateRaycaster();
+
+/**
+ * Get a camera matching the player's current view.
+ *
+ * camera: Receives the player's camera.
+ */
+void getPlayerCamera(Camera* camera);
+
+/**
+ * Get the camera-space ray directions of a view's columns, building
+ * them if no table for the view is kept. They only change with the
+ * view's width and viewplane distance, so a frame just rotates them.
+ * Building a table isn't thread safe; build every table a parallel
+ * pass needs before starting it.
+ *
+ * distFromViewplane: The viewplane distance for a VIEWPLANE_LENGTH wide view.
+ * width:             The width of the view in columns; at most VIEWPLANE_LENGTH.
+ *
+ * Returns: The table.
+ */
+const CameraRays* getCameraRays(float distFromViewplane, int width);
+
+/**
+ * Find the normalized direction of the ray through a view column,
+ * from the view's camera ray table if one is kept. Either way the
+ * result is the same.
+ *
+ * camera: The camera to use.
+ * column: The column of the view.
+ * width:  The width of the view in columns.
+ *
+ * Returns: The ray direction.
+ */
+Vector2f cameraRayDirection(const Camera* camera, int column, int width);
+
+/**
+ * Fixed-point counterpart of traceRay, used by it in fixedPointMode.
+ * The origin and direction are rounded to Q16.16 and the ray is cast
+ * with integer math only.
+ *
+ * origin: The world position the ray is cast from.
+ * ray:    The ray to trace; vRay holds its direction.
+ */
+void traceRayFixed(Vector2f origin, RayTuple* ray);
+
+/**
+ * Cast a full set of rays for a camera with integer math only. The
+ * camera is rounded to Q16.16 once; after that the rays are the same
+ * on every platform.
+ *
+ * camera: The camera to cast from.
+ * rays:   Receives one cast ray per column.
+ * width:  The number of columns.
+ */
+void castFixedRays(const Camera* camera, RayTuple* rays, int width);
+
+/**
+ * Approximate 2^48 / x from a reciprocal table and two Newton-Raphson
+ * steps, exact to within an ulp or two.
+ *
+ * x: The divisor; must be non-zero.
+ */
+Uint64 fixedReciprocal(Uint32 x);
+
+/**
+ * Cast a batch of rays from anywhere in the map, e.g. for AI or sensor
+ * checks. Uses the same traversal as the camera rays (including
+ * fixedPointMode) and never touches the global rays, so it is safe to
+ * call from any thread.
+ *
+ * origins:     The world position of each ray.
+ * dirs:        The direction of each ray; need not be normalized.
+ * count:       The number of rays.
+ * maxDistance: Walls further away than this are not reported; zero or
+ *              less for no limit.
+ * threads:     The most threads to spread the batch over, counting the
+ *              caller; zero or less to use every worker.
+ * hits:        Receives one answer per ray.
+ */
+void castRayBatch(const Vector2f* origins, const Vector2f* dirs, int count, float maxDistance, int threads, RayHit* hits);
+
+/**
+ * Check a batch of origin and target pairs for line of sight.
+ *
+ * origins: The world position each check is made from.
+ * targets: The world position each check is made to.
+ * count:   The number of checks.
+ * threads: The most threads to spread the batch over, counting the
+ *          caller; zero or less to use every worker.
+ * visible: Receives non-zero for each target with no wall in between.
+ */
+void checkLineOfSightBatch(const Vector2f* origins, const Vector2f* targets, int count, int threads, char* visible);
+
+/**
+ * Trace a single column of a camera's view with traceRay, then finish
+ * it with finishColumn.
+ *
+ * camera: The camera to cast from.
+ * rays:   Receives the cast ray at the column's index.
+ * width:  The number of columns.
+ * column: The column to trace.
+ */
+void traceColumn(const Camera* camera, RayTuple* rays, int width, int column);
+
+/**
+ * Recompute a cast column's hit as the column's ray direction meeting
+ * the grid line of the face it hit, instead of the position the ray
+ * steps added up to. Every caster finishes its columns this way, so
+ * they give exactly the same hits.
+ *
+ * camera: The camera the column was cast from.
+ * rays:   Holds the cast ray at the column's index.
+ * width:  The number of columns.
+ * column: The column to finish.
+ */
+void finishColumn(const Camera* camera, RayTuple* rays, int width, int column);
+
+/**
+ * Cast a full set of rays for a camera by tracing only the columns
+ * where the visible wall face changes. The columns between two traced
+ * columns on the same unobstructed face are filled in directly, and
+ * come out exactly the same as tracing every column with traceColumn.
+ * Built with -DSPAN_CAST_CHECK, every frame is asserted to.
+ *
+ * camera: The camera to cast from.
+ * rays:   Receives one cast ray per column.
+ * width:  The number of columns.
+ */
+void castSpans(const Camera* camera, RayTuple* rays, int width);
+
+/**
+ * Initialize the raycaster.
+ */
+void initRaycaster();
+
+/* raycaster */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* poses */
+
+/*
+ * Rays baked offline for a static map, for a grid of positions in every
+ * open cell and a full circle of directions around each. A camera close
+ * enough to a baked position looks its rays up instead of casting them.
+ */
+
+/* Constants */
+#define POSE_GRID           4       /* Baked positions along each side of a cell */
+#define POSE_RAYS           4096    /* Rays around each baked position */
+#define POSE_SNAP_DISTANCE  4.0f    /* Furthest a camera may be from a baked position to use it */
+#define POSE_HIT_TOLERANCE  4.0f    /* Furthest a column's hit may be from the baked one it came from */
+
+/* Functions */
+
+/**
+ * Bake the rays of the current map into a pose table file. Doors and
+ * pushwalls are baked as they are now, so call this after initMap.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int bakePoseTable(const char* path);
+
+/**
+ * Map a pose table file to look rays up from. Only a table baked for
+ * the current map is accepted. A baked position isn't used while
+ * anything it can see differs from the map as it was when the table
+ * was opened. Call after initMap, as this registers a map listener.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int openPoseTable(const char* path);
+
+/**
+ * Unmap the pose table.
+ */
+void closePoseTable();
+
+/**
+ * Fill in the rays of a camera from the pose table. Columns where the
+ * baked rays can't be trusted, at the edges of walls or where the baked
+ * ray passed close to another wall, are traced.
+ *
+ * camera: The camera to cast from.
+ * rays:   Receives one cast ray per column.
+ * width:  The number of columns.
+ *
+ * Returns: Non-zero if the rays were filled in, zero if the camera
+ *          isn't near a baked position and they must be cast.
+ */
+int castBakedRays(const Camera* camera, RayTuple* rays, int width);
+
+/* poses */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* telemetry */
+
+/*
+ * Ray traversal telemetry, compiled in with -DRAY_TELEMETRY. Without it
+ * the hooks below expand to nothing and the ray loops are untouched.
+ */
+#ifdef RAY_TELEMETRY
+
+/* Hooks for the ray loops */
+#define TELEMETRY_STEPS(N)          int N = 0
+#define TELEMETRY_VISIT(N, X, Y)    ((N)++, recordCellVisit((int)(X), (int)(Y)))
+#define TELEMETRY_RAY(N, RAY)       recordRay((N), (RAY))
+#define TELEMETRY_FRAME()           beginRayTelemetryFrame()
+
+/* Constants */
+#define RAY_HEATMAP_ALPHA        160
+#define RAY_HEATMAP_CELL_PIXELS  32   /* Size of a map cell in exported images */
+
+/* Datatypes */
+typedef struct {
+    long rays;
+    long steps;         /* Map cells tested */
+    long maxSteps;      /* Most cells tested by one ray */
+    long totalLength;   /* Sum of ray lengths, in world units */
+    long maxLength;
+} RayTelemetry;
+
+/* Global data */
+extern char rayHeatmapMode;
+extern RayTelemetry lastFrameTelemetry;
+extern RayTelemetry sessionTelemetry;
+
+/* Functions */
+
+/**
+ * Count a ray testing a map cell. Safe to call from any thread.
+ *
+ * mapx: The x coordinate of the cell
+ * mapy: The y coordinate of the cell
+ */
+void recordCellVisit(int mapx, int mapy);
+
+/**
+ * Count a finished ray. Safe to call from any thread.
+ *
+ * steps: The number of cells the ray tested
+ * ray:   The cast ray; the shorter of its two hits is its length
+ */
+void recordRay(int steps, const RayTuple* ray);
+
+/**
+ * Close the current frame: its counters move to lastFrameTelemetry and
+ * are added to sessionTelemetry. Call once per frame before casting.
+ */
+void beginRayTelemetryFrame();
+
+/**
+ * Reset the session totals and the per-cell visit counts.
+ */
+void clearRayTelemetry();
+
+/**
+ * Returns: How many times rays have tested the cell since the last clear.
+ */
+int getCellVisits(int mapx, int mapy);
+
+/**
+ * Draw the per-cell visit counts over the overhead map.
+ */
+void drawRayHeatmap();
+
+/**
+ * Write the per-cell visit counts to a file: a CSV grid of counts if
+ * the path ends in .csv, a binary PPM heatmap otherwise.
+ *
+ * Returns: Non-zero if successful, zero otherwise.
+ */
+int writeRayHeatmap(const char* path);
+
+/**
+ * Print the session's ray counts, steps and lengths to stderr.
+ */
+void printRayTelemetry();
+
+#else
+
+#define TELEMETRY_STEPS(N)
+#define TELEMETRY_VISIT(N, X, Y)
+#define TELEMETRY_RAY(N, RAY)
+#define TELEMETRY_FRAME()
+
+#endif
+
+/* telemetry */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* renderer */
+
+/* Macros */
+#define XY_TO_SCREEN_INDEX(X, Y)   (((Y) * WINDOW_WIDTH) + (X))
+#define XY_TO_TEXTURE_INDEX(X, Y)   (((X) * TEXTURE_SIZE) + (Y)) /* Textures are column-major */
+#define WALL_TO_TEXTURE_X(X)        (((X) * TEXTURE_SIZE) / WALL_SIZE)
+#define DARKEN_COLOR(C)     ((((C) >> 1) & 0x7F7F7F7F) | 0xFF000000)
+#define LIGHT_SCALE(L)      (((L) + 1) * 256 / LIGHT_LEVELS)  /* 256ths to scale colors by at a light level */
+#define LIGHT_COLOR(C, S)   (((((C) & 0x00FF00FF) * (S) >> 8) & 0x00FF00FF) | (((((C) >> 8) & 0x000000FF) * (S)) & 0x0000FF00) | 0xFF000000)
+
+#define IS_GRATE_TEXEL(X, Y)  ((X) % GRATE_BAR_PERIOD < GRATE_BAR_WIDTH || (Y) % GRATE_BAR_PERIOD < GRATE_BAR_WIDTH)
+
+#define VIEW_DIST_FROM_VIEWPLANE(V)  ((V)->camera.distFromViewplane * (V)->width / (float)VIEWPLANE_LENGTH)
+
+/* Constants */
+#define MAX_VIEWS          4
+#define VIEW_COLUMN_GRAIN  32  /* Columns per job; keeps threads off each other's cache lines */
+#define MAX_HIT_COLUMNS    (WINDOW_WIDTH * MAX_VIEWS)
+#define INTERLEAVED_SCALE_EPS  0.0001f  /* Reprojected columns closer than this to their old height are kept as is */
+#define MAX_COLUMN_LAYERS  4   /* See-through walls drawn in front of each column's wall */
+#define GRATE_BAR_PERIOD   16  /* Texels from one grate bar to the next */
+#define GRATE_BAR_WIDTH    4
+#define SIMD_SHADE_COLUMNS 8   /* Columns drawn together by drawTexturedStripsAVX2To */
+
+/* Enums */
+typedef enum {HORIZONTAL_RAY, VERTICAL_RAY} RayType;
+
+/* Datatypes */
+typedef struct {
+    Camera camera;
+    int x, y;           /* Top-left corner in the screen buffer */
+    int width, height;
+} View;
+
+/*
+ * What the cast stage found for each column, laid out one array per
+ * field. The shade stage reads nothing else.
+ */
+typedef struct {
+    float distance[MAX_HIT_COLUMNS];    /* To the wall along the view direction; straight-line with distortion */
+    Uint8 side[MAX_HIT_COLUMNS];        /* RayType of the face hit */
+    Uint8 material[MAX_HIT_COLUMNS];    /* As getWallMaterial */
+    Uint8 textureX[MAX_HIT_COLUMNS];    /* Texture column of the hit */
+    Sint16 mapx[MAX_HIT_COLUMNS];       /* Cell hit */
+    Sint16 mapy[MAX_HIT_COLUMNS];
+    Uint8 light[MAX_HIT_COLUMNS];       /* Light level at the hit, with lightingMode */
+
+    /* See-through walls in front of the hit, nearest first */
+    Uint8 layerCount[MAX_HIT_COLUMNS];
+    float layerDistance[MAX_HIT_COLUMNS][MAX_COLUMN_LAYERS];
+    Uint8 layerSide[MAX_HIT_COLUMNS][MAX_COLUMN_LAYERS];
+    Uint8 layerMaterial[MAX_HIT_COLUMNS][MAX_COLUMN_LAYERS];
+    Uint8 layerTextureX[MAX_HIT_COLUMNS][MAX_COLUMN_LAYERS];
+    Uint8 layerLight[MAX_HIT_COLUMNS][MAX_COLUMN_LAYERS];
+} ColumnHits;
+
+/* What a shaded column shows, kept to rebuild the column in later frames */
+typedef struct {
+    Vector2f hit;       /* World position of the wall hit */
+    float drawLength;   /* Projected wall height in pixels */
+    char valid;
+} ColumnSample;
+
+/* Global data */
+extern ColumnHits columnHits;   /* Of the last frame drawn */
+
+/* Functions */
+
+/**
+ * Calculate the draw height of a pixel column for a given
+ * ray length.
+ *
+ * rayLength: The ray length to use.
+ *
+ * Returns: The pixel height of a vertical column to draw.
+ */
+float calculateDrawHeight(float rayLength);
+
+/**
+ * Draw a textured pixel column on the screen.
+ *
+ * x:          The x coordinate of the column.
+ * wallYStart: The starting y coordinate of the pixel column.
+ * length:     The length of the column.
+ * textureX:   The texture column number to use for the strip.
+ * texture:    The mip chain of the texture to use.
+ * darken:     Non-zero if the strip should be darkened, zero otherwise.
+ */
+void drawTexturedStrip(int x, float wallYStart, float length, int textureX, Uint32* texture, char darken);
+
+/**
+ * Draw an un-textured pixel column on the screen.
+ *
+ * x:          The x coordinate of the column.
+ * wallYStart: The starting y coordinate of the pixel column.
+ * length:     The length of the column.
+ * ABGRColor:  The color (ABGR) to use.
+ * darken:     Non-zero if the strip should be darkened, zero otherwise.
+ */
+void drawUntexturedStrip(int x, float wallYStart, float length, Uint32 ABGRColor, char darken);
+
+/**
+ * Draw a textured pixel column on the indexed screen buffer.
+ *
+ * x:          The x coordinate of the column.
+ * wallYStart: The starting y coordinate of the pixel column.
+ * length:     The length of the column.
+ * textureX:   The texture column number to use for the strip.
+ * texture:    The 8-bit mip chain of the texture to use.
+ * darken:     Non-zero if the strip should be darkened, zero otherwise.
+ */
+void drawTexturedStrip8(int x, float wallYStart, float length, int textureX, Uint8* texture, char darken);
+
+/**
+ * Draw an un-textured pixel column on the indexed screen buffer.
+ *
+ * x:          The x coordinate of the column.
+ * wallYStart: The starting y coordinate of the pixel column.
+ * length:     The length of the column.
+ * color:      The palette index to use.
+ * darken:     Non-zero if the strip should be darkened, zero otherwise.
+ */
+void drawUntexturedStrip8(int x, float wallYStart, float length, Uint8 color, char darken);
+
+/**
+ * Draw a textured pixel column into any buffer. The strip functions
+ * above are shortcuts for full-height columns of the screen buffers;
+ * these variants take the column's top pixel, the buffer pitch and
+ * the column height, and have 8-bit and un-textured counterparts.
+ *
+ * dst:        The top pixel of the column.
+ * pitch:      The distance in pixels between rows of the buffer.
+ * height:     The height of the column.
+ * (remaining parameters as for drawTexturedStrip)
+ */
+void drawTexturedStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, int textureX, Uint32* texture, char darken);
+void drawUntexturedStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, Uint32 ABGRColor, char darken);
+void drawTexturedStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, int textureX, Uint8* texture, char darken);
+void drawUntexturedStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, Uint8 color, char darken);
+
+/**
+ * Draw a textured pixel column scaled by a light level instead of
+ * darkened by side.
+ *
+ * level:      The light level, from 0 to LIGHT_LEVELS - 1.
+ * (remaining parameters as for drawTexturedStripTo)
+ */
+void drawLitTexturedStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, int textureX, Uint32* texture, int level);
+void drawLitTexturedStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, int textureX, Uint8* texture, int level);
+
+/**
+ * Draw an un-textured pixel column in its color scaled by a light level.
+ *
+ * level:      The light level, from 0 to LIGHT_LEVELS - 1.
+ * (remaining parameters as for drawUntexturedStripTo)
+ */
+void drawLitUntexturedStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, Uint32 ABGRColor, int level);
+void drawLitUntexturedStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, Uint8 color, int level);
+
+/**
+ * Draw the bars of a see-through wall over a column already drawn;
+ * pixels between the bars and above and below the wall are left alone.
+ *
+ * textureX: The texture column number to use for the strip.
+ * texture:  The texture's mip chain, or NULL to use color.
+ * color:    The color of an un-textured wall.
+ * scale:    The 256ths to scale the color by (256 leaves it as is).
+ * (remaining parameters as for drawTexturedStripTo)
+ */
+void drawGrateStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, int textureX, const Uint32* texture, Uint32 color, int scale);
+
+/**
+ * The 8-bit counterpart of drawGrateStripTo.
+ *
+ * remap: The palette remap to shade the wall with, or NULL for none.
+ */
+void drawGrateStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, int textureX, const Uint8* texture, Uint8 color, const Uint8* remap);
+
+/**
+ * Draw 8 adjacent textured pixel columns at once with AVX2, a row at a
+ * time. The output is the same bit for bit as drawTexturedStripTo for
+ * each column. Only call this when gfxHasAVX2 is set.
+ *
+ * dst:        The top pixel of the leftmost column.
+ * wallYStart: The 8 columns' wall starts.
+ * length:     The 8 columns' wall lengths.
+ * textureX:   The 8 columns' texture column numbers.
+ * textures:   The 8 columns' mip chains.
+ * darken:     Non-zero for each column to darken.
+ * (remaining parameters as for drawTexturedStripTo)
+ *
+ * Returns: FALSE, drawing nothing, if the textures lie too far apart in
+ *          memory to gather from together.
+ */
+int drawTexturedStripsAVX2To(Uint32* dst, int pitch, int height, const float* wallYStart, const float* length, const int* textureX, Uint32* const* textures, const char* darken);
+
+/**
+ * Find the texture column number to use for a given ray.
+ *
+ * origin: The world position the ray was cast from.
+ * ray:    The ray to use.
+ * rtype:  The type of ray intersection (see above definition of RayType)
+ *
+ * Returns: The texture column number to use.
+ */
+int getTextureColumnNumberForRay(Vector2f origin, Vector2f ray, RayType rtype);
+
+/**
+ * Get the barrel-distortion corrected ray length for a given ray: its
+ * length scaled by the cosine of its angle off the view direction.
  *
  * ray: The ray to undistort.
+ * dir: The unit view direction of the camera the ray was cast for.
  *
  * Returns: The undistorted length of the ray.
  */
-float getUndistortedRayLength(Vector3f* ray);
+float getUndistortedRayLength(Vector2f ray, Vector2f dir);
+
+/**
+ * Cast stage: reduce a cast ray to the record the shade stage draws
+ * from. Safe to call from any thread for distinct indices.
+ *
+ * camera: The camera the ray was cast for.
+ * ray:    The cast ray.
+ * hits:   The buffer to store the record in.
+ * index:  Where in the buffer to store it.
+ */
+void storeColumnHit(const Camera* camera, const RayTuple* ray, ColumnHits* hits, int index);
+
+/**
+ * Shade stage: draw one column of a view from its hit record.
+ * Views write disjoint columns, so this is safe to call from any thread.
+ *
+ * view:   The view being drawn.
+ * hits:   The hit buffer.
+ * index:  The record to draw.
+ * column: The column within the view.
+ */
+void shadeColumn(const View* view, const ColumnHits* hits, int index, int column);
+
+/**
+ * Shade stage for a run of adjacent columns of a view, 8 at a time
+ * where the AVX2 kernel can draw them.
+ *
+ * view:   The view being drawn.
+ * hits:   The hit buffer.
+ * index:  The record of the first column.
+ * column: The first column within the view.
+ * count:  The number of columns.
+ */
+void shadeColumns(const View* view, const ColumnHits* hits, int index, int column, int count);
+
+/**
+ * Returns: The projected wall height in pixels of a hit record.
+ */
+float getColumnDrawLength(const View* view, const ColumnHits* hits, int index);
+
+/**
+ * Render several views into their rectangles of the screen buffer.
+ * The columns of all views are cast in one parallel pass and shaded
+ * in a second, then the frame is presented.
+ *
+ * views: The views to render (at most MAX_VIEWS).
+ * count: The number of views.
+ */
+void renderViews(const View* views, int count);
+
+/**
+ * Present the screen buffer of the active color pipeline.
+ */
+void presentScreenBuffer();
 
 /**
  * Render the scene.
@@ -646,10 +2060,248 @@ float getUndistortedRayLength(Vector3f* ray);
  */
 void renderProjectedScene();
 
+/**
+ * Render the scene casting and shading only every other column, the
+ * odd and even columns taking turns each frame. The skipped columns
+ * are rebuilt from the previous frame: each previous column is moved
+ * to where its wall hit now projects and rescaled to its new height.
+ * Columns nothing lands on (disocclusions) are interpolated from their
+ * neighbors. Casts its own rays.
+ */
+void renderInterleavedScene();
+
+/**
+ * Throw away the history used by renderInterleavedScene, so the next
+ * frame is rendered in full.
+ */
+void resetInterleavedHistory();
+
 /* renderer */
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
 /* ========================================================== */
 
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* lighting */
+
+/* Constants */
+#define MAX_LIGHTS              32
+#define LIGHTMAP_FACE_SAMPLES   8       /* Lightmap samples along each wall face */
+#define LIGHT_AMBIENT           0.25f   /* Brightness of faces no light reaches */
+#define LIGHT_FACE_OFFSET       0.5f    /* Distance off a face its samples are lit at */
+
+/* Wall faces, by the direction they face */
+#define FACE_NORTH  0
+#define FACE_EAST   1
+#define FACE_SOUTH  2
+#define FACE_WEST   3
+
+/* Datatypes */
+typedef struct {
+    Vector2f pos;       /* In map coordinates */
+    float radius;       /* Reach in world units */
+    float intensity;    /* Added brightness right next to the light; 1 is full */
+    char used;
+    char on;
+} Light;
+
+/* Global data */
+extern char lightingMode;
+extern Light lights[MAX_LIGHTS];
+extern const int FACE_NORMALS[4][2];  /* Outward normals of the faces, in FACE_* order */
+extern Uint32 lightCellVersion[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];  /* lightVersion of the last change to each cell's light */
+extern Uint32 lightVersion;                                       /* Bumped by every updateLighting that relights */
+
+/* Functions */
+
+/**
+ * Remove all lights and light the map with ambient light only. Call
+ * after initMap, as this registers a map listener.
+ */
+void initLighting();
+
+/**
+ * Add a point light.
+ *
+ * x:         The world x coordinate.
+ * y:         The world y coordinate.
+ * radius:    How far the light reaches in world units.
+ * intensity: The brightness it adds right next to it.
+ *
+ * Returns: The light, or -1 if there are MAX_LIGHTS already.
+ */
+int addLight(float x, float y, float radius, float intensity);
+
+/**
+ * Remove a light added with addLight.
+ */
+void removeLight(int light);
+
+/**
+ * Move a light. Only the faces within its reach before and after are
+ * relit.
+ *
+ * light: The light.
+ * x:     The new world x coordinate.
+ * y:     The new world y coordinate.
+ */
+void moveLight(int light, float x, float y);
+
+/**
+ * Switch a light on or off.
+ */
+void setLightEnabled(int light, char on);
+
+/**
+ * Change the brightness of a light, e.g. to make it flicker.
+ */
+void setLightIntensity(int light, float intensity);
+
+/**
+ * Relight every face affected by changes since the last call, spread
+ * over the worker threads. Call once per frame before rendering.
+ */
+void updateLighting();
+
+/**
+ * Sample the lightmap where a ray hit a wall.
+ *
+ * mapx:  The x coordinate of the cell hit.
+ * mapy:  The y coordinate of the cell hit.
+ * side:  Which kind of grid line the ray hit.
+ * ray:   The ray, for which face of the cell it hit.
+ * along: The world coordinate of the hit along the face.
+ *
+ * Returns: The light level, from 0 to LIGHT_LEVELS - 1.
+ */
+int getLightLevel(int mapx, int mapy, RayType side, Vector2f ray, float along);
+
+/* lighting */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
+
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* environments */
+
+/* Constants */
+#define ENV_INDEXED     0x01    /* Observations are palette indices instead of ABGR pixels */
+#define ENV_TEXTURED    0x02    /* Walls are textured instead of flat colored */
+#define ENV_PANORAMA    0x04    /* Views are 360 degree cylindrical strips centered on the view direction */
+#define ENV_DEPTH       0x08    /* Observations are one row of EnvironmentDepth instead of pixels */
+#define ENV_STEP_GRAIN  16      /* Environments stepped per job */
+#define ENV_BENCH_SIZE  84      /* Width and height of the views in benchmarkEnvironments */
+
+/* Datatypes */
+typedef struct {
+    const short* map;           /* Row-major tiles; shared, never written */
+    int mapWidth, mapHeight;
+    Vector2f pos;
+    Vector2f dir;               /* Unit length */
+    Vector2f plane;             /* Viewplane direction, dir turned a quarter */
+    void* observation;          /* This environment's frame in the batch tensor */
+} Environment;
+
+typedef struct {
+    int count;
+    int width, height;          /* Of each environment's view */
+    int flags;                  /* ENV_* */
+    float distFromViewplane;    /* For a view this wide */
+    Rotation2f leftTurn, rightTurn;
+    Vector2f* panoramaRays;     /* With ENV_PANORAMA, each column's unit ray along dir (x) and plane (y) */
+    Environment* envs;
+    void* observations;         /* count frames of height rows of width pixels, back to back */
+} EnvironmentBatch;
+
+/* One column of an ENV_DEPTH observation, like a lidar return */
+typedef struct {
+    float distance;             /* To the wall; the straight-line range with ENV_PANORAMA, along the view direction without */
+    Uint8 material;             /* Of the wall, 1 to 4 */
+    Uint8 side;                 /* RayType of the face hit */
+    Uint16 unused;
+} EnvironmentDepth;
+
+/* Functions */
+
+/**
+ * Create a batch of environments, each starting where the player is in
+ * the global map. Needs the wall textures (and, for ENV_INDEXED, the
+ * palette) but no window.
+ *
+ * count:  The number of environments.
+ * width:  The width of each environment's view in pixels; with
+ *         ENV_PANORAMA, spread over the full circle.
+ * height: The height of each environment's view in pixels; ignored
+ *         with ENV_DEPTH.
+ * flags:  ENV_* bits.
+ *
+ * Returns: The new batch, or NULL if out of memory.
+ */
+EnvironmentBatch* createEnvironmentBatch(int count, int width, int height, int flags);
+
+/**
+ * Free a batch and its observation tensor. Accepts NULL.
+ */
+void destroyEnvironmentBatch(EnvironmentBatch* batch);
+
+/**
+ * Point an environment at a map. The map is only read, so one map can
+ * be shared by any number of environments.
+ *
+ * batch:     The batch.
+ * index:     The environment.
+ * map:       The tiles, row by row.
+ * mapWidth:  The width of the map in cells.
+ * mapHeight: The height of the map in cells.
+ */
+void setEnvironmentMap(EnvironmentBatch* batch, int index, const short* map, int mapWidth, int mapHeight);
+
+/**
+ * Put an environment's camera somewhere.
+ *
+ * batch: The batch.
+ * index: The environment.
+ * x:     The world x coordinate.
+ * y:     The world y coordinate.
+ * angle: The view direction in radians.
+ */
+void placeEnvironment(EnvironmentBatch* batch, int index, float x, float y, float angle);
+
+/**
+ * Move every environment by its action, then render every view into
+ * the observation tensor, all in one parallel pass.
+ *
+ * batch:   The batch.
+ * actions: INPUT_* bits held for each environment, or NULL to only
+ *          render.
+ */
+void stepEnvironments(EnvironmentBatch* batch, const Uint8* actions);
+
+/**
+ * Step a batch of textured ENV_BENCH_SIZE views with random actions.
+ *
+ * count: The number of environments.
+ * steps: The number of steps.
+ *
+ * Returns: The environment frames rendered per second, or zero if the
+ *          environments could not be created.
+ */
+float benchmarkEnvironments(int count, int steps);
+
+/* environments */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+/* ========================================================== */
+
 #endif /* MAIN_H */
\ No newline at end of file
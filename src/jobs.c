@@ -0,0 +1,126 @@
+#include <stdio.h>
+
+#include "header/main.h"
+
+/*
+ * A small fork-join worker pool. parallelFor hands out chunks of an
+ * index range from a shared atomic counter; the calling thread works
+ * on chunks too, then waits for every worker to finish the job.
+ */
+
+/* Globals */
+SDL_Thread* jobWorkers[MAX_JOB_WORKERS];
+int jobWorkerCount = 0;
+SDL_sem* jobStartSem = NULL;
+SDL_sem* jobDoneSem = NULL;
+SDL_atomic_t jobNextIndex;
+SDL_atomic_t jobsBusy;
+char jobsQuit = FALSE;
+
+/* The current job, written before workers are woken */
+JobFunction jobFunction = NULL;
+void* jobContext = NULL;
+int jobCount = 0;
+int jobGrain = 1;
+int jobWorkerLimit = 0;     /* Workers past this index sit the job out */
+
+
+void runJobChunks() {
+    int begin, end;
+
+    for(;;) {
+        begin = SDL_AtomicAdd(&jobNextIndex, jobGrain);
+        if(begin >= jobCount) break;
+        end = MIN(begin + jobGrain, jobCount);
+        jobFunction(begin, end, jobContext);
+    }
+}
+
+int jobWorkerMain(void* data) {
+    int index = (int)(size_t)data;
+
+    for(;;) {
+        SDL_SemWait(jobStartSem);
+        if(jobsQuit) break;
+        if(index < jobWorkerLimit)
+            runJobChunks();
+        SDL_SemPost(jobDoneSem);
+    }
+
+    return 0;
+}
+
+int initJobs(int workerCount) {
+    int i;
+
+    if(jobWorkerCount) return TRUE;
+
+    if(workerCount < 0)
+        workerCount = SDL_GetCPUCount() - 1;
+    workerCount = MIN(MAX(workerCount, 0), MAX_JOB_WORKERS);
+
+    SDL_AtomicSet(&jobsBusy, 0);
+    if(!workerCount) return TRUE;
+
+    jobStartSem = SDL_CreateSemaphore(0);
+    jobDoneSem = SDL_CreateSemaphore(0);
+    if(!jobStartSem || !jobDoneSem) return FALSE;
+
+    jobsQuit = FALSE;
+    for(i = 0; i < workerCount; i++) {
+        jobWorkers[i] = SDL_CreateThread(jobWorkerMain, "jobWorker", (void*)(size_t)i);
+        if(!jobWorkers[i]) break;
+        jobWorkerCount++;
+    }
+
+    return jobWorkerCount == workerCount;
+}
+
+void destroyJobs() {
+    int i;
+
+    jobsQuit = TRUE;
+    for(i = 0; i < jobWorkerCount; i++)
+        SDL_SemPost(jobStartSem);
+    for(i = 0; i < jobWorkerCount; i++)
+        SDL_WaitThread(jobWorkers[i], NULL);
+    jobWorkerCount = 0;
+
+    if(jobStartSem) SDL_DestroySemaphore(jobStartSem);
+    if(jobDoneSem) SDL_DestroySemaphore(jobDoneSem);
+    jobStartSem = jobDoneSem = NULL;
+}
+
+void parallelForWorkers(int count, int grain, int threads, JobFunction function, void* context) {
+    int i;
+
+    if(count <= 0) return;
+    if(grain < 1) grain = 1;
+
+    /* Run inline with no workers, for tiny jobs, or when called from inside a job */
+    if(!jobWorkerCount || threads == 1 || count <= grain || !SDL_AtomicCAS(&jobsBusy, 0, 1)) {
+        function(0, count, context);
+        return;
+    }
+
+    jobFunction = function;
+    jobContext = context;
+    jobCount = count;
+    jobGrain = grain;
+    jobWorkerLimit = threads > 0 ? threads - 1 : jobWorkerCount;
+    SDL_AtomicSet(&jobNextIndex, 0);
+
+    for(i = 0; i < jobWorkerCount; i++)
+        SDL_SemPost(jobStartSem);
+
+    runJobChunks();
+
+    for(i = 0; i < jobWorkerCount; i++)
+        SDL_SemWait(jobDoneSem);
+
+    SDL_AtomicSet(&jobsBusy, 0);
+}
+
+void parallelFor(int count, int grain, JobFunction function, void* context) {
+    parallelForWorkers(count, grain, 0, function, context);
+}
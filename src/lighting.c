@@ -0,0 +1,271 @@
+#include <string.h>
+
+#include "header/main.h"
+
+/*
+ * Point lights and a lightmap of the wall faces they shine on. Every
+ * face that borders open space holds a few samples along its length;
+ * a sample is lit by each light within reach that it can see, which is
+ * found by walking the grid from the light to the sample.
+ *
+ * Nothing is recomputed until a light moves, changes or a wall it could
+ * reach changes. Those mark the cells within the light's reach dirty,
+ * and updateLighting recomputes just the dirty cells, a row per job.
+ */
+
+/* Globals */
+char lightingMode = FALSE;
+Light lights[MAX_LIGHTS];
+Uint8 faceLight[MAP_GRID_HEIGHT][MAP_GRID_WIDTH][4][LIGHTMAP_FACE_SAMPLES];
+Uint8 lightDirty[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+int lightDirtyTop = MAP_GRID_HEIGHT;
+int lightDirtyBottom = -1;
+Uint32 lightCellVersion[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+Uint32 lightVersion = 0;
+
+/* Outward normals of the faces, in FACE_* order */
+const int FACE_NORMALS[4][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+
+
+void markLightRegionDirty(float x, float y, float radius) {
+    int x1 = MAX((int)floor((x - radius) / WALL_SIZE), 0);
+    int y1 = MAX((int)floor((y - radius) / WALL_SIZE), 0);
+    int x2 = MIN((int)floor((x + radius) / WALL_SIZE), MAP_GRID_WIDTH - 1);
+    int y2 = MIN((int)floor((y + radius) / WALL_SIZE), MAP_GRID_HEIGHT - 1);
+    int row;
+
+    if(x1 > x2 || y1 > y2)
+        return;
+    for(row = y1; row <= y2; row++)
+        memset(&lightDirty[row][x1], 1, x2 - x1 + 1);
+    lightDirtyTop = MIN(lightDirtyTop, y1);
+    lightDirtyBottom = MAX(lightDirtyBottom, y2);
+}
+
+int isLightShining(const Light* light) {
+    return light->used && light->on && light->intensity > 0.0f;
+}
+
+void markLightDirty(const Light* light) {
+    if(isLightShining(light))
+        markLightRegionDirty(light->pos.x, light->pos.y, light->radius);
+}
+
+void relightMapRegion(const MapRegion* region, void* context) {
+    float reach = 0.0f;
+    int i;
+    (void)context;
+
+    /* A changed wall can cast or lift shadows as far as any light reaches */
+    for(i = 0; i < MAX_LIGHTS; i++)
+        if(isLightShining(&lights[i]))
+            reach = MAX(reach, lights[i].radius);
+    if(reach <= 0.0f)
+        return;
+
+    markLightRegionDirty((region->x + region->w / 2.0f) * WALL_SIZE, (region->y + region->h / 2.0f) * WALL_SIZE,
+                         reach + MAX(region->w, region->h) * WALL_SIZE / 2.0f);
+}
+
+int isLightVisible(Vector2f from, Vector2f to) {
+    Vector2f dir = vec2Sub(to, from);
+    int mapx = (int)floor(from.x / WALL_SIZE);
+    int mapy = (int)floor(from.y / WALL_SIZE);
+    int endx = (int)floor(to.x / WALL_SIZE);
+    int endy = (int)floor(to.y / WALL_SIZE);
+    int stepx = dir.x < 0 ? -1 : 1;
+    int stepy = dir.y < 0 ? -1 : 1;
+    float deltax = fabs(1.0f / MAKE_FLOAT_NONZERO(dir.x)) * WALL_SIZE;
+    float deltay = fabs(1.0f / MAKE_FLOAT_NONZERO(dir.y)) * WALL_SIZE;
+    float sidex = ((mapx + (stepx > 0)) * WALL_SIZE - from.x) / MAKE_FLOAT_NONZERO(dir.x);
+    float sidey = ((mapy + (stepy > 0)) * WALL_SIZE - from.y) / MAKE_FLOAT_NONZERO(dir.y);
+
+    /* Walk the cells the segment crosses; any wall on the way casts a shadow */
+    while(mapx != endx || mapy != endy) {
+        if(sidex < sidey) {
+            if(sidex >= 1.0f) break;
+            sidex += deltax;
+            mapx += stepx;
+        } else {
+            if(sidey >= 1.0f) break;
+            sidey += deltay;
+            mapy += stepy;
+        }
+        if(isOpaqueTile(mapx, mapy))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+float getLightAt(Vector2f point, int face) {
+    const Light* light;
+    Vector2f toLight;
+    float total = LIGHT_AMBIENT, distance, facing;
+    int mapx = (int)floor(point.x / WALL_SIZE);
+    int mapy = (int)floor(point.y / WALL_SIZE);
+    int i;
+
+    for(i = 0; i < MAX_LIGHTS; i++) {
+        light = &lights[i];
+        if(!isLightShining(light))
+            continue;
+
+        /* Lights in rooms which can't see the point's room are skipped before any walk */
+        if(!isCellPotentiallyVisible((int)floor(light->pos.x / WALL_SIZE), (int)floor(light->pos.y / WALL_SIZE), mapx, mapy))
+            continue;
+        toLight = vec2Sub(light->pos, point);
+
+        /* Lights behind the face or out of reach don't touch it */
+        facing = toLight.x * FACE_NORMALS[face][0] + toLight.y * FACE_NORMALS[face][1];
+        distance = vec2Length(toLight);
+        if(facing <= 0.0f || distance >= light->radius)
+            continue;
+        if(!isLightVisible(light->pos, point))
+            continue;
+
+        /* Quadratic falloff, and Lambert's cosine for the angle of incidence */
+        total += light->intensity * (1.0f - distance / light->radius) * (1.0f - distance / light->radius) * facing / MAKE_FLOAT_NONZERO(distance);
+    }
+
+    return total;
+}
+
+void relightCell(int mapx, int mapy) {
+    int face, sample, nx, ny;
+    float along;
+    Vector2f point;
+
+    for(face = 0; face < 4; face++) {
+        nx = mapx + FACE_NORMALS[face][0];
+        ny = mapy + FACE_NORMALS[face][1];
+
+        /* Only faces of walls which open onto empty or see-through space can be seen */
+        if(!isSolidTile(mapx, mapy) || isOpaqueTile(nx, ny)) {
+            memset(faceLight[mapy][mapx][face], (int)(LIGHT_AMBIENT * 255), LIGHTMAP_FACE_SAMPLES);
+            continue;
+        }
+
+        for(sample = 0; sample < LIGHTMAP_FACE_SAMPLES; sample++) {
+            along = (sample + 0.5f) * WALL_SIZE / LIGHTMAP_FACE_SAMPLES;
+
+            /* Just off the face, in the open cell, so the wall itself doesn't block */
+            if(FACE_NORMALS[face][0])
+                point = vec2((mapx + (FACE_NORMALS[face][0] > 0)) * WALL_SIZE + FACE_NORMALS[face][0] * LIGHT_FACE_OFFSET, mapy * WALL_SIZE + along);
+            else
+                point = vec2(mapx * WALL_SIZE + along, (mapy + (FACE_NORMALS[face][1] > 0)) * WALL_SIZE + FACE_NORMALS[face][1] * LIGHT_FACE_OFFSET);
+
+            faceLight[mapy][mapx][face][sample] = (Uint8)(MIN(getLightAt(point, face), 1.0f) * 255);
+        }
+    }
+}
+
+void relightRows(int begin, int end, void* context) {
+    Uint8 before[4][LIGHTMAP_FACE_SAMPLES];
+    int row, col;
+    (void)context;
+
+    for(row = lightDirtyTop + begin; row < lightDirtyTop + end; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            if(!lightDirty[row][col])
+                continue;
+            memcpy(before, faceLight[row][col], sizeof(before));
+            relightCell(col, row);
+            lightDirty[row][col] = 0;
+
+            /* Only cells whose light really changed count as relit */
+            if(memcmp(before, faceLight[row][col], sizeof(before)))
+                lightCellVersion[row][col] = lightVersion;
+        }
+    }
+}
+
+void updateLighting() {
+    if(lightDirtyBottom < lightDirtyTop)
+        return;
+
+    lightVersion++;
+    parallelFor(lightDirtyBottom - lightDirtyTop + 1, 1, relightRows, NULL);
+    lightDirtyTop = MAP_GRID_HEIGHT;
+    lightDirtyBottom = -1;
+}
+
+void initLighting() {
+    memset(lights, 0, sizeof(lights));
+    memset(lightDirty, 1, sizeof(lightDirty));
+    memset(lightCellVersion, 0, sizeof(lightCellVersion));
+    lightDirtyTop = 0;
+    lightDirtyBottom = MAP_GRID_HEIGHT - 1;
+    updateLighting();
+    addMapListener(relightMapRegion, NULL);
+}
+
+int addLight(float x, float y, float radius, float intensity) {
+    int i;
+
+    for(i = 0; i < MAX_LIGHTS; i++) {
+        if(lights[i].used)
+            continue;
+        lights[i].pos = vec2(x, y);
+        lights[i].radius = radius;
+        lights[i].intensity = intensity;
+        lights[i].used = TRUE;
+        lights[i].on = TRUE;
+        markLightDirty(&lights[i]);
+        return i;
+    }
+    return -1;
+}
+
+void removeLight(int light) {
+    markLightDirty(&lights[light]);
+    lights[light].used = FALSE;
+}
+
+void setLightEnabled(int light, char on) {
+    if(lights[light].on == on)
+        return;
+
+    /* Whichever state shines marks the region */
+    markLightDirty(&lights[light]);
+    lights[light].on = on;
+    markLightDirty(&lights[light]);
+}
+
+void moveLight(int light, float x, float y) {
+    if(lights[light].pos.x == x && lights[light].pos.y == y)
+        return;
+
+    /* What it lit before and what it lights now */
+    markLightDirty(&lights[light]);
+    lights[light].pos = vec2(x, y);
+    markLightDirty(&lights[light]);
+}
+
+void setLightIntensity(int light, float intensity) {
+    if(lights[light].intensity == intensity)
+        return;
+    markLightDirty(&lights[light]);
+    lights[light].intensity = intensity;
+    markLightDirty(&lights[light]);
+}
+
+int getLightLevel(int mapx, int mapy, RayType side, Vector2f ray, float along) {
+    int face, sample;
+    float pos;
+
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return LIGHT_LEVELS - 1;
+
+    /* Rays travelling right hit the west face of a cell, and so on */
+    if(side == VERTICAL_RAY)
+        face = ray.x > 0 ? FACE_WEST : FACE_EAST;
+    else
+        face = ray.y > 0 ? FACE_NORTH : FACE_SOUTH;
+
+    /* Blend the two nearest samples */
+    pos = MIN(MAX(fmod(along, WALL_SIZE) * LIGHTMAP_FACE_SAMPLES / WALL_SIZE - 0.5f, 0.0f), LIGHTMAP_FACE_SAMPLES - 1.0f);
+    sample = MIN((int)pos, LIGHTMAP_FACE_SAMPLES - 2);
+    pos = faceLight[mapy][mapx][face][sample] + (faceLight[mapy][mapx][face][sample + 1] - faceLight[mapy][mapx][face][sample]) * (pos - sample);
+
+    return (int)pos * LIGHT_LEVELS / 256;
+}
@@ -1,17 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "header/main.h"
 
-#define UNUSED(x) (void)(x)
-
-const short MAP[MAP_GRID_HEIGHT][MAP_GRID_WIDTH] = {
+short MAP[MAP_GRID_HEIGHT][MAP_GRID_WIDTH] = {
     {R,R,R,R,R,R,R,R,R,R},
     {R,B,0,G,0,0,P,0,B,R},
-    {R,0,0,G,0,0,0,0,0,R},
+    {R,0,0,D,0,0,0,0,0,R},
     {R,0,0,G,0,0,G,0,0,R},
     {R,0,0,0,0,0,0,0,0,R},
     {R,0,0,0,0,0,0,0,0,R},
-    {R,0,0,G,0,0,G,0,0,R},
+    {R,0,0,G,0,0,PW(G),0,0,R},
     {R,0,0,0,0,0,0,0,0,R},
     {R,B,0,0,0,0,0,0,B,R},
     {R,R,R,R,R,R,R,R,R,R}
@@ -33,6 +32,14 @@ const Uint32 COLORS[4] = {
 };
 
 Uint32* TEXTURES[4];
+TextureSet wallTextureSet = DEFAULT_TEXTURE_SET;
+
+/* World file to stream, if any */
+const char* worldPath = NULL;
+
+/* Pose table to look rays up in, or to bake */
+const char* posesPath = NULL;
+const char* bakePosesPath = NULL;
 
 /* Program toggles */
 char gameIsRunning    = TRUE;
@@ -40,21 +47,189 @@ char showMap          = TRUE;
 char distortion       = FALSE;
 char slowRenderMode   = FALSE;
 char rayCastMode      = 0;
+char spanCastMode     = FALSE;
+char checkerboardMode = FALSE;
+char fixedPointMode   = FALSE;
 char textureMode      = 0;
+char indexedColorMode = FALSE;
+char viewCount        = 1;
+
+/* Fixed security cameras shown in the lower half of the four-way split */
+const float SECURITY_CAMERAS[2][4] = {
+    /* x, y, direction x, direction y */
+    {1.5f * WALL_SIZE, 7.5f * WALL_SIZE,  0.7071f, -0.7071f},
+    {8.5f * WALL_SIZE, 7.5f * WALL_SIZE, -0.7071f, -0.7071f}
+};
+
+/* Wall torches of the built-in map, and the light the player carries */
+const float TORCHES[4][2] = {
+    /* x, y */
+    {1.5f * WALL_SIZE, 1.2f * WALL_SIZE},
+    {8.5f * WALL_SIZE, 1.2f * WALL_SIZE},
+    {1.2f * WALL_SIZE, 5.0f * WALL_SIZE},
+    {8.8f * WALL_SIZE, 5.0f * WALL_SIZE}
+};
+int torchLights[4] = {-1, -1, -1, -1};
+int playerLight = -1;
+
+void setupLights() {
+    int i;
+
+    initLighting();
+
+    /* A streamed world has its own layout, so only the player's light goes there */
+    if(!worldPath)
+        for(i = 0; i < 4; i++)
+            torchLights[i] = addLight(TORCHES[i][0], TORCHES[i][1], 3.0f * WALL_SIZE, 0.9f);
+    playerLight = addLight(playerPos.x, playerPos.y, 2.5f * WALL_SIZE, 0.6f);
+}
+
+void animateLights() {
+    static Uint32 tick = 0;
+    int i;
+
+    /* A cheap flicker, counted in frames so replays look the same */
+    tick++;
+    for(i = 0; i < 4; i++)
+        if(torchLights[i] >= 0)
+            setLightIntensity(torchLights[i], 0.8f + 0.1f * (((tick / 4 + i * 7) * 2654435761u) >> 30) / 3.0f);
+    if(playerLight >= 0)
+        moveLight(playerLight, playerPos.x, playerPos.y);
+
+    updateLighting();
+}
+
+void setupCamera(Camera* camera, float x, float y, float dirX, float dirY) {
+    camera->pos = vec2(x, y);
+    camera->dir = vec2Normalize(vec2(dirX, dirY));
+    camera->plane = vec2(-camera->dir.y, camera->dir.x);
+    camera->distFromViewplane = distFromViewplane;
+}
+
+int setupSplitViews(View* views) {
+    int i;
+
+    /* The player's view and a rear view */
+    getPlayerCamera(&views[0].camera);
+    getPlayerCamera(&views[1].camera);
+    views[1].camera.dir = vec2Scale(playerDir, -1.0f);
+    views[1].camera.plane = vec2Scale(viewplaneDir, -1.0f);
+
+    if(viewCount == 2) {
+        /* Stacked, each the full width */
+        for(i = 0; i < 2; i++) {
+            views[i].x = 0;
+            views[i].y = i * (WINDOW_HEIGHT / 2);
+            views[i].width = WINDOW_WIDTH;
+            views[i].height = WINDOW_HEIGHT / 2;
+        }
+        return 2;
+    }
+
+    for(i = 0; i < 2; i++)
+        setupCamera(&views[2 + i].camera, SECURITY_CAMERAS[i][0], SECURITY_CAMERAS[i][1], SECURITY_CAMERAS[i][2], SECURITY_CAMERAS[i][3]);
+
+    /* Quarters */
+    for(i = 0; i < 4; i++) {
+        views[i].x = (i % 2) * (WINDOW_WIDTH / 2);
+        views[i].y = (i / 2) * (WINDOW_HEIGHT / 2);
+        views[i].width = WINDOW_WIDTH / 2;
+        views[i].height = WINDOW_HEIGHT / 2;
+    }
+    return 4;
+}
 
 void render() {
+    View views[MAX_VIEWS];
+
     if(showMap) {
         clearRenderer();
         renderOverheadMap();
+    } else if(viewCount > 1) { /* Draw split views */
+        renderViews(views, setupSplitViews(views));
+    } else if(checkerboardMode && !slowRenderMode) { /* Draw half the columns, reuse the rest */
+        renderInterleavedScene();
+        return;
     } else { /* Draw projected scene */
         renderProjectedScene();
     }
+
+    /* Anything else drawn leaves the screen buffer out of step with the interleaved history */
+    resetInterleavedHistory();
+}
+
+void captureRenderedFrame() {
+    /* The overhead map is drawn straight to the renderer, so there is no frame to copy */
+    if(captureFormat == CAPTURE_OFF || showMap) return;
+
+    if(indexedColorMode)
+        captureIndexedFrame(indexedScreenBuffer, PALETTE);
+    else
+        captureFrame(screenBuffer);
+}
+
+void publishRenderedFrame() {
+    /* As with capture, the overhead map leaves no frame behind */
+    if(showMap) return;
+
+    if(indexedColorMode)
+        publishIndexedFrame(indexedScreenBuffer, PALETTE);
+    else
+        publishFrame(screenBuffer);
+}
+
+void applyInputFrame(InputFrame* frame) {
+    movingForward   = (frame->held & INPUT_FORWARD) != 0;
+    movingBack      = (frame->held & INPUT_BACK) != 0;
+    turningLeft     = (frame->held & INPUT_LEFT) != 0;
+    turningRight    = (frame->held & INPUT_RIGHT) != 0;
+    playerIsRunning = (frame->held & INPUT_RUN) != 0;
+
+    if(frame->actions & ACTION_TOGGLE_TEXTURE)
+        textureMode = (textureMode + 1) % 2;
+    if(frame->actions & ACTION_TOGGLE_INDEXED)
+        indexedColorMode = !indexedColorMode;
+    if(frame->actions & ACTION_TOGGLE_MAP)
+        showMap = !showMap;
+    if(frame->actions & ACTION_TOGGLE_DISTORTION)
+        distortion = !distortion;
+    if(frame->actions & ACTION_CYCLE_CAST_MODE)
+        rayCastMode = (rayCastMode + 1) % 3;
+    if(frame->actions & ACTION_TOGGLE_SPAN_CAST)
+        spanCastMode = !spanCastMode;
+    if(frame->actions & ACTION_TOGGLE_CHECKERBOARD) {
+        checkerboardMode = !checkerboardMode;
+        resetInterleavedHistory();
+    }
+    if(frame->actions & ACTION_TOGGLE_FIXED_POINT)
+        fixedPointMode = !fixedPointMode;
+    if(frame->actions & ACTION_TOGGLE_LIGHTING)
+        lightingMode = !lightingMode;
+    if(frame->actions & ACTION_INTERACT)
+        interactWithMap(playerPos, playerDir);
+    if(frame->actions & ACTION_CYCLE_VIEWS)
+        viewCount = (viewCount == 1) ? 2 : (viewCount == 2) ? 4 : 1;
+    if((frame->actions & ACTION_NARROW_FOV) && distFromViewplane - 20.0f > 100.0f)
+        distFromViewplane -= 20.0f;
+    if(frame->actions & ACTION_WIDEN_FOV)
+        distFromViewplane += 20.0f;
+    if(frame->actions & ACTION_QUIT)
+        gameIsRunning = FALSE;
+}
+
+void setHeldInput(InputFrame* frame, Uint8 bit, char keyIsDown) {
+    if(keyIsDown)
+        frame->held |= bit;
+    else
+        frame->held &= ~bit;
 }
 
-void consumeSDLEvents() {
+void consumeSDLEvents(InputFrame* frame) {
     SDL_Event event;
     char keyIsDown;
 
+    frame->actions = 0;
+
     while(SDL_PollEvent(&event)) {
         keyIsDown = (event.type == SDL_KEYDOWN);
         switch(event.type) {
@@ -62,63 +237,96 @@ void consumeSDLEvents() {
             case SDL_KEYDOWN:
                 switch(event.key.keysym.sym) {
                     case SDLK_UP:
-                        movingForward = keyIsDown;
+                        setHeldInput(frame, INPUT_FORWARD, keyIsDown);
                         break;
                     case SDLK_DOWN:
-                        movingBack = keyIsDown;
+                        setHeldInput(frame, INPUT_BACK, keyIsDown);
                         break;
                     case SDLK_LEFT:
-                        turningLeft = keyIsDown;
+                        setHeldInput(frame, INPUT_LEFT, keyIsDown);
                         break;
                     case SDLK_RIGHT:
-                        turningRight = keyIsDown;
+                        setHeldInput(frame, INPUT_RIGHT, keyIsDown);
                         break;
                     case SDLK_w:
-                        movingForward = keyIsDown;
+                        setHeldInput(frame, INPUT_FORWARD, keyIsDown);
                         break;
                     case SDLK_s:
-                        movingBack = keyIsDown;
+                        setHeldInput(frame, INPUT_BACK, keyIsDown);
                         break;
                     case SDLK_a:
-                        turningLeft = keyIsDown;
+                        setHeldInput(frame, INPUT_LEFT, keyIsDown);
                         break;
                     case SDLK_d:
-                        turningRight = keyIsDown;
+                        setHeldInput(frame, INPUT_RIGHT, keyIsDown);
                         break;
                     case SDLK_LSHIFT:
                     case SDLK_RSHIFT:
-                        playerIsRunning = keyIsDown;
+                        setHeldInput(frame, INPUT_RUN, keyIsDown);
                         break;
                     case SDLK_ESCAPE:
-                        gameIsRunning = FALSE;
+                        frame->actions |= ACTION_QUIT;
                         break;
                     case SDLK_t:
-                        if(keyIsDown) textureMode = (textureMode + 1) % 2;
+                        if(keyIsDown) frame->actions |= ACTION_TOGGLE_TEXTURE;
+                        break;
+                    case SDLK_p:
+                        if(keyIsDown) frame->actions |= ACTION_TOGGLE_INDEXED;
                         break;
                     case SDLK_m:
-                        if(keyIsDown) showMap = !showMap;
+                        if(keyIsDown) frame->actions |= ACTION_TOGGLE_MAP;
                         break;
                     case SDLK_f:
-                        if(keyIsDown) distortion = !distortion;
+                        if(keyIsDown) frame->actions |= ACTION_TOGGLE_DISTORTION;
                         break;
                     case SDLK_r:
                         if(keyIsDown) slowRenderMode = !slowRenderMode;
                         break;
+                    case SDLK_g:
+                        if(keyIsDown) frame->actions |= ACTION_TOGGLE_SPAN_CAST;
+                        break;
+                    case SDLK_x:
+                        if(keyIsDown) frame->actions |= ACTION_TOGGLE_FIXED_POINT;
+                        break;
+                    case SDLK_l:
+                        if(keyIsDown) frame->actions |= ACTION_TOGGLE_LIGHTING;
+                        break;
+                    case SDLK_k:
+                        if(keyIsDown) frame->actions |= ACTION_TOGGLE_CHECKERBOARD;
+                        break;
+#ifdef RAY_TELEMETRY
+                    case SDLK_h:
+                        if(keyIsDown) rayHeatmapMode = !rayHeatmapMode;
+                        break;
+                    case SDLK_j:
+                        if(keyIsDown) {
+                            if(writeRayHeatmap("heatmap.ppm") && writeRayHeatmap("heatmap.csv"))
+                                fprintf(stderr, "Wrote heatmap.ppm and heatmap.csv\n");
+                            printRayTelemetry();
+                        }
+                        break;
+#endif
                     case SDLK_c:
-                        if(keyIsDown) rayCastMode = (rayCastMode + 1) % 3;
+                        if(keyIsDown) frame->actions |= ACTION_CYCLE_CAST_MODE;
+                        break;
+                    case SDLK_e:
+                        if(keyIsDown) frame->actions |= ACTION_INTERACT;
+                        break;
+                    case SDLK_v:
+                        if(keyIsDown) frame->actions |= ACTION_CYCLE_VIEWS;
                         break;
                     case SDLK_LEFTBRACKET:
-                        if(keyIsDown && distFromViewplane - 20.0f > 100.0f) distFromViewplane -= 20.0f;
+                        if(keyIsDown) frame->actions |= ACTION_NARROW_FOV;
                         break;
                     case SDLK_RIGHTBRACKET:
-                        if(keyIsDown) distFromViewplane += 20.0f;
+                        if(keyIsDown) frame->actions |= ACTION_WIDEN_FOV;
                         break;
                     default:
                         break;
                 }
                 break;
             case SDL_QUIT:
-                gameIsRunning = FALSE;
+                frame->actions |= ACTION_QUIT;
                 break;
             default:
                 break;
@@ -126,32 +334,110 @@ void consumeSDLEvents() {
     }
 }
 
+void consumeReplayEvents() {
+    SDL_Event event;
+
+    /* Input comes from the replay, but the window may still be closed */
+    while(SDL_PollEvent(&event)) {
+        if(event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE))
+            gameIsRunning = FALSE;
+    }
+}
+
 void runGame() {
     long gameTicks = 0;
     long time;
+    InputFrame frame = {0, 0};
 
     do {
         time = SDL_GetTicks();
 
-        /* Handle SDL key events */
-        consumeSDLEvents();
+        /* Handle input, either live from SDL or from a replay */
+        if(replayMode == REPLAY_PLAYING) {
+            consumeReplayEvents();
+            if(!readInputFrame(&frame))
+                break;
+            beginFrameTiming();
+        } else {
+            consumeSDLEvents(&frame);
+            recordInputFrame(&frame);
+        }
+        applyInputFrame(&frame);
 
         /* Update the player */
         updatePlayer();
 
-        /* Update the raycaster */
-        updateRaycaster();
+        /* Move doors and pushwalls */
+        updateMap();
+
+        /* Stream the world around the player */
+        updateWorld();
+
+        /* Relight whatever the lights and map changes touched */
+        if(lightingMode)
+            animateLights();
+
+        /* Close the last frame's ray counts */
+        TELEMETRY_FRAME();
+
+        /* Update the raycaster (split views and checkerboard frames cast their own rays) */
+        if(showMap || (viewCount == 1 && !checkerboardMode))
+            updateRaycaster();
 
         /* Render a frame */
         render();
+        captureRenderedFrame();
+        publishRenderedFrame();
+
+        /* Replays run unthrottled */
+        if(replayMode == REPLAY_PLAYING) {
+            endFrameTiming();
+            continue;
+        }
 
         /* Fixed delay before next frame */
-        SDL_Delay(10);
+        SDL_Delay(TICK_MS);
 
         /* Print FPS every 500 frames */
         if(!(gameTicks++ % 500))
             fprintf(stderr, "FPS: %.2f\n", 1000.0f / (float)(SDL_GetTicks() - time));
     } while(gameIsRunning);
+
+    if(replayMode == REPLAY_PLAYING)
+        printFrameTimingReport();
+#ifdef RAY_TELEMETRY
+    TELEMETRY_FRAME();
+    printRayTelemetry();
+#endif
+}
+
+int loadWallTextures() {
+    int i;
+
+    /*
+     * The renderer samples from mipmapped copies of the generated textures.
+     * Everything for the walls lives in one set so it can be released (or
+     * swapped for another texture pack) in one go. None of it is drawn with
+     * SDL, so it loads without a window too.
+     */
+    wallTextureSet = createTextureSet();
+    if(wallTextureSet < 0) return FALSE;
+
+    redXorTexture = generateRedXorTexture(wallTextureSet, TEXTURE_SIZE);
+    greenXorTexture = generateGreenXorTexture(wallTextureSet, TEXTURE_SIZE);
+    blueXorTexture = generateBlueXorTexture(wallTextureSet, TEXTURE_SIZE);
+    grayXorTexture = generateGrayXorTexture(wallTextureSet, TEXTURE_SIZE);
+    if(!redXorTexture || !greenXorTexture || !blueXorTexture || !grayXorTexture) return FALSE;
+
+    initMipLayout();
+    TEXTURES[0] = createMipChain(wallTextureSet, redXorTexture);
+    TEXTURES[1] = createMipChain(wallTextureSet, greenXorTexture);
+    TEXTURES[2] = createMipChain(wallTextureSet, blueXorTexture);
+    TEXTURES[3] = createMipChain(wallTextureSet, grayXorTexture);
+    for(i = 0; i < 4; i++)
+        if(!TEXTURES[i]) return FALSE;
+
+    return initPalette(wallTextureSet);
 }
 
 int setupWindow() {
@@ -160,16 +446,7 @@ int setupWindow() {
     if(!initGFX("Raycaster", WINDOW_WIDTH, WINDOW_HEIGHT)) return FALSE;
 
     screenBuffer = createTexture(WINDOW_WIDTH, WINDOW_HEIGHT);
-    redXorTexture = generateRedXorTexture(TEXTURE_SIZE);
-    greenXorTexture = generateGreenXorTexture(TEXTURE_SIZE);
-    blueXorTexture = generateBlueXorTexture(TEXTURE_SIZE);
-    grayXorTexture = generateGrayXorTexture(TEXTURE_SIZE);
-    TEXTURES[0] = redXorTexture;
-    TEXTURES[1] = greenXorTexture;
-    TEXTURES[2] = blueXorTexture;
-    TEXTURES[3] = grayXorTexture;
-
-    if(!screenBuffer) return FALSE;
+    if(!screenBuffer || !loadWallTextures()) return FALSE;
 
     /* Make the texture initially gray */
     for(x = 0; x < WINDOW_WIDTH; x++)
@@ -179,17 +456,135 @@ int setupWindow() {
     return TRUE;
 }
 
+int runEnvironmentBenchmark(int count, int steps) {
+    float rate;
+
+    /* No window: only the textures and the workers are needed */
+    if(!loadWallTextures()) {
+        destroyTextureSet(wallTextureSet);
+        return FALSE;
+    }
+    initPlayer();
+    initJobs(-1);
+    rate = benchmarkEnvironments(count, steps);
+    destroyJobs();
+    destroyPalette();
+    destroyTextureSet(wallTextureSet);
+    if(rate <= 0.0f) return FALSE;
+
+    fprintf(stderr, "%d environments, %d steps: %.0f frames/sec\n", count, steps, rate);
+    return TRUE;
+}
+
+int runPoseBake(const char* path) {
+    /* No window: the bake only reads the map */
+    initMap();
+    initJobs(-1);
+    if(!bakePoseTable(path)) {
+        destroyJobs();
+        return FALSE;
+    }
+    destroyJobs();
+    fprintf(stderr, "Wrote %s\n", path);
+    return TRUE;
+}
+
+int parseArguments(int argc, char* argv[]) {
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--record") && i + 1 < argc) {
+            if(!startRecording(argv[++i])) {
+                fprintf(stderr, "Could not open %s for recording!\n", argv[i]);
+                return FALSE;
+            }
+        } else if(!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            if(!startPlayback(argv[++i])) {
+                fprintf(stderr, "Could not open replay %s!\n", argv[i]);
+                return FALSE;
+            }
+        } else if((!strcmp(argv[i], "--capture") || !strcmp(argv[i], "--capture-raw")) && i + 1 < argc) {
+            if(!startCapture(argv[i + 1], strcmp(argv[i], "--capture") ? CAPTURE_RAW : CAPTURE_Y4M)) {
+                fprintf(stderr, "Could not start capturing to %s!\n", argv[i + 1]);
+                return FALSE;
+            }
+            i++;
+        } else if(!strcmp(argv[i], "--frame-ring") && i + 1 < argc) {
+            if(!openFrameRing(argv[++i], DEFAULT_FRAME_RING_SLOTS)) {
+                fprintf(stderr, "Could not create frame ring %s!\n", argv[i]);
+                return FALSE;
+            }
+        } else if(!strcmp(argv[i], "--fixed-point")) {
+            fixedPointMode = TRUE;
+        } else if(!strcmp(argv[i], "--env-bench") && i + 2 < argc) {
+            if(!runEnvironmentBenchmark(atoi(argv[i + 1]), atoi(argv[i + 2]))) {
+                fprintf(stderr, "Could not set up environments!\n");
+                return FALSE;
+            }
+            exit(EXIT_SUCCESS);
+        } else if(!strcmp(argv[i], "--poses") && i + 1 < argc) {
+            posesPath = argv[++i];
+        } else if(!strcmp(argv[i], "--bake-poses") && i + 1 < argc) {
+            bakePosesPath = argv[++i];
+        } else if(!strcmp(argv[i], "--world") && i + 1 < argc) {
+            worldPath = argv[++i];
+        } else if(!strcmp(argv[i], "--make-world") && i + 2 < argc) {
+            if(!writeProceduralWorld(argv[i + 1], (Uint32)strtoul(argv[i + 2], NULL, 10), (Uint32)SDL_GetTicks())) {
+                fprintf(stderr, "Could not write world %s!\n", argv[i + 1]);
+                return FALSE;
+            }
+            fprintf(stderr, "Wrote %s\n", argv[i + 1]);
+            exit(EXIT_SUCCESS);
+        } else {
+            fprintf(stderr, "Usage: %s [--record file | --replay file] [--capture file | --capture-raw file]\n"
+                            "       [--world file | --make-world file size] [--fixed-point]\n"
+                            "       [--frame-ring name] [--env-bench count steps]\n"
+                            "       [--poses file | --bake-poses file]\n", argv[0]);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
 int main(int argc, char* argv[]) {
-    UNUSED(argc);
-    UNUSED(argv);
+    if(!parseArguments(argc, argv))
+        return EXIT_FAILURE;
+    if(bakePosesPath) {
+        if(!runPoseBake(bakePosesPath)) {
+            fprintf(stderr, "Could not bake poses to %s!\n", bakePosesPath);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
     if(!setupWindow()) {
         fprintf(stderr, "Could not initialize raycaster!\n");
         return EXIT_FAILURE;
     }
+    initMap();
     initPlayer();
+    setupLights();
+    if(posesPath && !openPoseTable(posesPath)) {
+        fprintf(stderr, "Could not open pose table %s!\n", posesPath);
+        return EXIT_FAILURE;
+    }
+    if(worldPath && !openWorld(worldPath)) {
+        fprintf(stderr, "Could not open world %s!\n", worldPath);
+        return EXIT_FAILURE;
+    }
     initRaycaster();
+    if(!initJobs(-1))
+        fprintf(stderr, "Could not start all worker threads, rendering with fewer\n");
     runGame();
 
+    stopReplay();
+    stopCapture();
+    closeFrameRing();
+    closePoseTable();
+    closeWorld();
+    destroyJobs();
+    destroyPalette();
+    destroyTextureSet(wallTextureSet);
     destroyGFX();
     return EXIT_SUCCESS;
 }
\ No newline at end of file
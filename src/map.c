@@ -1,43 +1,526 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "header/main.h"
 
+/*
+ * The map can change at runtime. Every change bumps the version of the
+ * cells it touches and is reported to the registered listeners as a
+ * dirty region, so anything derived from the map can patch just that
+ * region instead of rebuilding.
+ */
 
-void renderOverheadMap() {
-    int i, row, col;
+/* Datatypes */
+typedef struct {
+    MapListener listener;
+    void* context;
+} MapListenerEntry;
+
+typedef struct {
+    char kind;      /* MOVER_DOOR or MOVER_PUSHWALL */
+    int x, y;       /* Current cell */
+    int dx, dy;     /* Push direction */
+    int target;     /* Door opening to reach, or cells left to push */
+    int ticks;      /* Ticks until a pushwall moves again */
+} MapMover;
+
+#define MOVER_DOOR      0
+#define MOVER_PUSHWALL  1
+
+/* Globals */
+Uint16 doorOpenAmount[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+Uint32 mapCellVersion[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+Uint32 mapVersion = 0;
+int seeThroughTileCount = 0;
+
+MapListenerEntry mapListeners[MAX_MAP_LISTENERS];
+int mapListenerCount = 0;
+MapMover mapMovers[MAX_MAP_MOVERS];
+int mapMoverCount = 0;
+
+/* Overhead map cache: one rectangle list per tile color */
+const Uint8 MAP_GROUP_COLORS[MAP_TILE_GROUPS][3] = {
+    {255, 255, 255},  /* Empty */
+    {255, 0, 0},
+    {0, 255, 0},
+    {0, 0, 255},
+    {128, 128, 128},
+    {140, 90, 40}     /* Door */
+};
+SDL_Rect overheadRects[MAP_TILE_GROUPS][MAP_GRID_WIDTH * MAP_GRID_HEIGHT];
+int overheadRectCell[MAP_TILE_GROUPS][MAP_GRID_WIDTH * MAP_GRID_HEIGHT];
+int overheadRectCount[MAP_TILE_GROUPS];
+int overheadGroup[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];  /* -1 if not in a list yet */
+int overheadSlot[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+
+/* Chebyshev distance from each cell to the nearest cell a ray may stop in */
+Uint8 emptyDistance[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+int emptyDistanceCount[MAX_EMPTY_DISTANCE + 1];  /* How many cells have each distance */
+int maxEmptyDistance = 0;
+
+
+/*========================================================
+ * Cell state
+ *========================================================
+ */
+
+int isDoorOpening(int mapx, int mapy) {
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return FALSE;
+    return TILE_MATERIAL(MAP[mapy][mapx]) == D && doorOpenAmount[mapy][mapx] > 0;
+}
+
+int isInDoorGap(int mapx, int mapy, float along) {
+    if(!isDoorOpening(mapx, mapy))
+        return FALSE;
+
+    /* The gap opens from the low end of the cell as the door slides back */
+    return fmod(along, WALL_SIZE) < doorOpenAmount[mapy][mapx];
+}
+
+int playerOverlapsTile(int mapx, int mapy) {
+    return playerPos.x + PLAYER_SIZE >= mapx * WALL_SIZE && playerPos.x - PLAYER_SIZE < (mapx + 1) * WALL_SIZE
+        && playerPos.y + PLAYER_SIZE >= mapy * WALL_SIZE && playerPos.y - PLAYER_SIZE < (mapy + 1) * WALL_SIZE;
+}
+
+void countSeeThroughTiles(const MapRegion* region, void* context) {
+    int row, col;
+    (void)region;
+    (void)context;
+
+    /* Changes are rare and the whole map is cheap to count */
+    seeThroughTileCount = 0;
+    for(row = 0; row < MAP_GRID_HEIGHT; row++)
+        for(col = 0; col < MAP_GRID_WIDTH; col++)
+            seeThroughTileCount += MAP[row][col] > 0 && (MAP[row][col] & SEE_THROUGH);
+}
+
+
+/*========================================================
+ * Change tracking
+ *========================================================
+ */
+
+int addMapListener(MapListener listener, void* context) {
+    if(mapListenerCount >= MAX_MAP_LISTENERS)
+        return FALSE;
+
+    mapListeners[mapListenerCount].listener = listener;
+    mapListeners[mapListenerCount].context = context;
+    mapListenerCount++;
+    return TRUE;
+}
+
+void removeMapListener(MapListener listener, void* context) {
+    int i;
+
+    for(i = 0; i < mapListenerCount; i++) {
+        if(mapListeners[i].listener == listener && mapListeners[i].context == context) {
+            mapListeners[i] = mapListeners[--mapListenerCount];
+            return;
+        }
+    }
+}
+
+void markMapRegionChanged(int x, int y, int w, int h) {
+    MapRegion region;
+    int row, col;
+
+    region.x = MAX(x, 0);
+    region.y = MAX(y, 0);
+    region.w = MIN(x + w, MAP_GRID_WIDTH) - region.x;
+    region.h = MIN(y + h, MAP_GRID_HEIGHT) - region.y;
+    if(region.w <= 0 || region.h <= 0)
+        return;
+
+    mapVersion++;
+    for(row = region.y; row < region.y + region.h; row++)
+        for(col = region.x; col < region.x + region.w; col++)
+            mapCellVersion[row][col] = mapVersion;
+
+    for(row = 0; row < mapListenerCount; row++)
+        mapListeners[row].listener(&region, mapListeners[row].context);
+}
+
+void setMapCell(int mapx, int mapy, short value) {
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return;
+    if(MAP[mapy][mapx] == value)
+        return;
+
+    MAP[mapy][mapx] = value;
+    doorOpenAmount[mapy][mapx] = 0;
+    markMapRegionChanged(mapx, mapy, 1, 1);
+}
+
+
+/*========================================================
+ * Doors and pushwalls
+ *========================================================
+ */
+
+MapMover* findMapMover(int mapx, int mapy) {
+    int i;
+
+    for(i = 0; i < mapMoverCount; i++)
+        if(mapMovers[i].x == mapx && mapMovers[i].y == mapy)
+            return &mapMovers[i];
+
+    return NULL;
+}
+
+MapMover* addMapMover(char kind, int mapx, int mapy) {
+    MapMover* mover;
+
+    if(mapMoverCount >= MAX_MAP_MOVERS)
+        return NULL;
+
+    mover = &mapMovers[mapMoverCount++];
+    mover->kind = kind;
+    mover->x = mapx;
+    mover->y = mapy;
+    mover->dx = mover->dy = 0;
+    mover->ticks = 0;
+    return mover;
+}
+
+int toggleDoor(int mapx, int mapy) {
+    MapMover* mover;
+
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return FALSE;
+    if(TILE_MATERIAL(MAP[mapy][mapx]) != D)
+        return FALSE;
+
+    /* Reverse a door which is already moving */
+    if((mover = findMapMover(mapx, mapy))) {
+        mover->target = mover->target ? 0 : WALL_SIZE;
+        return TRUE;
+    }
+
+    if(!(mover = addMapMover(MOVER_DOOR, mapx, mapy)))
+        return FALSE;
+    mover->target = doorOpenAmount[mapy][mapx] ? 0 : WALL_SIZE;
+    return TRUE;
+}
+
+int pushWall(int mapx, int mapy, int dx, int dy) {
+    MapMover* mover;
+
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return FALSE;
+    if(!(MAP[mapy][mapx] & PUSHWALL) || findMapMover(mapx, mapy))
+        return FALSE;
+    if(!(mover = addMapMover(MOVER_PUSHWALL, mapx, mapy)))
+        return FALSE;
+
+    mover->dx = dx;
+    mover->dy = dy;
+    mover->target = PUSHWALL_DISTANCE;
+    mover->ticks = PUSHWALL_TICKS;
+    return TRUE;
+}
+
+int interactWithMap(Vector2f pos, Vector2f dir) {
+    Vector2f reach = vec2Add(pos, vec2Scale(dir, WALL_SIZE * 0.75f));
+    int mapx = (int)(reach.x / WALL_SIZE);
+    int mapy = (int)(reach.y / WALL_SIZE);
+
+    if(toggleDoor(mapx, mapy))
+        return TRUE;
+
+    /* Walls are pushed along the axis the player faces most */
+    if(fabs(dir.x) > fabs(dir.y))
+        return pushWall(mapx, mapy, dir.x > 0 ? 1 : -1, 0);
+    return pushWall(mapx, mapy, 0, dir.y > 0 ? 1 : -1);
+}
+
+int updateMapMover(MapMover* mover) {
+    int amount, nextx, nexty;
+
+    if(mover->kind == MOVER_DOOR) {
+        amount = doorOpenAmount[mover->y][mover->x];
+
+        /* Wait for the doorway to clear before closing */
+        if(mover->target < amount && playerOverlapsTile(mover->x, mover->y))
+            return TRUE;
+
+        if(mover->target > amount)
+            amount = MIN(amount + DOOR_SPEED, mover->target);
+        else
+            amount = MAX(amount - DOOR_SPEED, mover->target);
+
+        doorOpenAmount[mover->y][mover->x] = amount;
+        markMapRegionChanged(mover->x, mover->y, 1, 1);
+        return amount != mover->target;
+    }
+
+    if(--mover->ticks > 0)
+        return TRUE;
+
+    nextx = mover->x + mover->dx;
+    nexty = mover->y + mover->dy;
+    if(isSolidTile(nextx, nexty) || MAP[nexty][nextx] > 0 || playerOverlapsTile(nextx, nexty))
+        return FALSE;
+
+    /* Move the wall one cell; both cells change in one region */
+    MAP[nexty][nextx] = MAP[mover->y][mover->x];
+    MAP[mover->y][mover->x] = 0;
+    markMapRegionChanged(MIN(mover->x, nextx), MIN(mover->y, nexty), abs(mover->dx) + 1, abs(mover->dy) + 1);
+
+    mover->x = nextx;
+    mover->y = nexty;
+    mover->ticks = PUSHWALL_TICKS;
+    return --mover->target > 0;
+}
+
+void shiftMapState(int dx, int dy) {
+    static Uint16 shifted[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+    int row, col, i = 0;
+
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            if(row + dy < 0 || col + dx < 0 || row + dy >= MAP_GRID_HEIGHT || col + dx >= MAP_GRID_WIDTH)
+                shifted[row][col] = 0;
+            else
+                shifted[row][col] = doorOpenAmount[row + dy][col + dx];
+        }
+    }
+    memcpy(doorOpenAmount, shifted, sizeof(shifted));
+
+    /* Whatever moves out of the map stops where it is */
+    while(i < mapMoverCount) {
+        mapMovers[i].x -= dx;
+        mapMovers[i].y -= dy;
+        if(mapMovers[i].x < 0 || mapMovers[i].y < 0 || mapMovers[i].x >= MAP_GRID_WIDTH || mapMovers[i].y >= MAP_GRID_HEIGHT)
+            mapMovers[i] = mapMovers[--mapMoverCount];
+        else
+            i++;
+    }
+}
+
+void updateMap() {
+    int i = 0;
+
+    /* Only cells which are actually moving are touched */
+    while(i < mapMoverCount) {
+        if(updateMapMover(&mapMovers[i]))
+            i++;
+        else
+            mapMovers[i] = mapMovers[--mapMoverCount];
+    }
+}
+
+/*========================================================
+ * Empty-space distance field
+ *========================================================
+ *
+ * A cell at distance d has nothing but empty cells within d - 1 cells
+ * of it in every direction, so a ray can cross that many cells without
+ * looking at them. Doors count as walls whether open or not, so doors
+ * moving don't change the field.
+ */
+
+int isDistanceFieldWall(int mapx, int mapy) {
+    return isSolidTile(mapx, mapy) || MAP[mapy][mapx] > 0;
+}
+
+int getEmptyDistance(int mapx, int mapy) {
+    /* Everything off the map is wall */
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return 0;
+    return emptyDistance[mapy][mapx];
+}
+
+void relaxDistance(int mapx, int mapy, int dx, int dy) {
+    int d = getEmptyDistance(mapx + dx, mapy + dy) + 1;
+
+    if(d < emptyDistance[mapy][mapx])
+        emptyDistance[mapy][mapx] = d;
+}
+
+void countEmptyDistances(int x1, int y1, int x2, int y2, int delta) {
+    int row, col;
+
+    for(row = y1; row <= y2; row++)
+        for(col = x1; col <= x2; col++)
+            emptyDistanceCount[emptyDistance[row][col]] += delta;
+}
+
+void buildDistanceField(int x1, int y1, int x2, int y2) {
+    int row, col;
+
+    /* The window's old distances leave the histogram and its new ones join it below */
+    countEmptyDistances(x1, y1, x2, y2, -1);
+    for(row = y1; row <= y2; row++)
+        for(col = x1; col <= x2; col++)
+            emptyDistance[row][col] = isDistanceFieldWall(col, row) ? 0 : MAX_EMPTY_DISTANCE;
+
+    /*
+     * Two raster passes with the 8-neighbour chamfer mask give the exact
+     * Chebyshev distance. Cells just outside the window keep their values
+     * and seed the passes, so a window can be rebuilt on its own.
+     */
+    for(row = y1; row <= y2; row++) {
+        for(col = x1; col <= x2; col++) {
+            relaxDistance(col, row, -1, 0);
+            relaxDistance(col, row, -1, -1);
+            relaxDistance(col, row, 0, -1);
+            relaxDistance(col, row, 1, -1);
+        }
+    }
+    for(row = y2; row >= y1; row--) {
+        for(col = x2; col >= x1; col--) {
+            relaxDistance(col, row, 1, 0);
+            relaxDistance(col, row, 1, 1);
+            relaxDistance(col, row, 0, 1);
+            relaxDistance(col, row, -1, 1);
+        }
+    }
+    countEmptyDistances(x1, y1, x2, y2, 1);
+}
+
+void updateMaxEmptyDistance() {
+    /* The highest distance any cell still has */
+    maxEmptyDistance = MAX_EMPTY_DISTANCE;
+    while(maxEmptyDistance > 0 && emptyDistanceCount[maxEmptyDistance] == 0)
+        maxEmptyDistance--;
+}
+
+void patchDistanceField(const MapRegion* region, void* context) {
+    int row, col, changed = FALSE;
+    int reach;
+    (void)context;
+
+    for(row = region->y; row < region->y + region->h; row++)
+        for(col = region->x; col < region->x + region->w; col++)
+            changed |= isDistanceFieldWall(col, row) != (emptyDistance[row][col] == 0);
+    if(!changed)
+        return;
+
+    /*
+     * A cell further than maxEmptyDistance from the region can't have
+     * had its nearest wall there, and a new wall there is further than
+     * its nearest one, so only cells within that reach change.
+     */
+    reach = maxEmptyDistance + 1;
+    buildDistanceField(MAX(region->x - reach, 0), MAX(region->y - reach, 0),
+            MIN(region->x + region->w - 1 + reach, MAP_GRID_WIDTH - 1), MIN(region->y + region->h - 1 + reach, MAP_GRID_HEIGHT - 1));
+    updateMaxEmptyDistance();
+}
+
+
+/*========================================================
+ * Overhead map
+ *========================================================
+ */
+
+int getOverheadTileGroup(int mapx, int mapy) {
+    int material = TILE_MATERIAL(MAP[mapy][mapx]);
+
+    if(material == D)
+        return doorOpenAmount[mapy][mapx] < WALL_SIZE ? MAP_TILE_GROUPS - 1 : 0;
+    if(material < 1 || material > 4)
+        return 0;
+    return material;
+}
+
+void updateOverheadTile(int mapx, int mapy) {
     float mapGridSquareSize = (float)HUD_MAP_SIZE / (float)MAP_GRID_WIDTH;
     int mapXOffset = (WINDOW_WIDTH - HUD_MAP_SIZE) / 2;
     int mapYOffset = (WINDOW_HEIGHT - HUD_MAP_SIZE) / 2;
+    int group = getOverheadTileGroup(mapx, mapy);
+    int oldGroup = overheadGroup[mapy][mapx];
+    int slot = overheadSlot[mapy][mapx];
+    int last, cell;
+    SDL_Rect* rect;
+
+    if(group == oldGroup)
+        return;
+
+    /* Take the tile out of its old list by moving that list's last tile into its slot */
+    if(oldGroup >= 0) {
+        last = --overheadRectCount[oldGroup];
+        cell = overheadRectCell[oldGroup][last];
+        overheadRects[oldGroup][slot] = overheadRects[oldGroup][last];
+        overheadRectCell[oldGroup][slot] = cell;
+        overheadSlot[cell / MAP_GRID_WIDTH][cell % MAP_GRID_WIDTH] = slot;
+    }
 
+    rect = &overheadRects[group][overheadRectCount[group]];
+    rect->x = (int)(mapGridSquareSize * mapx) + mapXOffset;
+    rect->y = (int)(mapGridSquareSize * mapy) + mapYOffset;
+    rect->w = mapGridSquareSize;
+    rect->h = mapGridSquareSize;
+    overheadRectCell[group][overheadRectCount[group]] = mapy * MAP_GRID_WIDTH + mapx;
+    overheadGroup[mapy][mapx] = group;
+    overheadSlot[mapy][mapx] = overheadRectCount[group]++;
+}
+
+void patchOverheadMap(const MapRegion* region, void* context) {
+    int row, col;
+    (void)context;
+
+    for(row = region->y; row < region->y + region->h; row++)
+        for(col = region->x; col < region->x + region->w; col++)
+            updateOverheadTile(col, row);
+}
+
+void initMap() {
+    int row, col;
 
-    /* Draw map tiles */
     for(row = 0; row < MAP_GRID_HEIGHT; row++) {
         for(col = 0; col < MAP_GRID_WIDTH; col++) {
-            switch(MAP[row][col]) {
-                case R:
-                    setDrawColor(255, 0, 0, 255);
-                    break;
-                case G:
-                    setDrawColor(0, 255, 0, 255);
-                    break;
-                case B:
-                    setDrawColor(0, 0, 255, 255);
-                    break;
-                case W:
-                    setDrawColor(128, 128, 128, 255);
-                    break;
-                default:
-                    setDrawColor(255, 255, 255, 255);
-                    break;
-            }
-            fillRect((int)(mapGridSquareSize * col) + mapXOffset, (int)(mapGridSquareSize * row) + mapYOffset, mapGridSquareSize, mapGridSquareSize);
+            doorOpenAmount[row][col] = 0;
+            mapCellVersion[row][col] = 0;
+            overheadGroup[row][col] = -1;
         }
     }
+    for(row = 0; row < MAP_TILE_GROUPS; row++)
+        overheadRectCount[row] = 0;
+    memset(emptyDistance, 0, sizeof(emptyDistance));
+    memset(emptyDistanceCount, 0, sizeof(emptyDistanceCount));
+    emptyDistanceCount[0] = MAP_GRID_WIDTH * MAP_GRID_HEIGHT;
+    mapVersion = 0;
+    mapMoverCount = 0;
+
+    for(row = 0; row < MAP_GRID_HEIGHT; row++)
+        for(col = 0; col < MAP_GRID_WIDTH; col++)
+            updateOverheadTile(col, row);
+
+    buildDistanceField(0, 0, MAP_GRID_WIDTH - 1, MAP_GRID_HEIGHT - 1);
+    updateMaxEmptyDistance();
+    countSeeThroughTiles(NULL, NULL);
+
+    mapListenerCount = 0;
+    addMapListener(patchOverheadMap, NULL);
+    addMapListener(patchDistanceField, NULL);
+    addMapListener(countSeeThroughTiles, NULL);
+    initVisibility();
+}
+
+void renderOverheadMap() {
+    int i;
+    int mapXOffset = (WINDOW_WIDTH - HUD_MAP_SIZE) / 2;
+    int mapYOffset = (WINDOW_HEIGHT - HUD_MAP_SIZE) / 2;
+
+
+    /* Draw map tiles, one batch per color */
+    for(i = 0; i < MAP_TILE_GROUPS; i++) {
+        setDrawColor(MAP_GROUP_COLORS[i][0], MAP_GROUP_COLORS[i][1], MAP_GROUP_COLORS[i][2], 255);
+        fillRects(overheadRects[i], overheadRectCount[i]);
+    }
+
+#ifdef RAY_TELEMETRY
+    if(rayHeatmapMode)
+        drawRayHeatmap();
+#endif
 
     /* Draw rays */
     setDrawColor(200, 100, 50, 255);
     for(i = 0; i < WINDOW_WIDTH; i++) {
-        Vector3f ray;
-        if(fabs(homogeneousVectorMagnitude(&rays[i].hRay)) < fabs(homogeneousVectorMagnitude(&rays[i].vRay)))
+        Vector2f ray;
+        if(vec2LengthSquared(rays[i].hRay) < vec2LengthSquared(rays[i].vRay))
             ray = rays[i].hRay;
         else
             ray = rays[i].vRay;
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "header/main.h"
+
+/*
+ * Named shared memory: POSIX shm objects, or pagefile-backed file
+ * mappings on Windows. Other processes attach to the same memory by
+ * name, so nothing placed in it ever has to be copied out. Files can
+ * be mapped read-only the same way.
+ */
+
+
+void clearMapping(MemoryMapping* mapping) {
+    memset(mapping, 0, sizeof(MemoryMapping));
+#ifndef _WIN32
+    mapping->fd = -1;
+#endif
+}
+
+#ifdef _WIN32
+
+int mapSharedMemory(MemoryMapping* mapping, const char* name, size_t size, char create) {
+    MEMORY_BASIC_INFORMATION info;
+    HANDLE handle;
+
+    clearMapping(mapping);
+    if(create)
+        handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((Uint64)size >> 32), (DWORD)size, name);
+    else
+        handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    if(!handle)
+        return FALSE;
+
+    mapping->data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if(!mapping->data) {
+        CloseHandle(handle);
+        return FALSE;
+    }
+
+    /* Attaching doesn't say how big the mapping is; the view covers all of it */
+    if(!create && VirtualQuery(mapping->data, &info, sizeof(info)))
+        size = info.RegionSize;
+
+    mapping->handle = handle;
+    mapping->size = size;
+    return TRUE;
+}
+
+int mapFile(MemoryMapping* mapping, const char* path) {
+    LARGE_INTEGER size;
+    HANDLE file, handle;
+
+    clearMapping(mapping);
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    /* The mapping keeps the file open by itself */
+    handle = NULL;
+    if(GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if(!handle)
+        return FALSE;
+
+    mapping->data = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+    if(!mapping->data) {
+        CloseHandle(handle);
+        return FALSE;
+    }
+
+    mapping->handle = handle;
+    mapping->size = (size_t)size.QuadPart;
+    return TRUE;
+}
+
+void unmapMemory(MemoryMapping* mapping) {
+    if(mapping->data)
+        UnmapViewOfFile(mapping->data);
+    if(mapping->handle)
+        CloseHandle(mapping->handle);
+    clearMapping(mapping);
+}
+
+#else
+
+int openSharedMemoryFile(MemoryMapping* mapping, size_t* size, char create) {
+    struct stat info;
+
+    if(create) {
+        /* Replace whatever a crashed run left behind */
+        shm_unlink(mapping->name);
+        mapping->fd = shm_open(mapping->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if(mapping->fd < 0)
+            return FALSE;
+        mapping->owner = TRUE;
+        return ftruncate(mapping->fd, (off_t)*size) == 0;
+    }
+
+    mapping->fd = shm_open(mapping->name, O_RDWR, 0);
+    if(mapping->fd < 0 || fstat(mapping->fd, &info) != 0)
+        return FALSE;
+    *size = (size_t)info.st_size;
+    return TRUE;
+}
+
+int mapSharedMemory(MemoryMapping* mapping, const char* name, size_t size, char create) {
+    void* data;
+
+    clearMapping(mapping);
+
+    /* POSIX shm names start with a slash */
+    snprintf(mapping->name, sizeof(mapping->name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    if(!openSharedMemoryFile(mapping, &size, create)) {
+        unmapMemory(mapping);
+        return FALSE;
+    }
+
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mapping->fd, 0);
+    if(data == MAP_FAILED) {
+        unmapMemory(mapping);
+        return FALSE;
+    }
+
+    mapping->data = data;
+    mapping->size = size;
+    return TRUE;
+}
+
+int mapFile(MemoryMapping* mapping, const char* path) {
+    struct stat info;
+    void* data;
+
+    clearMapping(mapping);
+    mapping->fd = open(path, O_RDONLY);
+    if(mapping->fd < 0 || fstat(mapping->fd, &info) != 0 || info.st_size <= 0) {
+        unmapMemory(mapping);
+        return FALSE;
+    }
+
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, mapping->fd, 0);
+    if(data == MAP_FAILED) {
+        unmapMemory(mapping);
+        return FALSE;
+    }
+
+    mapping->data = data;
+    mapping->size = (size_t)info.st_size;
+    return TRUE;
+}
+
+void unmapMemory(MemoryMapping* mapping) {
+    if(mapping->data)
+        munmap(mapping->data, mapping->size);
+    if(mapping->fd >= 0)
+        close(mapping->fd);
+    if(mapping->owner)
+        shm_unlink(mapping->name);
+    clearMapping(mapping);
+}
+
+#endif
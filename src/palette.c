@@ -0,0 +1,116 @@
+#include "header/main.h"
+
+/* Globals */
+Uint32 PALETTE[PALETTE_SIZE];
+Uint8 darkenRemap[PALETTE_SIZE];
+Uint8 lightRemap[LIGHT_LEVELS][PALETTE_SIZE];
+Uint8 INDEXED_COLORS[4];
+Uint8 indexedCeilingColor;
+Uint8 indexedFloorColor;
+Uint8* INDEXED_TEXTURES[4] = {NULL, NULL, NULL, NULL};
+Uint8* indexedScreenBuffer = NULL;
+
+
+void buildRampPalette(Uint32* palette) {
+    int ramp, level, v;
+
+    /*
+     * One ramp per wall color (in the same order as COLORS and TEXTURES).
+     * Each level steps by 4, which is exactly the step the xor texture
+     * generator uses for TEXTURE_SIZE 64, so the top mip level quantizes
+     * losslessly. Smaller levels are averaged in ABGR and then quantized.
+     */
+    for(ramp = 0; ramp < PALETTE_RAMP_COUNT; ramp++) {
+        for(level = 0; level < PALETTE_RAMP_LENGTH; level++) {
+            v = level * (256 / PALETTE_RAMP_LENGTH);
+            switch(ramp) {
+                case 0:
+                    palette[PALETTE_INDEX(ramp, level)] = RGBtoABGR(v, 0, 0);
+                    break;
+                case 1:
+                    palette[PALETTE_INDEX(ramp, level)] = RGBtoABGR(0, v, 0);
+                    break;
+                case 2:
+                    palette[PALETTE_INDEX(ramp, level)] = RGBtoABGR(0, 0, v);
+                    break;
+                default:
+                    palette[PALETTE_INDEX(ramp, level)] = RGBtoABGR(v, v, v);
+                    break;
+            }
+        }
+    }
+}
+
+Uint8 nearestPaletteIndex(const Uint32* palette, Uint32 ABGRColor) {
+    int i, dr, dg, db;
+    int best = 0;
+    long dist, bestDist = -1;
+
+    for(i = 0; i < PALETTE_SIZE; i++) {
+        dr = (int)(palette[i] & 0xFF) - (int)(ABGRColor & 0xFF);
+        dg = (int)((palette[i] >> 8) & 0xFF) - (int)((ABGRColor >> 8) & 0xFF);
+        db = (int)((palette[i] >> 16) & 0xFF) - (int)((ABGRColor >> 16) & 0xFF);
+        dist = (long)dr * dr + (long)dg * dg + (long)db * db;
+
+        if(bestDist < 0 || dist < bestDist) {
+            bestDist = dist;
+            best = i;
+            if(!dist) break;
+        }
+    }
+
+    return (Uint8)best;
+}
+
+Uint8* createIndexedTexture(TextureSet set, const Uint32* texture, int texelCount, const Uint32* palette) {
+    int i;
+    Uint8* indexed = allocTextureMemory(set, texelCount); if(!indexed) { return NULL; }
+
+    for(i = 0; i < texelCount; i++)
+        indexed[i] = nearestPaletteIndex(palette, texture[i]);
+
+    return indexed;
+}
+
+int initPalette(TextureSet set) {
+    int i, level;
+
+    buildRampPalette(PALETTE);
+
+    /* Shading is a table remap instead of per-channel arithmetic */
+    for(i = 0; i < PALETTE_SIZE; i++)
+        darkenRemap[i] = nearestPaletteIndex(PALETTE, DARKEN_COLOR(PALETTE[i]));
+    for(level = 0; level < LIGHT_LEVELS; level++)
+        for(i = 0; i < PALETTE_SIZE; i++)
+            lightRemap[level][i] = nearestPaletteIndex(PALETTE, LIGHT_COLOR(PALETTE[i], LIGHT_SCALE(level)));
+
+    for(i = 0; i < 4; i++)
+        INDEXED_COLORS[i] = nearestPaletteIndex(PALETTE, COLORS[i]);
+    indexedCeilingColor = nearestPaletteIndex(PALETTE, CEILING_COLOR);
+    indexedFloorColor = nearestPaletteIndex(PALETTE, FLOOR_COLOR);
+
+    for(i = 0; i < 4; i++) {
+        INDEXED_TEXTURES[i] = createIndexedTexture(set, TEXTURES[i], textureChainLength, PALETTE);
+        if(!INDEXED_TEXTURES[i]) return FALSE;
+    }
+
+    indexedScreenBuffer = allocTextureMemory(DEFAULT_TEXTURE_SET, WINDOW_WIDTH * WINDOW_HEIGHT);
+    if(!indexedScreenBuffer) return FALSE;
+
+    for(i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; i++)
+        indexedScreenBuffer[i] = indexedFloorColor;
+
+    return TRUE;
+}
+
+void destroyPalette() {
+    int i;
+
+    for(i = 0; i < 4; i++) {
+        if(INDEXED_TEXTURES[i]) destroyTexture(INDEXED_TEXTURES[i]);
+        INDEXED_TEXTURES[i] = NULL;
+    }
+
+    if(indexedScreenBuffer) destroyTexture(indexedScreenBuffer);
+    indexedScreenBuffer = NULL;
+}
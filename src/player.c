@@ -4,8 +4,8 @@
 
 
 /* Global data */
-Vector3f playerPos    = {PLAYER_START_X, PLAYER_START_Y, 1};
-Vector3f playerDir    = {PLAYER_DIR_X, PLAYER_DIR_Y, 1};
+Vector2f playerPos    = {PLAYER_START_X, PLAYER_START_Y};
+Vector2f playerDir    = {PLAYER_DIR_X, PLAYER_DIR_Y};
 
 /* Toggles */
 char movingForward    = FALSE;
@@ -15,9 +15,9 @@ char turningRight     = FALSE;
 char playerIsRunning  = FALSE;
 
 
-void rotatePlayer(Matrix3f* rotMatrix) {
-    matrixVectorMultiply(rotMatrix, &playerDir);
-    matrixVectorMultiply(rotMatrix, &viewplaneDir);
+void rotatePlayer(Rotation2f rot) {
+    playerDir = vec2Rotate(playerDir, rot);
+    viewplaneDir = vec2Rotate(viewplaneDir, rot);
 }
 
 void updatePlayer() {
@@ -31,13 +31,13 @@ void updatePlayer() {
     } if(movingBack) {
         movePlayer(-1 * playerDir.x * moveSpeed, -1 * playerDir.y * moveSpeed);
     } if(turningLeft) {
-        rotatePlayer(&clockwiseRotation);
+        rotatePlayer(clockwiseRotation);
         if(playerIsRunning)
-            rotatePlayer(&clockwiseRotation);
+            rotatePlayer(clockwiseRotation);
     } if(turningRight) {
-        rotatePlayer(&counterClockwiseRotation);
+        rotatePlayer(counterClockwiseRotation);
         if(playerIsRunning)
-            rotatePlayer(&counterClockwiseRotation);
+            rotatePlayer(counterClockwiseRotation);
     }
 
 }
@@ -76,7 +76,7 @@ int clipMovement(float dx, float dy) {
     /* Check all tiles the player occupies */
     for(i = y1; i <= y2; i++) {
         for(j = x1; j <= x2; j++) {
-            if(i < 0 || j < 0 || i > MAP_GRID_HEIGHT || j > MAP_GRID_WIDTH || MAP[i][j] > 0) {
+            if(isSolidTile(j, i)) {
                 return TRUE;
             }
         }
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "header/main.h"
+
+/*
+ * Pose table file layout (all multi-byte values little-endian):
+ *
+ *   "MZPV"  magic
+ *   Uint8   version
+ *   Uint8   POSE_GRID
+ *   Uint16  unused
+ *   Uint32  map width in cells
+ *   Uint32  map height in cells
+ *   Uint32  POSE_RAYS
+ *   Uint32  checksum of the map it was baked for
+ *   Uint32  number of baked cells
+ *   Uint32  unused
+ *   Uint32  slot of every cell, row by row; POSE_NO_SLOT if not baked
+ *   positions...
+ *
+ * Each baked cell holds POSE_GRID * POSE_GRID positions row by row. A
+ * position starts with four Uint16s, the first and last column and row
+ * of the cells it can see, and then holds POSE_RAYS records, one per
+ * ray, counterclockwise from the +x axis. A record is the Uint16
+ * (distance * POSE_DISTANCE_SCALE) << 2, with POSE_RECORD_VERTICAL set
+ * if the ray hit a vertical grid line and POSE_RECORD_CLEAR set if it
+ * kept POSE_CLEARANCE away from every other wall on its way there.
+ *
+ * The distance only has to tell which grid line the wall is on; the
+ * exact hit is found again from the live camera, so two bytes a ray
+ * are plenty and the records stay small enough to map in whole. The
+ * live camera isn't where the ray was baked from, though. Its ray
+ * starts and ends within POSE_CLEARANCE of the baked one, so only a
+ * clear baked ray is sure to have no nearer wall in the way of it.
+ */
+#define POSE_MAGIC           "MZPV"
+#define POSE_VERSION         2
+#define POSE_HEADER_SIZE     32
+#define POSE_VIEW_SIZE       8
+#define POSE_NO_SLOT         0xFFFFFFFF
+#define POSE_DISTANCE_SCALE  2
+#define POSE_MAX_DISTANCE    0x3FFF
+#define POSE_RECORD_VERTICAL 1
+#define POSE_RECORD_CLEAR    2
+#define POSE_CLEARANCE       (MAX(POSE_SNAP_DISTANCE, POSE_HIT_TOLERANCE) + 1.0f)
+#define POSE_CORNER_SLACK    0.01f  /* Hits closer than this to a corner are traced */
+#define POSE_MAX_CHANGES     32     /* Changed regions tracked before they are merged */
+
+/* Globals */
+MemoryMapping poseMapping;
+const Uint8* poseSlots = NULL;      /* Into the mapping; NULL without a table */
+const Uint8* poseRecords = NULL;
+short* poseOpenTiles = NULL;        /* The map as it was when the table was opened */
+Uint16* poseOpenDoors = NULL;
+MapRegion poseChanges[POSE_MAX_CHANGES];  /* Every cell unlike the opened map is in one */
+int poseChangeCount = 0;
+Vector2f poseRayDirs[POSE_RAYS];
+float poseColumnAngles[VIEWPLANE_LENGTH];  /* Of each column off the view direction */
+float poseColumnDist = 0.0f;                /* Viewplane distance and width they are for */
+int poseColumnWidth = 0;
+
+
+Uint32 getMapChecksum() {
+    Uint32 hash = 2166136261u;
+    int row, col;
+
+    /* FNV-1a over the tiles */
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            hash = (hash ^ (MAP[row][col] & 0xFF)) * 16777619u;
+            hash = (hash ^ ((MAP[row][col] >> 8) & 0xFF)) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+void initPoseRayDirs() {
+    int i;
+
+    for(i = 0; i < POSE_RAYS; i++)
+        poseRayDirs[i] = vec2((float)cos(2.0 * PI * i / POSE_RAYS), (float)sin(2.0 * PI * i / POSE_RAYS));
+}
+
+Vector2f getPosePosition(int mapx, int mapy, int pose) {
+    return vec2((mapx + ((pose % POSE_GRID) + 0.5f) / POSE_GRID) * WALL_SIZE, (mapy + ((pose / POSE_GRID) + 0.5f) / POSE_GRID) * WALL_SIZE);
+}
+
+size_t getPoseBytes() {
+    return POSE_VIEW_SIZE + (size_t)POSE_RAYS * 2;
+}
+
+size_t getPoseCellBytes() {
+    return (size_t)POSE_GRID * POSE_GRID * getPoseBytes();
+}
+
+
+/*========================================================
+ * Baking
+ *========================================================
+ */
+
+/* Work shared by the jobs of a bake */
+typedef struct {
+    const int* cells;   /* Map index of each slot */
+    Uint8* records;
+} PoseBake;
+
+int clipToSlab(float start, float delta, float lo, float hi, float* t0, float* t1) {
+    float enter, leave;
+
+    if(fabs(delta) < EPS)
+        return start >= lo && start <= hi;
+    enter = (lo - start) / delta;
+    leave = (hi - start) / delta;
+    *t0 = MAX(*t0, MIN(enter, leave));
+    *t1 = MIN(*t1, MAX(enter, leave));
+    return *t0 <= *t1;
+}
+
+/* Whether a segment comes within margin of a cell, the margin squared off */
+int isSegmentNearCell(Vector2f from, Vector2f to, int mapx, int mapy, float margin) {
+    float t0 = 0.0f, t1 = 1.0f;
+
+    return clipToSlab(from.x, to.x - from.x, mapx * WALL_SIZE - margin, (mapx + 1) * WALL_SIZE + margin, &t0, &t1)
+        && clipToSlab(from.y, to.y - from.y, mapy * WALL_SIZE - margin, (mapy + 1) * WALL_SIZE + margin, &t0, &t1);
+}
+
+/*
+ * Whether a baked ray keeps POSE_CLEARANCE from every opaque cell on
+ * the near side of the grid line it hit. Cells past the line can't be
+ * in the way of a ray that ends on it. Each column of cells is only
+ * checked where the ray passes through it.
+ */
+int isBakedRayClear(Vector2f from, Vector2f to, char vertical, int line) {
+    Vector2f ray = vec2Sub(to, from);
+    char positive = (vertical ? ray.x : ray.y) > 0;
+    float t0, t1, y0, y1;
+    int col, row, across;
+
+    for(col = (int)floor((MIN(from.x, to.x) - POSE_CLEARANCE) / WALL_SIZE); col <= (int)floor((MAX(from.x, to.x) + POSE_CLEARANCE) / WALL_SIZE); col++) {
+        t0 = 0.0f;
+        t1 = 1.0f;
+        if(!clipToSlab(from.x, ray.x, col * WALL_SIZE - POSE_CLEARANCE, (col + 1) * WALL_SIZE + POSE_CLEARANCE, &t0, &t1))
+            continue;
+        y0 = from.y + ray.y * t0;
+        y1 = from.y + ray.y * t1;
+
+        for(row = (int)floor((MIN(y0, y1) - POSE_CLEARANCE) / WALL_SIZE); row <= (int)floor((MAX(y0, y1) + POSE_CLEARANCE) / WALL_SIZE); row++) {
+            across = vertical ? col : row;
+            if(positive ? across >= line : across < line)
+                continue;
+            if(isOpaqueTile(col, row) && isSegmentNearCell(from, to, col, row, POSE_CLEARANCE))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void bakePoseCells(int begin, int end, void* context) {
+    const PoseBake* bake = context;
+    Uint8* out;
+    RayTuple ray;
+    Vector2f pos, hit;
+    float distance;
+    char vertical;
+    int slot, pose, i, line, x1, y1, x2, y2;
+
+    for(slot = begin; slot < end; slot++) {
+        out = bake->records + getPoseCellBytes() * slot;
+
+        for(pose = 0; pose < POSE_GRID * POSE_GRID; pose++, out += getPoseBytes()) {
+            pos = getPosePosition(bake->cells[slot] % MAP_GRID_WIDTH, bake->cells[slot] / MAP_GRID_WIDTH, pose);
+            x1 = x2 = bake->cells[slot] % MAP_GRID_WIDTH;
+            y1 = y2 = bake->cells[slot] / MAP_GRID_WIDTH;
+
+            for(i = 0; i < POSE_RAYS; i++) {
+                ray.vRay = ray.hRay = poseRayDirs[i];
+                traceRay(pos, &ray);
+
+                /* Pick the ray the same way the renderer does */
+                vertical = !(vec2LengthSquared(ray.hRay) < vec2LengthSquared(ray.vRay));
+                hit = vertical ? ray.vRay : ray.hRay;
+                distance = MIN(vec2Length(hit) * POSE_DISTANCE_SCALE, POSE_MAX_DISTANCE);
+                line = (int)floor((vertical ? pos.x + hit.x : pos.y + hit.y) / WALL_SIZE + 0.5f);
+                hit = vec2Add(pos, hit);
+                putU16(out + POSE_VIEW_SIZE + i * 2, ((Uint32)distance << 2) | (vertical ? POSE_RECORD_VERTICAL : 0)
+                       | (isBakedRayClear(pos, hit, vertical, line) ? POSE_RECORD_CLEAR : 0));
+
+                /* The cells on both sides of the hit */
+                x1 = MIN(x1, (int)floor((hit.x - 1.0f) / WALL_SIZE));
+                y1 = MIN(y1, (int)floor((hit.y - 1.0f) / WALL_SIZE));
+                x2 = MAX(x2, (int)floor((hit.x + 1.0f) / WALL_SIZE));
+                y2 = MAX(y2, (int)floor((hit.y + 1.0f) / WALL_SIZE));
+            }
+
+            /* A camera near the position sees a little further round than it */
+            putU16(out, MAX(x1 - 1, 0));
+            putU16(out + 2, MAX(y1 - 1, 0));
+            putU16(out + 4, MIN(x2 + 1, MAP_GRID_WIDTH - 1));
+            putU16(out + 6, MIN(y2 + 1, MAP_GRID_HEIGHT - 1));
+        }
+    }
+}
+
+int bakePoseTable(const char* path) {
+    Uint8 header[POSE_HEADER_SIZE];
+    Uint8* slots;
+    PoseBake bake;
+    int* cells;
+    int row, col, count = 0, ok = TRUE;
+    FILE* file;
+
+    slots = malloc((size_t)MAP_GRID_WIDTH * MAP_GRID_HEIGHT * 4);
+    cells = malloc((size_t)MAP_GRID_WIDTH * MAP_GRID_HEIGHT * sizeof(int));
+    if(!slots || !cells) {
+        free(slots);
+        free(cells);
+        return FALSE;
+    }
+
+    /* Only cells the camera can stand in are baked */
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            if(isSolidTile(col, row)) {
+                putU32(slots + (row * MAP_GRID_WIDTH + col) * 4, POSE_NO_SLOT);
+                continue;
+            }
+            putU32(slots + (row * MAP_GRID_WIDTH + col) * 4, count);
+            cells[count++] = row * MAP_GRID_WIDTH + col;
+        }
+    }
+
+    bake.cells = cells;
+    bake.records = malloc(getPoseCellBytes() * MAX(count, 1));
+    file = fopen(path, "wb");
+    if(!bake.records || !file) {
+        if(file) fclose(file);
+        free(bake.records);
+        free(slots);
+        free(cells);
+        return FALSE;
+    }
+
+    initPoseRayDirs();
+    parallelFor(count, 1, bakePoseCells, &bake);
+
+    memset(header, 0, POSE_HEADER_SIZE);
+    memcpy(header, POSE_MAGIC, 4);
+    header[4] = POSE_VERSION;
+    header[5] = POSE_GRID;
+    putU32(header + 8, MAP_GRID_WIDTH);
+    putU32(header + 12, MAP_GRID_HEIGHT);
+    putU32(header + 16, POSE_RAYS);
+    putU32(header + 20, getMapChecksum());
+    putU32(header + 24, count);
+
+    ok &= fwrite(header, 1, POSE_HEADER_SIZE, file) == POSE_HEADER_SIZE;
+    ok &= fwrite(slots, 4, (size_t)MAP_GRID_WIDTH * MAP_GRID_HEIGHT, file) == (size_t)MAP_GRID_WIDTH * MAP_GRID_HEIGHT;
+    ok &= fwrite(bake.records, getPoseCellBytes(), count, file) == (size_t)count;
+
+    free(bake.records);
+    free(slots);
+    free(cells);
+    return fclose(file) == 0 && ok;
+}
+
+
+/*========================================================
+ * Lookup
+ *========================================================
+ */
+
+int isPoseRegionAsOpened(const MapRegion* region) {
+    int row, col;
+
+    for(row = region->y; row < region->y + region->h; row++) {
+        for(col = region->x; col < region->x + region->w; col++) {
+            if(MAP[row][col] != poseOpenTiles[row * MAP_GRID_WIDTH + col] || doorOpenAmount[row][col] != poseOpenDoors[row * MAP_GRID_WIDTH + col])
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+int isPoseRegionOverlapping(const MapRegion* a, const MapRegion* b) {
+    return a->x < b->x + b->w && b->x < a->x + a->w && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+void trackPoseChanges(const MapRegion* region, void* context) {
+    MapRegion* last;
+    int i, x2, y2;
+    (void)context;
+
+    /* Regions back as they were, like a door that closed again, no longer matter */
+    for(i = 0; i < poseChangeCount; ) {
+        if(isPoseRegionAsOpened(&poseChanges[i]))
+            poseChanges[i] = poseChanges[--poseChangeCount];
+        else
+            i++;
+    }
+    if(isPoseRegionAsOpened(region))
+        return;
+    for(i = 0; i < poseChangeCount; i++)
+        if(!memcmp(&poseChanges[i], region, sizeof(MapRegion)))
+            return;
+
+    if(poseChangeCount < POSE_MAX_CHANGES) {
+        poseChanges[poseChangeCount++] = *region;
+        return;
+    }
+
+    /* Out of room, so the last region grows to cover this one too */
+    last = &poseChanges[POSE_MAX_CHANGES - 1];
+    x2 = MAX(last->x + last->w, region->x + region->w);
+    y2 = MAX(last->y + last->h, region->y + region->h);
+    last->x = MIN(last->x, region->x);
+    last->y = MIN(last->y, region->y);
+    last->w = x2 - last->x;
+    last->h = y2 - last->y;
+}
+
+int openPoseTable(const char* path) {
+    const Uint8* data;
+    size_t slotBytes = (size_t)MAP_GRID_WIDTH * MAP_GRID_HEIGHT * 4;
+
+    if(poseSlots) return FALSE;
+    if(!mapFile(&poseMapping, path)) return FALSE;
+
+    /* The table is only any use for exactly the map it was baked for */
+    data = poseMapping.data;
+    if(poseMapping.size < POSE_HEADER_SIZE + slotBytes || memcmp(data, POSE_MAGIC, 4) || data[4] != POSE_VERSION || data[5] != POSE_GRID
+        || getU32(data + 8) != MAP_GRID_WIDTH || getU32(data + 12) != MAP_GRID_HEIGHT || getU32(data + 16) != POSE_RAYS
+        || getU32(data + 20) != getMapChecksum()
+        || poseMapping.size < POSE_HEADER_SIZE + slotBytes + getPoseCellBytes() * getU32(data + 24)) {
+        unmapMemory(&poseMapping);
+        return FALSE;
+    }
+
+    /* Changes are told apart from the map as it is now */
+    poseOpenTiles = malloc(sizeof(MAP));
+    poseOpenDoors = malloc(sizeof(doorOpenAmount));
+    if(!poseOpenTiles || !poseOpenDoors || !addMapListener(trackPoseChanges, NULL)) {
+        free(poseOpenTiles);
+        free(poseOpenDoors);
+        poseOpenTiles = NULL;
+        poseOpenDoors = NULL;
+        unmapMemory(&poseMapping);
+        return FALSE;
+    }
+    memcpy(poseOpenTiles, MAP, sizeof(MAP));
+    memcpy(poseOpenDoors, doorOpenAmount, sizeof(doorOpenAmount));
+    poseChangeCount = 0;
+
+    initPoseRayDirs();
+    poseSlots = data + POSE_HEADER_SIZE;
+    poseRecords = poseSlots + slotBytes;
+    return TRUE;
+}
+
+void closePoseTable() {
+    if(!poseSlots) return;
+    removeMapListener(trackPoseChanges, NULL);
+    unmapMemory(&poseMapping);
+    free(poseOpenTiles);
+    free(poseOpenDoors);
+    poseOpenTiles = NULL;
+    poseOpenDoors = NULL;
+    poseSlots = NULL;
+    poseRecords = NULL;
+}
+
+int isBakedHitWall(int line, float along, char vertical, char negative) {
+    int across = negative ? line - 1 : line;
+    int cell = (int)floor(along / WALL_SIZE);
+
+    /* Right at a corner, rounding decides which wall a ray hits */
+    if(along - cell * WALL_SIZE < POSE_CORNER_SLACK || (cell + 1) * WALL_SIZE - along < POSE_CORNER_SLACK)
+        return FALSE;
+    if(vertical)
+        return isOpaqueTile(across, cell) && !isInDoorGap(across, cell, along);
+    return isOpaqueTile(cell, across) && !isInDoorGap(cell, across, along);
+}
+
+void updatePoseColumnAngles(float dist, int width) {
+    int column;
+
+    if(dist == poseColumnDist && width == poseColumnWidth)
+        return;
+    for(column = 0; column < width; column++)
+        poseColumnAngles[column] = (float)atan2(column - (width / 2), dist);
+    poseColumnDist = dist;
+    poseColumnWidth = width;
+}
+
+int castBakedRays(const Camera* camera, RayTuple* rays, int width) {
+    int mapx = (int)floor(camera->pos.x / WALL_SIZE);
+    int mapy = (int)floor(camera->pos.y / WALL_SIZE);
+    float dist = camera->distFromViewplane * width / (float)VIEWPLANE_LENGTH;
+    int posex, posey, index, column, line, i;
+    const Uint8* records;
+    MapRegion view;
+    Uint32 slot, record;
+    Vector2f pos, dir, hit, columnHit;
+    float angle, turn, lineDist, t;
+    char vertical;
+
+    if(!poseSlots)
+        return FALSE;
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT || width > VIEWPLANE_LENGTH)
+        return FALSE;
+    slot = getU32(poseSlots + (mapy * MAP_GRID_WIDTH + mapx) * 4);
+    if(slot == POSE_NO_SLOT)
+        return FALSE;
+
+    /* The nearest baked position, if the camera is close enough to it */
+    posex = MIN((int)((camera->pos.x / WALL_SIZE - mapx) * POSE_GRID), POSE_GRID - 1);
+    posey = MIN((int)((camera->pos.y / WALL_SIZE - mapy) * POSE_GRID), POSE_GRID - 1);
+    pos = getPosePosition(mapx, mapy, posey * POSE_GRID + posex);
+    if(vec2LengthSquared(vec2Sub(camera->pos, pos)) > POSE_SNAP_DISTANCE * POSE_SNAP_DISTANCE)
+        return FALSE;
+    records = poseRecords + getPoseCellBytes() * slot + (size_t)(posey * POSE_GRID + posex) * getPoseBytes();
+
+    /* A change to the map anywhere the position can see makes its rays wrong */
+    view.x = getU16(records);
+    view.y = getU16(records + 2);
+    view.w = getU16(records + 4) - view.x + 1;
+    view.h = getU16(records + 6) - view.y + 1;
+    for(i = 0; i < poseChangeCount; i++)
+        if(isPoseRegionOverlapping(&view, &poseChanges[i]))
+            return FALSE;
+    records += POSE_VIEW_SIZE;
+
+    /*
+     * The columns fan out from the view direction by fixed angles, so
+     * finding each column's baked ray takes no trigonometry per frame.
+     * The plane may point either way round from the direction.
+     */
+    updatePoseColumnAngles(dist, width);
+    angle = (float)atan2(camera->dir.y, camera->dir.x);
+    turn = camera->dir.x * camera->plane.y - camera->dir.y * camera->plane.x < 0 ? -1.0f : 1.0f;
+
+    for(column = 0; column < width; column++) {
+        index = (int)floor((angle + turn * poseColumnAngles[column]) * POSE_RAYS / (2.0f * PI) + 0.5f);
+        index = ((index % POSE_RAYS) + POSE_RAYS) % POSE_RAYS;
+
+        /* The baked ray says which grid line the wall is on */
+        record = getU16(records + index * 2);
+        vertical = (record & POSE_RECORD_VERTICAL) != 0;
+        hit = vec2Add(pos, vec2Scale(poseRayDirs[index], (record >> 2) / (float)POSE_DISTANCE_SCALE));
+        line = (int)floor((vertical ? hit.x : hit.y) / WALL_SIZE + 0.5f);
+
+        /* Where this column's ray meets that line, worked out just as finishColumn does */
+        dir = cameraRayDirection(camera, column, width);
+        lineDist = line * WALL_SIZE - (vertical ? camera->pos.x : camera->pos.y);
+        t = lineDist / MAKE_FLOAT_NONZERO(vertical ? dir.x : dir.y);
+
+        /*
+         * Near the edge of a wall the baked ray and this one can hit
+         * different walls, and a baked ray which passed close to another
+         * wall may have this one's blocked. Then the two hits are far
+         * apart, there is no wall behind this one's or the baked ray
+         * wasn't clear, and the column is traced for real.
+         */
+        columnHit = vec2Add(camera->pos, vec2Scale(dir, t));
+        if(!(record & POSE_RECORD_CLEAR) || t <= 0.0f
+            || vec2LengthSquared(vec2Sub(columnHit, hit)) > POSE_HIT_TOLERANCE * POSE_HIT_TOLERANCE
+            || !isBakedHitWall(line, vertical ? columnHit.y : columnHit.x, vertical, (vertical ? dir.x : dir.y) < 0)) {
+            traceColumn(camera, rays, width, column);
+            continue;
+        }
+
+        /* Push the other ray past the hit so the renderer picks this one */
+        if(vertical) {
+            rays[column].vRay = vec2Scale(dir, t);
+            rays[column].hRay = vec2Scale(rays[column].vRay, 2.0f);
+        } else {
+            rays[column].hRay = vec2Scale(dir, t);
+            rays[column].vRay = vec2Scale(rays[column].hRay, 2.0f);
+        }
+    }
+
+    return TRUE;
+}
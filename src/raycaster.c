@@ -1,113 +1,200 @@
 #include <stdio.h>
+#ifdef SPAN_CAST_CHECK
+#include <assert.h>
+#endif
 
 #include "header/main.h"
 
 /* Globals */
-Vector3f viewplaneDir = {VIEWPLANE_DIR_X, VIEWPLANE_DIR_Y, 1};
+Vector2f viewplaneDir = {VIEWPLANE_DIR_X, VIEWPLANE_DIR_Y};
 float distFromViewplane;
-Matrix3f counterClockwiseRotation = IDENTITY_M;
-Matrix3f clockwiseRotation = IDENTITY_M;
+Rotation2f counterClockwiseRotation = {1, 0};
+Rotation2f clockwiseRotation = {1, 0};
 RayTuple rays[VIEWPLANE_LENGTH];
+CameraRays cameraRayTables[CAMERA_RAY_TABLES];
+int nextCameraRayTable = 0;
 
 
-void initializeRayDirections() {
+void initializeRayDirections(const Camera* camera) {
+    const CameraRays* table = getCameraRays(camera->distFromViewplane, VIEWPLANE_LENGTH);
     int i;
-    Vector3f v1,v2,v3;
+    Vector2f dir;
 
     for(i = 0; i < VIEWPLANE_LENGTH; i++) {
-        v1 = homogeneousVectorScale(&playerDir, distFromViewplane);
-        v2 = homogeneousVectorScale(&viewplaneDir, ((VIEWPLANE_LENGTH / 2) - i));
-        v3 = vectorSubtract(&v1, &v2);
-        rays[i].hRay = normalizeVector(&v3);
-        rays[i].vRay = normalizeVector(&v3);
+        dir = vec2Sub(vec2Scale(camera->dir, table->forward[i]), vec2Scale(camera->plane, table->side[i]));
+        rays[i].hRay = dir;
+        rays[i].vRay = dir;
 
         if (rayCastMode == ONLY_NORMALIZED) {
-            rays[i].hRay = homogeneousVectorScale(&rays[i].hRay, 40);
-            rays[i].vRay = homogeneousVectorScale(&rays[i].vRay, 40);
+            rays[i].hRay = vec2Scale(rays[i].hRay, 40);
+            rays[i].vRay = vec2Scale(rays[i].vRay, 40);
         }
     }
 }
 
-void extendRaysToFirstHit(RayTuple* rays) {
-    int i;
+void extendRayToFirstHit(Vector2f origin, RayTuple* ray) {
+    Vector2fPair pair = vec2Pair(ray->vRay, ray->hRay);
+    Vector2fPair perpVecs;
+    float perpX, perpY, vDot, hDot;
 
-    for(i = 0; i < VIEWPLANE_LENGTH; i++) {
-        Vector3f perpVec = HOMOGENEOUS_V3;
+    /* Perpendicular distance to the first vertical grid line */
+    if(ray->vRay.x < 0) { /* Ray is facing left */
+        perpX = ((int)(origin.x / (float)WALL_SIZE)) * WALL_SIZE - origin.x;
+    } else { /* Ray is facing right */
+        perpX = ((int)(origin.x / (float)WALL_SIZE)) * WALL_SIZE - origin.x + WALL_SIZE;
+    }
 
-        /* Extend vertical ray */
-        if(rays[i].vRay.x < 0) { /* Ray is facing left */
-            perpVec.x = ((int)(playerPos.x / (float)WALL_SIZE)) * WALL_SIZE - playerPos.x;
-        } else { /* Ray is facing right */
-            perpVec.x = ((int)(playerPos.x / (float)WALL_SIZE)) * WALL_SIZE - playerPos.x + WALL_SIZE;
-        }
-        rays[i].vRay = homogeneousVectorScale(&rays[i].vRay, vectorDotProduct(&perpVec, &perpVec) / MAKE_FLOAT_NONZERO(vectorDotProduct(&perpVec, &rays[i].vRay)));
-
-        /* Extend horizontal ray */
-        perpVec.x = 0.0f;
-        if(rays[i].hRay.y < 0) { /* Ray is facing up */
-            perpVec.y = ((int)(playerPos.y / (float)WALL_SIZE)) * WALL_SIZE - playerPos.y;
-        } else { /* Ray is facing down */
-            perpVec.y = ((int)(playerPos.y / (float)WALL_SIZE)) * WALL_SIZE - playerPos.y + WALL_SIZE;
-        }
-        rays[i].hRay = homogeneousVectorScale(&rays[i].hRay, vectorDotProduct(&perpVec, &perpVec) / MAKE_FLOAT_NONZERO(vectorDotProduct(&perpVec, &rays[i].hRay)));
+    /* Perpendicular distance to the first horizontal grid line */
+    if(ray->hRay.y < 0) { /* Ray is facing up */
+        perpY = ((int)(origin.y / (float)WALL_SIZE)) * WALL_SIZE - origin.y;
+    } else { /* Ray is facing down */
+        perpY = ((int)(origin.y / (float)WALL_SIZE)) * WALL_SIZE - origin.y + WALL_SIZE;
     }
 
+    /* Extend both rays at once */
+    perpVecs = vec2Pair(vec2(perpX, 0.0f), vec2(0.0f, perpY));
+    vec2PairDot(perpVecs, pair, &vDot, &hDot);
+    pair = vec2PairScale(pair, perpX * perpX / MAKE_FLOAT_NONZERO(vDot), perpY * perpY / MAKE_FLOAT_NONZERO(hDot));
+    vec2PairStore(pair, &ray->vRay, &ray->hRay);
 }
 
-Vector3f findVerticalRayStepVector(Vector3f* ray) {
-    Vector3f stepVector = HOMOGENEOUS_V3;
-    if(ray->x < 0) { /* Ray is facing left */
+void extendRaysToFirstHit(RayTuple* rays) {
+    int i;
+
+    for(i = 0; i < VIEWPLANE_LENGTH; i++)
+        extendRayToFirstHit(playerPos, &rays[i]);
+}
+
+Vector2f findVerticalRayStepVector(Vector2f ray) {
+    Vector2f stepVector = {0, 0};
+    if(ray.x < 0) { /* Ray is facing left */
         stepVector.x = -1 * WALL_SIZE;
 
     } else { /* Ray is facing right */
         stepVector.x = WALL_SIZE;
     }
 
-    return homogeneousVectorScale(ray, vectorDotProduct(&stepVector, &stepVector) / MAKE_FLOAT_NONZERO(vectorDotProduct(&stepVector, ray)));
+    return vec2Scale(ray, vec2Dot(stepVector, stepVector) / MAKE_FLOAT_NONZERO(vec2Dot(stepVector, ray)));
 }
 
-Vector3f findHorizontalRayStepVector(Vector3f* ray) {
-    Vector3f stepVector = HOMOGENEOUS_V3;
-    if(ray->y < 0) { /* Ray is facing up */
+Vector2f findHorizontalRayStepVector(Vector2f ray) {
+    Vector2f stepVector = {0, 0};
+    if(ray.y < 0) { /* Ray is facing up */
         stepVector.y = -1 * WALL_SIZE;
 
     } else { /* Ray is facing down */
         stepVector.y = WALL_SIZE;
     }
 
-    return homogeneousVectorScale(ray, vectorDotProduct(&stepVector, &stepVector) / MAKE_FLOAT_NONZERO(vectorDotProduct(&stepVector, ray)));
+    return vec2Scale(ray, vec2Dot(stepVector, stepVector) / MAKE_FLOAT_NONZERO(vec2Dot(stepVector, ray)));
+}
+
+int isSolidTile(int mapx, int mapy) {
+    /* Everything on or past the map border stops a ray */
+    if(!(mapx > 0 && mapy > 0 && mapx < MAP_GRID_WIDTH && mapy < MAP_GRID_HEIGHT))
+        return TRUE;
+    if(TILE_MATERIAL(MAP[mapy][mapx]) == D)
+        return doorOpenAmount[mapy][mapx] < WALL_SIZE;
+    return MAP[mapy][mapx] > 0;
+}
+
+int isOpaqueTile(int mapx, int mapy) {
+    if(!isSolidTile(mapx, mapy))
+        return FALSE;
+    return !(mapx > 0 && mapy > 0 && mapx < MAP_GRID_WIDTH && mapy < MAP_GRID_HEIGHT) || !(MAP[mapy][mapx] & SEE_THROUGH);
+}
+
+int getEmptySteps(Vector2f mapCoord, float slope) {
+    int reach = getEmptyDistance(mapCoord.x, mapCoord.y) - 1;
+    int steps;
+
+    /*
+     * Every cell within reach of this one is empty. A ray moves one cell
+     * along its stepping axis and slope cells across it per step, so it
+     * stays within reach for this many steps; the margin keeps rounding
+     * from carrying it into the next cell across.
+     */
+    if(reach <= 0)
+        return 1;
+    if(slope * SKIP_SLOPE_MARGIN <= 1.0f)
+        return reach + 1;
+    steps = (int)(reach / (slope * SKIP_SLOPE_MARGIN));
+    return steps + 1;
+}
+
+void castRay(Vector2f origin, RayTuple* ray) {
+    Vector2fPair norms = vec2PairNormalize(vec2Pair(ray->vRay, ray->hRay));
+    Vector2f vstep = findVerticalRayStepVector(vec2PairFirst(norms));
+    Vector2f hstep = findHorizontalRayStepVector(vec2PairSecond(norms));
+    float vslope = fabs(vstep.y / WALL_SIZE);
+    float hslope = fabs(hstep.x / WALL_SIZE);
+    Vector2f mapCoord;
+    TELEMETRY_STEPS(steps);
+
+    /* Cast the vertical ray until it hits something, skipping runs of empty cells */
+    mapCoord = getTileCoordinateForVerticalRay(origin, ray->vRay);
+    TELEMETRY_VISIT(steps, mapCoord.x, mapCoord.y);
+    while(!isOpaqueTile(mapCoord.x, mapCoord.y) || isInDoorGap(mapCoord.x, mapCoord.y, origin.y + ray->vRay.y)) {
+        ray->vRay = vec2Add(ray->vRay, vec2Scale(vstep, getEmptySteps(mapCoord, vslope)));
+        mapCoord = getTileCoordinateForVerticalRay(origin, ray->vRay);
+        TELEMETRY_VISIT(steps, mapCoord.x, mapCoord.y);
+    }
+
+    /* Cast the horizontal ray until it hits something */
+    mapCoord = getTileCoordinateForHorizontalRay(origin, ray->hRay);
+    TELEMETRY_VISIT(steps, mapCoord.x, mapCoord.y);
+    while(!isOpaqueTile(mapCoord.x, mapCoord.y) || isInDoorGap(mapCoord.x, mapCoord.y, origin.x + ray->hRay.x)) {
+        ray->hRay = vec2Add(ray->hRay, vec2Scale(hstep, getEmptySteps(mapCoord, hslope)));
+        mapCoord = getTileCoordinateForHorizontalRay(origin, ray->hRay);
+        TELEMETRY_VISIT(steps, mapCoord.x, mapCoord.y);
+    }
+
+    TELEMETRY_RAY(steps, ray);
 }
 
 void raycast(RayTuple* rays) {
     int i;
 
-    for(i = 0; i < VIEWPLANE_LENGTH; i++) {
-        Vector3f vnorm = normalizeVector(&rays[i].vRay);
-        Vector3f hnorm = normalizeVector(&rays[i].hRay);
-        Vector3f vstep = findVerticalRayStepVector(&vnorm);
-        Vector3f hstep = findHorizontalRayStepVector(&hnorm);
-        Vector3f mapCoord;
-
-        /* Cast the vertical ray until it hits something */
-        mapCoord = getTileCoordinateForVerticalRay(&rays[i].vRay);
-        while(mapCoord.x > 0 && mapCoord.y > 0 && mapCoord.x < MAP_GRID_WIDTH && mapCoord.y < MAP_GRID_HEIGHT && MAP[(int)mapCoord.y][(int)mapCoord.x] < 1) {
-            rays[i].vRay = vectorAdd(&rays[i].vRay, &vstep);
-            mapCoord = getTileCoordinateForVerticalRay(&rays[i].vRay);
-        }
+    for(i = 0; i < VIEWPLANE_LENGTH; i++)
+        castRay(playerPos, &rays[i]);
+}
 
-        /* Cast the horizontal ray until it hits something */
-        mapCoord = getTileCoordinateForHorizontalRay(&rays[i].hRay);
-        while(mapCoord.x > 0 && mapCoord.y > 0 && mapCoord.x < MAP_GRID_WIDTH && mapCoord.y < MAP_GRID_HEIGHT && MAP[(int)mapCoord.y][(int)mapCoord.x] < 1) {
-            rays[i].hRay = vectorAdd(&rays[i].hRay, &hstep);
-            mapCoord = getTileCoordinateForHorizontalRay(&rays[i].hRay);
-        }
+void traceRay(Vector2f origin, RayTuple* ray) {
+    if(fixedPointMode) {
+        traceRayFixed(origin, ray);
+        return;
     }
+    extendRayToFirstHit(origin, ray);
+    castRay(origin, ray);
 }
 
 void updateRaycaster() {
+    Camera camera;
+    int i;
+
+    /* Every mode below shares the player's camera and its ray table */
+    getPlayerCamera(&camera);
+    getCameraRays(camera.distFromViewplane, VIEWPLANE_LENGTH);
+
+    /* Baked rays, where there are any for the camera */
+    if (!rayCastMode) {
+        if (castBakedRays(&camera, rays, VIEWPLANE_LENGTH))
+            return;
+    }
+
+    /* The span caster only produces fully cast rays */
+    if (spanCastMode && !rayCastMode) {
+        castSpans(&camera, rays, VIEWPLANE_LENGTH);
+        return;
+    }
+
+    if (fixedPointMode && !rayCastMode) {
+        castFixedRays(&camera, rays, VIEWPLANE_LENGTH);
+        return;
+    }
 
     /* Update the rays */
-    initializeRayDirections();
+    initializeRayDirections(&camera);
 
     if (rayCastMode == ONLY_NORMALIZED)
         return;
@@ -120,39 +207,551 @@ void updateRaycaster() {
     /* Perform raycasting */
     raycast(rays);
 
+    /* Finished the way the span caster fills columns, so the two agree exactly */
+    for (i = 0; i < VIEWPLANE_LENGTH; i++)
+        finishColumn(&camera, rays, VIEWPLANE_LENGTH, i);
+
 }
 
-Vector3f getTileCoordinateForVerticalRay(Vector3f* ray) {
-    Vector3f pos = vectorAdd(&playerPos, ray);
-    Vector3f coord;
-    coord.x = (int)(pos.x + ((ray->x < 0) ? (-1 * RAY_EPS) : (RAY_EPS))) / WALL_SIZE;
-    coord.y = (int)(pos.y + ((ray->y < 0) ? (-1 * EPS) : (EPS))) / WALL_SIZE;
+Vector2f getTileCoordinateForVerticalRay(Vector2f origin, Vector2f ray) {
+    Vector2f pos = vec2Add(origin, ray);
+    Vector2f coord;
+    coord.x = (int)(pos.x + ((ray.x < 0) ? (-1 * RAY_EPS) : (RAY_EPS))) / WALL_SIZE;
+    coord.y = (int)(pos.y + ((ray.y < 0) ? (-1 * EPS) : (EPS))) / WALL_SIZE;
 
     return coord;
 }
 
-Vector3f getTileCoordinateForHorizontalRay(Vector3f* ray) {
-    Vector3f pos = vectorAdd(&playerPos, ray);
-    Vector3f coord;
-    coord.x = (int)(pos.x + ((ray->x < 0) ? (-1 * EPS) : EPS)) / WALL_SIZE;
-    coord.y = (int)(pos.y + ((ray->y < 0) ? (-1 * RAY_EPS) : (RAY_EPS))) / WALL_SIZE;
+Vector2f getTileCoordinateForHorizontalRay(Vector2f origin, Vector2f ray) {
+    Vector2f pos = vec2Add(origin, ray);
+    Vector2f coord;
+    coord.x = (int)(pos.x + ((ray.x < 0) ? (-1 * EPS) : EPS)) / WALL_SIZE;
+    coord.y = (int)(pos.y + ((ray.y < 0) ? (-1 * RAY_EPS) : (RAY_EPS))) / WALL_SIZE;
 
     return coord;
 }
 
+void getPlayerCamera(Camera* camera) {
+    /* Turning drifts the player's vectors off unit length a little at a time */
+    camera->pos = playerPos;
+    camera->dir = vec2Normalize(playerDir);
+    camera->plane = vec2Normalize(viewplaneDir);
+    camera->distFromViewplane = distFromViewplane;
+}
+
+void getCameraSpaceRay(float dist, int offset, float* forward, float* side) {
+    float length = (float)sqrt(dist * dist + (float)offset * offset);
+
+    *forward = dist / length;
+    *side = offset / length;
+}
+
+const CameraRays* findCameraRays(float distFromViewplane, int width) {
+    int i;
+
+    for(i = 0; i < CAMERA_RAY_TABLES; i++)
+        if(cameraRayTables[i].width == width && cameraRayTables[i].distFromViewplane == distFromViewplane)
+            return &cameraRayTables[i];
+    return NULL;
+}
+
+const CameraRays* getCameraRays(float distFromViewplane, int width) {
+    const CameraRays* found = findCameraRays(distFromViewplane, width);
+    CameraRays* table;
+    float dist = distFromViewplane * width / (float)VIEWPLANE_LENGTH;
+    int column;
+
+    if(found)
+        return found;
+
+    /* Replace the tables in turn; a frame rarely needs more than one or two */
+    table = &cameraRayTables[nextCameraRayTable];
+    nextCameraRayTable = (nextCameraRayTable + 1) % CAMERA_RAY_TABLES;
+    for(column = 0; column < width; column++)
+        getCameraSpaceRay(dist, (width / 2) - column, &table->forward[column], &table->side[column]);
+    table->distFromViewplane = distFromViewplane;
+    table->width = width;
+
+    return table;
+}
+
+Vector2f cameraRayDirection(const Camera* camera, int column, int width) {
+    const CameraRays* table = findCameraRays(camera->distFromViewplane, width);
+    float forward, side;
+
+    if(table) {
+        forward = table->forward[column];
+        side = table->side[column];
+    } else {
+        getCameraSpaceRay(camera->distFromViewplane * width / (float)VIEWPLANE_LENGTH, (width / 2) - column, &forward, &side);
+    }
+
+    return vec2Sub(vec2Scale(camera->dir, forward), vec2Scale(camera->plane, side));
+}
+
+
+/*========================================================
+ * Span caster
+ *========================================================
+ *
+ * Neighbouring columns nearly always hit the same wall face. Instead
+ * of tracing every column, trace the two ends of a span of columns; if
+ * both land on the same face and nothing can stand between the player
+ * and the face inside the span, every column in between hits that face
+ * too and is filled in directly. Otherwise the span is split in half.
+ */
+
+/* A wall face: the grid line it lies on and the direction rays reach it from */
+typedef struct {
+    char vertical;  /* Lies on a vertical grid line (hit by a vRay) */
+    int line;       /* Index of the grid line */
+    char positive;  /* Rays travel towards increasing x (or y) to reach it */
+} WallFace;
+
+Vector2f getRayHit(Vector2f origin, const RayTuple* ray, WallFace* face) {
+    Vector2f hit;
+
+    /* Pick the ray the same way the renderer does */
+    face->vertical = !(vec2LengthSquared(ray->hRay) < vec2LengthSquared(ray->vRay));
+    hit = face->vertical ? ray->vRay : ray->hRay;
+    face->positive = face->vertical ? hit.x > 0 : hit.y > 0;
+    face->line = (int)floor((face->vertical ? origin.x + hit.x : origin.y + hit.y) / WALL_SIZE + 0.5f);
+
+    return hit;
+}
+
+int isOpaqueTileAcross(const WallFace* face, int across, int along) {
+    return face->vertical ? isOpaqueTile(across, along) : isOpaqueTile(along, across);
+}
+
+int isPointInTriangle(Vector2f p, Vector2f a, Vector2f b) {
+    /* Triangle spanned by the origin and a, b; points on the edges count as inside */
+    float den = a.x * b.y - a.y * b.x;
+    float s = (p.x * b.y - p.y * b.x) / den;
+    float t = (a.x * p.y - a.y * p.x) / den;
+
+    return s >= -0.0001f && t >= -0.0001f && s + t <= 1.0001f;
+}
+
+/* Where along the face's axis an edge from the origin to a hit is at a given distance across */
+float getEdgeAlong(float acrossO, float alongO, float acrossHit, float alongHit, float across) {
+    return alongO + (alongHit - alongO) * (across - acrossO) / MAKE_FLOAT_NONZERO(acrossHit - acrossO);
+}
+
+int isFaceSpanClear(Vector2f origin, const WallFace* face, Vector2f hitA, Vector2f hitB) {
+    int farCell = face->positive ? face->line : face->line - 1;
+    int nearCell = (int)((face->vertical ? origin.x : origin.y) / WALL_SIZE);
+    int acrossMin = MIN(nearCell, face->positive ? face->line - 1 : face->line);
+    int acrossMax = MAX(nearCell, face->positive ? face->line - 1 : face->line);
+    float alongA = face->vertical ? origin.y + hitA.y : origin.x + hitA.x;
+    float alongB = face->vertical ? origin.y + hitB.y : origin.x + hitB.x;
+    float alongO = face->vertical ? origin.y : origin.x;
+    float acrossO = face->vertical ? origin.x : origin.y;
+    float acrossFace = face->line * WALL_SIZE;
+    float stripNear, stripFar, edgeMin, edgeMax;
+    int alongMin, alongMax, alongLimit, across, along, corner;
+    Vector2f p;
+
+    /* The face must be solid all the way between the two hits, with no door gaps */
+    alongMin = (int)(MIN(alongA, alongB) / WALL_SIZE);
+    alongMax = (int)(MAX(alongA, alongB) / WALL_SIZE);
+    for(along = alongMin; along <= alongMax; along++) {
+        if(!isOpaqueTileAcross(face, farCell, along)
+            || (face->vertical ? isDoorOpening(farCell, along) : isDoorOpening(along, farCell)))
+            return FALSE;
+    }
+
+    /*
+     * No solid tile may reach into the triangle between the player and
+     * the face. Each row of cells across is only checked where the
+     * triangle's two edges pass through it, so the cost follows the
+     * triangle rather than the open area around it.
+     */
+    alongLimit = (face->vertical ? MAP_GRID_HEIGHT : MAP_GRID_WIDTH) - 1;
+    acrossMax = MIN(acrossMax, (face->vertical ? MAP_GRID_WIDTH : MAP_GRID_HEIGHT) - 1);
+    for(across = MAX(acrossMin, 0); across <= acrossMax; across++) {
+        /* The part of the row between the player and the face */
+        stripNear = MAX(across * WALL_SIZE, MIN(acrossO, acrossFace));
+        stripFar = MIN((across + 1) * WALL_SIZE, MAX(acrossO, acrossFace));
+        edgeMin = MIN(MIN(getEdgeAlong(acrossO, alongO, acrossFace, alongA, stripNear), getEdgeAlong(acrossO, alongO, acrossFace, alongA, stripFar)),
+                      MIN(getEdgeAlong(acrossO, alongO, acrossFace, alongB, stripNear), getEdgeAlong(acrossO, alongO, acrossFace, alongB, stripFar)));
+        edgeMax = MAX(MAX(getEdgeAlong(acrossO, alongO, acrossFace, alongA, stripNear), getEdgeAlong(acrossO, alongO, acrossFace, alongA, stripFar)),
+                      MAX(getEdgeAlong(acrossO, alongO, acrossFace, alongB, stripNear), getEdgeAlong(acrossO, alongO, acrossFace, alongB, stripFar)));
+
+        /* Cells merely touching an edge at a corner count, as in isPointInTriangle */
+        alongMin = MAX((int)floor((edgeMin - SPAN_CORNER_SLACK) / WALL_SIZE), 0);
+        alongMax = MIN((int)floor((edgeMax + SPAN_CORNER_SLACK) / WALL_SIZE), alongLimit);
+
+        for(along = alongMin; along <= alongMax; along++) {
+            if(!isOpaqueTileAcross(face, across, along))
+                continue;
+
+            for(corner = 0; corner < 4; corner++) {
+                if(face->vertical)
+                    p = vec2((across + (corner & 1)) * WALL_SIZE, (along + (corner >> 1)) * WALL_SIZE);
+                else
+                    p = vec2((along + (corner >> 1)) * WALL_SIZE, (across + (corner & 1)) * WALL_SIZE);
+
+                if(isPointInTriangle(vec2Sub(p, origin), hitA, hitB))
+                    return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+void setFaceHit(RayTuple* ray, Vector2f origin, Vector2f dir, const WallFace* face) {
+    float lineDist = face->line * WALL_SIZE - (face->vertical ? origin.x : origin.y);
+    Vector2f hit = vec2Scale(dir, lineDist / MAKE_FLOAT_NONZERO(face->vertical ? dir.x : dir.y));
+
+    /* Push the other ray past the hit so the renderer picks this one */
+    if(face->vertical) {
+        ray->vRay = hit;
+        ray->hRay = vec2Scale(hit, 2.0f);
+    } else {
+        ray->hRay = hit;
+        ray->vRay = vec2Scale(hit, 2.0f);
+    }
+}
+
+void finishColumn(const Camera* camera, RayTuple* rays, int width, int column) {
+    WallFace face;
+
+    getRayHit(camera->pos, &rays[column], &face);
+    setFaceHit(&rays[column], camera->pos, cameraRayDirection(camera, column, width), &face);
+}
+
+void fillFaceSpan(const Camera* camera, RayTuple* rays, int width, const WallFace* face, int first, int last) {
+    float along, corner;
+    int i;
+
+    /* Exactly what tracing each column and finishing it would give */
+    for(i = first; i <= last; i++) {
+        setFaceHit(&rays[i], camera->pos, cameraRayDirection(camera, i, width), face);
+
+        /* Through a corner either face can win the trace by rounding, so leave it to the trace */
+        along = face->vertical ? camera->pos.y + rays[i].vRay.y : camera->pos.x + rays[i].hRay.x;
+        corner = (float)floor(along / WALL_SIZE + 0.5f) * WALL_SIZE;
+        if(fabs(along - corner) < SPAN_CORNER_SLACK)
+            traceColumn(camera, rays, width, i);
+    }
+}
+
+void traceColumn(const Camera* camera, RayTuple* rays, int width, int column) {
+    rays[column].vRay = rays[column].hRay = cameraRayDirection(camera, column, width);
+    traceRay(camera->pos, &rays[column]);
+    finishColumn(camera, rays, width, column);
+}
+
+void castSpan(const Camera* camera, RayTuple* rays, int width, int first, int last) {
+    WallFace faceA, faceB;
+    Vector2f hitA, hitB;
+    int mid;
+
+    if(last - first < 2)
+        return;
+
+    hitA = getRayHit(camera->pos, &rays[first], &faceA);
+    hitB = getRayHit(camera->pos, &rays[last], &faceB);
+    if(faceA.vertical == faceB.vertical && faceA.line == faceB.line && faceA.positive == faceB.positive
+        && isFaceSpanClear(camera->pos, &faceA, hitA, hitB)) {
+        fillFaceSpan(camera, rays, width, &faceA, first + 1, last - 1);
+        return;
+    }
+
+    mid = (first + last) / 2;
+    traceColumn(camera, rays, width, mid);
+    castSpan(camera, rays, width, first, mid);
+    castSpan(camera, rays, width, mid, last);
+}
+
+void castSpans(const Camera* camera, RayTuple* rays, int width) {
+#ifdef SPAN_CAST_CHECK
+    static RayTuple traced[VIEWPLANE_LENGTH];
+    int i;
+#endif
+
+    traceColumn(camera, rays, width, 0);
+    if(width > 1)
+        traceColumn(camera, rays, width, width - 1);
+    castSpan(camera, rays, width, 0, width - 1);
+
+#ifdef SPAN_CAST_CHECK
+    /* Every filled column must be exactly the column the per-column caster gives */
+    for(i = 0; i < width; i++) {
+        traceColumn(camera, traced, width, i);
+        assert(traced[i].vRay.x == rays[i].vRay.x && traced[i].vRay.y == rays[i].vRay.y);
+        assert(traced[i].hRay.x == rays[i].hRay.x && traced[i].hRay.y == rays[i].hRay.y);
+    }
+#endif
+}
+
+
+/*========================================================
+ * Fixed-point caster
+ *========================================================
+ *
+ * The same casts done entirely in Q16.16 integers, so that a camera
+ * gives the same rays on every machine and compiler. Hit positions are
+ * computed from the number of grid lines crossed rather than by adding
+ * up steps, and divides go through a reciprocal table.
+ */
+
+/* Globals */
+Uint32 reciprocalTable[RECIPROCAL_TABLE_SIZE];
+
+void initReciprocalTable() {
+    int i;
+
+    /* 1 / (1 + i / size) in Q1.31, rounded, for the top bits of a normalized divisor */
+    for(i = 0; i < RECIPROCAL_TABLE_SIZE; i++)
+        reciprocalTable[i] = (Uint32)((((Uint64)RECIPROCAL_TABLE_SIZE << 32) + (RECIPROCAL_TABLE_SIZE + i)) / (2 * (RECIPROCAL_TABLE_SIZE + i)));
+}
+
+Uint64 fixedReciprocal(Uint32 x) {
+    Uint32 m = x;
+    Sint64 err;
+    Uint64 r;
+    int i, msb = 31;
+
+    /* Normalize x to m in [1, 2) as Q1.31 */
+    while(!(m & 0x80000000u)) {
+        m <<= 1;
+        msb--;
+    }
+
+    /* Table estimate, then two Newton-Raphson steps: r += r * (1 - m * r) */
+    r = reciprocalTable[(m >> (31 - RECIPROCAL_TABLE_BITS)) & (RECIPROCAL_TABLE_SIZE - 1)];
+    for(i = 0; i < 2; i++) {
+        err = ((Sint64)1 << 62) - (Sint64)((Uint64)m * r);
+        r += (Sint64)r * (err >> 31) >> 31;
+    }
+
+    /* 2^48 / x: r / 2^31 is 1 / m, and x is m scaled by 2^(msb - 31) */
+    return msb <= 17 ? r << (17 - msb) : r >> (msb - 17);
+}
+
+Sint32 floatToFixed(float f) {
+    return (Sint32)floor(f * FIXED_ONE + 0.5f);
+}
+
+int getFixedEmptySteps(int mapx, int mapy, Sint64 slope) {
+    int reach = getEmptyDistance(mapx, mapy) - 1;
+    Sint64 limit, steps;
+
+    /* As getEmptySteps, but exact: j steps move j * slope cells across, which must stay under reach */
+    if(reach <= 0)
+        return 1;
+    limit = (Sint64)reach * FIXED_ONE - 1;
+    if(slope * reach <= limit)
+        return reach + 1;
+
+    steps = (Sint64)((Uint64)limit * fixedReciprocal((Uint32)slope) >> 48);
+    while(steps > 0 && steps * slope > limit)
+        steps--;
+    return (int)steps + 1;
+}
+
+int castFixedAxis(const Sint32 origin[2], const Sint32 dir[2], int axis, Sint64 hit[2], int* steps) {
+    int across = !axis;
+    int sign = dir[axis] < 0 ? -1 : 1;
+    Sint64 along = dir[axis] < 0 ? -(Sint64)dir[axis] : dir[axis];
+    Sint64 side = dir[across] < 0 ? -(Sint64)dir[across] : dir[across];
+    Sint64 slope, line, stepped, pos;
+    int cell[2], firstLine, lines = 0;
+    (void)steps;  /* Only counted with RAY_TELEMETRY */
+
+    /* Rays (nearly) parallel to the grid lines of this axis never cross them */
+    if(along == 0 || side > along * FIXED_MAX_SLOPE)
+        return FALSE;
+    slope = (Sint64)((Uint64)side * fixedReciprocal((Uint32)along) >> 32);
+
+    /* The first grid line ahead of the origin */
+    firstLine = (origin[axis] >> FIXED_SHIFT) / WALL_SIZE + (sign > 0);
+
+    for(;;) {
+        line = (Sint64)(firstLine + sign * lines) * WALL_SIZE << FIXED_SHIFT;
+        stepped = (line - origin[axis]) * sign;
+        pos = origin[across] + (dir[across] < 0 ? -(stepped * slope >> FIXED_SHIFT) : stepped * slope >> FIXED_SHIFT);
+
+        /* The cell beyond the line, and the cell the crossing point lies in */
+        cell[axis] = firstLine + sign * lines - (sign < 0);
+        cell[across] = (int)((pos >> FIXED_SHIFT) / WALL_SIZE);
+        if(pos < 0)
+            cell[across] = -1;
+
+        TELEMETRY_VISIT(*steps, cell[0], cell[1]);
+        if(isOpaqueTile(cell[0], cell[1]) && !isInDoorGap(cell[0], cell[1], (float)(pos >> FIXED_SHIFT)))
+            break;
+        lines += getFixedEmptySteps(cell[0], cell[1], slope);
+    }
+
+    hit[axis] = line - origin[axis];
+    hit[across] = pos - origin[across];
+    return TRUE;
+}
+
+void castFixedRay(const Sint32 origin[2], const Sint32 dir[2], RayTuple* ray) {
+    Sint64 hit[2];
+    int vertical, horizontal, steps = 0;
+
+    vertical = castFixedAxis(origin, dir, 0, hit, &steps);
+    ray->vRay = vec2(hit[0] / (float)FIXED_ONE, hit[1] / (float)FIXED_ONE);
+    horizontal = castFixedAxis(origin, dir, 1, hit, &steps);
+    ray->hRay = vec2(hit[0] / (float)FIXED_ONE, hit[1] / (float)FIXED_ONE);
+
+    /* A ray which never crosses one kind of line reaches the other first */
+    if(!vertical)
+        ray->vRay = vec2Scale(ray->hRay, 2.0f);
+    if(!horizontal)
+        ray->hRay = vec2Scale(ray->vRay, 2.0f);
+
+    TELEMETRY_RAY(steps, ray);
+}
+
+void traceRayFixed(Vector2f origin, RayTuple* ray) {
+    Sint32 o[2], d[2];
+
+    o[0] = floatToFixed(origin.x);
+    o[1] = floatToFixed(origin.y);
+    d[0] = floatToFixed(ray->vRay.x);
+    d[1] = floatToFixed(ray->vRay.y);
+    castFixedRay(o, d, ray);
+}
+
+void castFixedRays(const Camera* camera, RayTuple* rays, int width) {
+    Sint32 origin[2], forward[2], plane[2], dir[2];
+    Sint32 dist = floatToFixed(camera->distFromViewplane * width / (float)VIEWPLANE_LENGTH);
+    int i;
+
+    origin[0] = floatToFixed(camera->pos.x);
+    origin[1] = floatToFixed(camera->pos.y);
+    plane[0] = floatToFixed(camera->plane.x);
+    plane[1] = floatToFixed(camera->plane.y);
+    forward[0] = (Sint32)((Sint64)floatToFixed(camera->dir.x) * dist >> FIXED_SHIFT);
+    forward[1] = (Sint32)((Sint64)floatToFixed(camera->dir.y) * dist >> FIXED_SHIFT);
+
+    /* Directions don't need normalizing: only their slopes are used */
+    for(i = 0; i < width; i++) {
+        dir[0] = forward[0] - plane[0] * ((width / 2) - i);
+        dir[1] = forward[1] - plane[1] * ((width / 2) - i);
+        castFixedRay(origin, dir, &rays[i]);
+    }
+}
+
+/*========================================================
+ * Batch queries
+ *========================================================
+ *
+ * Rays for game logic rather than for the screen: any origin and
+ * direction, answered through the same traversal as the camera rays.
+ * Nothing here touches the global rays, so batches can run on the
+ * worker threads (or be issued from several threads at once).
+ */
+
+typedef struct {
+    const Vector2f* origins;
+    const Vector2f* dirs;       /* Or targets, for line of sight checks */
+    float maxDistance;
+    RayHit* hits;
+    char* visible;
+} RayBatch;
+
+float getHitFaceCoordinate(Vector2f origin, Vector2f hit, char vertical) {
+    Vector2f pos = vec2Add(origin, hit);
+    float u = fmod(vertical ? pos.y : pos.x, WALL_SIZE) / WALL_SIZE;
+
+    /* Flipped the same way as getTextureColumnNumberForRay */
+    if(vertical ? hit.x < 0 : hit.y > 0)
+        u = 1.0f - u;
+    return MIN(MAX(u, 0.0f), 0.99999f);
+}
+
+void queryRay(Vector2f origin, Vector2f dir, float maxDistance, RayHit* hit) {
+    RayTuple ray;
+    Vector2f coords, end;
+
+    hit->distance = maxDistance;
+    hit->mapx = hit->mapy = -1;
+    hit->vertical = FALSE;
+    hit->u = 0.0f;
+    if(vec2LengthSquared(dir) <= 0.0f)
+        return;
+
+    ray.vRay = ray.hRay = vec2Normalize(dir);
+    traceRay(origin, &ray);
+
+    /* Pick the ray the same way the renderer does */
+    hit->vertical = !(vec2LengthSquared(ray.hRay) < vec2LengthSquared(ray.vRay));
+    end = hit->vertical ? ray.vRay : ray.hRay;
+    if(maxDistance > 0.0f && vec2LengthSquared(end) > maxDistance * maxDistance) {
+        hit->vertical = FALSE;
+        return;
+    }
+
+    coords = hit->vertical ? getTileCoordinateForVerticalRay(origin, end) : getTileCoordinateForHorizontalRay(origin, end);
+    hit->distance = vec2Length(end);
+    hit->mapx = coords.x;
+    hit->mapy = coords.y;
+    hit->u = getHitFaceCoordinate(origin, end, hit->vertical);
+}
+
+void castRayBatchJob(int begin, int end, void* context) {
+    const RayBatch* batch = context;
+    int i;
+
+    for(i = begin; i < end; i++)
+        queryRay(batch->origins[i], batch->dirs[i], batch->maxDistance, &batch->hits[i]);
+}
+
+void checkLineOfSightJob(int begin, int end, void* context) {
+    const RayBatch* batch = context;
+    Vector2f toTarget;
+    float distance;
+    RayHit hit;
+    int i;
+
+    for(i = begin; i < end; i++) {
+        toTarget = vec2Sub(batch->dirs[i], batch->origins[i]);
+        distance = vec2Length(toTarget);
+
+        /* Anything closer than the target blocks it; a wall the target is on does not */
+        queryRay(batch->origins[i], toTarget, distance - LINE_OF_SIGHT_EPS, &hit);
+        batch->visible[i] = distance <= LINE_OF_SIGHT_EPS || hit.mapx < 0;
+    }
+}
+
+void castRayBatch(const Vector2f* origins, const Vector2f* dirs, int count, float maxDistance, int threads, RayHit* hits) {
+    RayBatch batch;
+
+    batch.origins = origins;
+    batch.dirs = dirs;
+    batch.maxDistance = maxDistance;
+    batch.hits = hits;
+    batch.visible = NULL;
+    parallelForWorkers(count, RAY_BATCH_GRAIN, threads, castRayBatchJob, &batch);
+}
+
+void checkLineOfSightBatch(const Vector2f* origins, const Vector2f* targets, int count, int threads, char* visible) {
+    RayBatch batch;
+
+    batch.origins = origins;
+    batch.dirs = targets;
+    batch.maxDistance = 0.0f;
+    batch.hits = NULL;
+    batch.visible = visible;
+    parallelForWorkers(count, RAY_BATCH_GRAIN, threads, checkLineOfSightJob, &batch);
+}
+
 void initRaycaster() {
 
     /* Infer viewplane distance from a given field of view angle */
     distFromViewplane = (WINDOW_WIDTH / 2.0f) / (float)(tan(FOV / 2.0f));
 
-    /* Setup player rotation matrices */
-    counterClockwiseRotation[0][0] = cos(PLAYER_ROT_SPEED);
-    counterClockwiseRotation[0][1] = -1.0f * sin(PLAYER_ROT_SPEED);
-    counterClockwiseRotation[1][0] = sin(PLAYER_ROT_SPEED);
-    counterClockwiseRotation[1][1] = cos(PLAYER_ROT_SPEED);
+    /* Setup player rotations */
+    counterClockwiseRotation = rotation2f(PLAYER_ROT_SPEED);
+    clockwiseRotation = rotation2f(-1.0f * PLAYER_ROT_SPEED);
 
-    clockwiseRotation[0][0] = cos(-1.0f * PLAYER_ROT_SPEED);
-    clockwiseRotation[0][1] = -1.0f * sin(-1.0f * PLAYER_ROT_SPEED);
-    clockwiseRotation[1][0] = sin(-1.0f * PLAYER_ROT_SPEED);
-    clockwiseRotation[1][1] = cos(-1.0f * PLAYER_ROT_SPEED);
+    initReciprocalTable();
 }
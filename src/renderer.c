@@ -1,143 +1,883 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "header/main.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RENDERER_X86_SIMD
+#endif
+
+/* Globals */
+ColumnHits columnHits;
+
 
 float calculateDrawHeight(float rayLength) {
     return distFromViewplane * WALL_SIZE / rayLength;
 }
 
-void drawUntexturedStrip(int x, float wallYStart, float length, Uint32 ABGRColor, char darken) {
+void drawUntexturedStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, Uint32 ABGRColor, char darken) {
     int y;
 
     if(wallYStart < 0)
         wallYStart = 0;
 
-    for(y = 0; y < WINDOW_HEIGHT; y++) {
+    for(y = 0; y < height; y++) {
         if(y < wallYStart) {
-            screenBuffer[XY_TO_SCREEN_INDEX(x, y)] = CEILING_COLOR;
+            dst[y * pitch] = CEILING_COLOR;
         } else if(y > (wallYStart + length)) {
-            screenBuffer[XY_TO_SCREEN_INDEX(x, y)] = FLOOR_COLOR;
+            dst[y * pitch] = FLOOR_COLOR;
         } else {
-            screenBuffer[XY_TO_SCREEN_INDEX(x, y)] = (darken) ? ABGRColor : DARKEN_COLOR(ABGRColor);
+            dst[y * pitch] = (darken) ? ABGRColor : DARKEN_COLOR(ABGRColor);
         }
     }
 }
 
-void drawTexturedStrip(int x, float wallYStart, float length, int textureX, Uint32* texture, char darken) {
+void drawUntexturedStrip(int x, float wallYStart, float length, Uint32 ABGRColor, char darken) {
+    drawUntexturedStripTo(screenBuffer + x, WINDOW_WIDTH, WINDOW_HEIGHT, wallYStart, length, ABGRColor, darken);
+}
+
+void drawTexturedStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, int textureX, Uint32* texture, char darken) {
     int y;
     float d, ty;
     Uint32 color;
+    int level = selectMipLevel(length);
+    int levelSize = TEXTURE_SIZE >> level;
+    Uint32* column = texture + MIP_COLUMN_OFFSET(level, textureX >> level);
 
     if(wallYStart < 0)
         wallYStart = 0;
 
-    for(y = 0; y < WINDOW_HEIGHT; y++) {
-        d = y - (WINDOW_HEIGHT / 2.0f) + length / 2.0f;
-        ty = d * (float)(TEXTURE_SIZE-EPS) / length;
+    for(y = 0; y < height; y++) {
+        d = y - (height / 2.0f) + length / 2.0f;
+        ty = d * (float)(levelSize-EPS) / length;
+        if(ty >= levelSize) ty = levelSize - 1; /* EPS vanishes in float precision */
 
         if(y < wallYStart) {
-            screenBuffer[XY_TO_SCREEN_INDEX(x, y)] = CEILING_COLOR;
+            dst[y * pitch] = CEILING_COLOR;
         } else if(y > (wallYStart + length)) {
-            screenBuffer[XY_TO_SCREEN_INDEX(x, y)] = FLOOR_COLOR;
+            dst[y * pitch] = FLOOR_COLOR;
         } else {
-            color = texture[XY_TO_TEXTURE_INDEX(textureX, (int)ty)];
+            color = column[(int)ty];
             if(darken) color = DARKEN_COLOR(color);
 
-            screenBuffer[XY_TO_SCREEN_INDEX(x, y)] = color;
+            dst[y * pitch] = color;
+        }
+    }
+
+}
+
+void drawTexturedStrip(int x, float wallYStart, float length, int textureX, Uint32* texture, char darken) {
+    drawTexturedStripTo(screenBuffer + x, WINDOW_WIDTH, WINDOW_HEIGHT, wallYStart, length, textureX, texture, darken);
+}
+
+/*
+ * Each lane repeats drawTexturedStripTo's float math in the same order,
+ * so every texel index, and so every pixel, comes out the same. Lanes
+ * off their wall are masked out of the gather and take the ceiling or
+ * floor color instead, which lets each row go out in a single store.
+ */
+#ifdef RENDERER_X86_SIMD
+__attribute__((target("avx2")))
+int drawTexturedStripsAVX2To(Uint32* dst, int pitch, int height, const float* wallYStart, const float* length, const int* textureX, Uint32* const* textures, const char* darken) {
+    int lane, level, levelSize, y;
+    int offsets[SIMD_SHADE_COLUMNS], darkenMask[SIMD_SHADE_COLUMNS];
+    float starts[SIMD_SHADE_COLUMNS], ends[SIMD_SHADE_COLUMNS], halfLengths[SIMD_SHADE_COLUMNS];
+    float scales[SIMD_SHADE_COLUMNS], sizes[SIMD_SHADE_COLUMNS], lasts[SIMD_SHADE_COLUMNS];
+    const Uint32* base = textures[0];
+    const Uint32* column;
+    ptrdiff_t offset;
+    __m256 rowY, half, start, end, halfLength, len, scale, size, last, ty, above, below;
+    __m256i index, color, dark, wall, texelOffsets, darkenLanes;
+
+    for(lane = 0; lane < SIMD_SHADE_COLUMNS; lane++) {
+        level = selectMipLevel(length[lane]);
+        levelSize = TEXTURE_SIZE >> level;
+        column = textures[lane] + MIP_COLUMN_OFFSET(level, textureX[lane] >> level);
+
+        /* Gathers take 32-bit indices from one base */
+        offset = column - base;
+        if(offset != (int)offset)
+            return FALSE;
+
+        offsets[lane] = (int)offset;
+        darkenMask[lane] = darken[lane] ? -1 : 0;
+        starts[lane] = wallYStart[lane] < 0 ? 0 : wallYStart[lane];
+        ends[lane] = starts[lane] + length[lane];
+        halfLengths[lane] = length[lane] / 2.0f;
+        scales[lane] = (float)(levelSize-EPS);
+        sizes[lane] = (float)levelSize;
+        lasts[lane] = (float)(levelSize - 1);
+    }
+
+    half = _mm256_set1_ps(height / 2.0f);
+    start = _mm256_loadu_ps(starts);
+    end = _mm256_loadu_ps(ends);
+    halfLength = _mm256_loadu_ps(halfLengths);
+    len = _mm256_loadu_ps(length);
+    scale = _mm256_loadu_ps(scales);
+    size = _mm256_loadu_ps(sizes);
+    last = _mm256_loadu_ps(lasts);
+    texelOffsets = _mm256_loadu_si256((const __m256i*)offsets);
+    darkenLanes = _mm256_loadu_si256((const __m256i*)darkenMask);
+
+    for(y = 0; y < height; y++) {
+        rowY = _mm256_set1_ps((float)y);
+        ty = _mm256_div_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(rowY, half), halfLength), scale), len);
+        ty = _mm256_blendv_ps(ty, last, _mm256_cmp_ps(ty, size, _CMP_GE_OQ));
+
+        above = _mm256_cmp_ps(rowY, start, _CMP_LT_OQ);
+        below = _mm256_cmp_ps(rowY, end, _CMP_GT_OQ);
+        wall = _mm256_xor_si256(_mm256_castps_si256(_mm256_or_ps(above, below)), _mm256_set1_epi32(-1));
+
+        index = _mm256_add_epi32(_mm256_cvttps_epi32(ty), texelOffsets);
+        color = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)base, index, wall, 4);
+        dark = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(color, 1), _mm256_set1_epi32(0x7F7F7F7F)), _mm256_set1_epi32((int)0xFF000000));
+        color = _mm256_blendv_epi8(color, dark, darkenLanes);
+
+        /* The ceiling wins where both apply, as it does in the scalar kernel */
+        color = _mm256_blendv_epi8(color, _mm256_set1_epi32((int)FLOOR_COLOR), _mm256_castps_si256(below));
+        color = _mm256_blendv_epi8(color, _mm256_set1_epi32((int)CEILING_COLOR), _mm256_castps_si256(above));
+        _mm256_storeu_si256((__m256i*)(dst + y * pitch), color);
+    }
+
+    return TRUE;
+}
+#else
+int drawTexturedStripsAVX2To(Uint32* dst, int pitch, int height, const float* wallYStart, const float* length, const int* textureX, Uint32* const* textures, const char* darken) {
+    (void)dst; (void)pitch; (void)height; (void)wallYStart; (void)length; (void)textureX; (void)textures; (void)darken;
+    return FALSE;
+}
+#endif
+
+void drawUntexturedStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, Uint8 color, char darken) {
+    int y;
+
+    if(wallYStart < 0)
+        wallYStart = 0;
+
+    for(y = 0; y < height; y++) {
+        if(y < wallYStart) {
+            dst[y * pitch] = indexedCeilingColor;
+        } else if(y > (wallYStart + length)) {
+            dst[y * pitch] = indexedFloorColor;
+        } else {
+            dst[y * pitch] = (darken) ? color : darkenRemap[color];
+        }
+    }
+}
+
+void drawUntexturedStrip8(int x, float wallYStart, float length, Uint8 color, char darken) {
+    drawUntexturedStrip8To(indexedScreenBuffer + x, WINDOW_WIDTH, WINDOW_HEIGHT, wallYStart, length, color, darken);
+}
+
+void drawTexturedStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, int textureX, Uint8* texture, char darken) {
+    int y;
+    float d, ty;
+    Uint8 color;
+    int level = selectMipLevel(length);
+    int levelSize = TEXTURE_SIZE >> level;
+    Uint8* column = texture + MIP_COLUMN_OFFSET(level, textureX >> level);
+
+    if(wallYStart < 0)
+        wallYStart = 0;
+
+    for(y = 0; y < height; y++) {
+        d = y - (height / 2.0f) + length / 2.0f;
+        ty = d * (float)(levelSize-EPS) / length;
+        if(ty >= levelSize) ty = levelSize - 1; /* EPS vanishes in float precision */
+
+        if(y < wallYStart) {
+            dst[y * pitch] = indexedCeilingColor;
+        } else if(y > (wallYStart + length)) {
+            dst[y * pitch] = indexedFloorColor;
+        } else {
+            color = column[(int)ty];
+            if(darken) color = darkenRemap[color];
+
+            dst[y * pitch] = color;
+        }
+    }
+}
+
+void drawTexturedStrip8(int x, float wallYStart, float length, int textureX, Uint8* texture, char darken) {
+    drawTexturedStrip8To(indexedScreenBuffer + x, WINDOW_WIDTH, WINDOW_HEIGHT, wallYStart, length, textureX, texture, darken);
+}
+
+void drawLitTexturedStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, int textureX, Uint32* texture, int level) {
+    int y;
+    float d, ty;
+    int scale = LIGHT_SCALE(level);
+    int mip = selectMipLevel(length);
+    int levelSize = TEXTURE_SIZE >> mip;
+    Uint32* column = texture + MIP_COLUMN_OFFSET(mip, textureX >> mip);
+
+    if(wallYStart < 0)
+        wallYStart = 0;
+
+    for(y = 0; y < height; y++) {
+        d = y - (height / 2.0f) + length / 2.0f;
+        ty = d * (float)(levelSize-EPS) / length;
+        if(ty >= levelSize) ty = levelSize - 1; /* EPS vanishes in float precision */
+
+        if(y < wallYStart) {
+            dst[y * pitch] = CEILING_COLOR;
+        } else if(y > (wallYStart + length)) {
+            dst[y * pitch] = FLOOR_COLOR;
+        } else {
+            dst[y * pitch] = LIGHT_COLOR(column[(int)ty], scale);
         }
     }
+}
 
+void drawLitTexturedStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, int textureX, Uint8* texture, int level) {
+    int y;
+    float d, ty;
+    Uint8* remap = lightRemap[level];
+    int mip = selectMipLevel(length);
+    int levelSize = TEXTURE_SIZE >> mip;
+    Uint8* column = texture + MIP_COLUMN_OFFSET(mip, textureX >> mip);
+
+    if(wallYStart < 0)
+        wallYStart = 0;
+
+    for(y = 0; y < height; y++) {
+        d = y - (height / 2.0f) + length / 2.0f;
+        ty = d * (float)(levelSize-EPS) / length;
+        if(ty >= levelSize) ty = levelSize - 1; /* EPS vanishes in float precision */
+
+        if(y < wallYStart) {
+            dst[y * pitch] = indexedCeilingColor;
+        } else if(y > (wallYStart + length)) {
+            dst[y * pitch] = indexedFloorColor;
+        } else {
+            dst[y * pitch] = remap[column[(int)ty]];
+        }
+    }
+}
+
+void drawLitUntexturedStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, Uint32 ABGRColor, int level) {
+    int y;
+    Uint32 lit = LIGHT_COLOR(ABGRColor, LIGHT_SCALE(level));
+
+    if(wallYStart < 0)
+        wallYStart = 0;
+
+    for(y = 0; y < height; y++) {
+        if(y < wallYStart) {
+            dst[y * pitch] = CEILING_COLOR;
+        } else if(y > (wallYStart + length)) {
+            dst[y * pitch] = FLOOR_COLOR;
+        } else {
+            dst[y * pitch] = lit;
+        }
+    }
 }
 
-int getTextureColumnNumberForRay(Vector3f* ray, RayType rtype) {
-    Vector3f rayHitPos = vectorAdd(&playerPos, ray);
+void drawLitUntexturedStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, Uint8 color, int level) {
+    int y;
+    Uint8 lit = lightRemap[level][color];
+
+    if(wallYStart < 0)
+        wallYStart = 0;
+
+    for(y = 0; y < height; y++) {
+        if(y < wallYStart) {
+            dst[y * pitch] = indexedCeilingColor;
+        } else if(y > (wallYStart + length)) {
+            dst[y * pitch] = indexedFloorColor;
+        } else {
+            dst[y * pitch] = lit;
+        }
+    }
+}
+
+void drawGrateStripTo(Uint32* dst, int pitch, int height, float wallYStart, float length, int textureX, const Uint32* texture, Uint32 color, int scale) {
+    int y, ty;
+    int last = MIN((int)floor(wallYStart + length), height - 1);
+    const Uint32* column = texture ? texture + MIP_COLUMN_OFFSET(0, textureX) : NULL;
+
+    /* Bars are placed in full-size texels, so the full-size texture is used at any distance */
+    for(y = MAX((int)ceil(wallYStart), 0); y <= last; y++) {
+        ty = MIN((int)((y - (height / 2.0f) + length / 2.0f) * (float)(TEXTURE_SIZE-EPS) / length), TEXTURE_SIZE - 1);
+        if(IS_GRATE_TEXEL(textureX, ty))
+            dst[y * pitch] = LIGHT_COLOR(column ? column[ty] : color, scale);
+    }
+}
+
+void drawGrateStrip8To(Uint8* dst, int pitch, int height, float wallYStart, float length, int textureX, const Uint8* texture, Uint8 color, const Uint8* remap) {
+    int y, ty;
+    int last = MIN((int)floor(wallYStart + length), height - 1);
+    const Uint8* column = texture ? texture + MIP_COLUMN_OFFSET(0, textureX) : NULL;
+    Uint8 texel;
+
+    for(y = MAX((int)ceil(wallYStart), 0); y <= last; y++) {
+        ty = MIN((int)((y - (height / 2.0f) + length / 2.0f) * (float)(TEXTURE_SIZE-EPS) / length), TEXTURE_SIZE - 1);
+        if(!IS_GRATE_TEXEL(textureX, ty))
+            continue;
+        texel = column ? column[ty] : color;
+        dst[y * pitch] = remap ? remap[texel] : texel;
+    }
+}
+
+int getTextureColumnNumberForRay(Vector2f origin, Vector2f ray, RayType rtype) {
+    Vector2f rayHitPos = vec2Add(origin, ray);
     if(rtype == HORIZONTAL_RAY) {
-        if(ray->y < 0)
-            return (int)rayHitPos.x % TEXTURE_SIZE;
+        if(ray.y < 0)
+            return WALL_TO_TEXTURE_X((int)rayHitPos.x % WALL_SIZE);
         else
-            return TEXTURE_SIZE - 1 - ((int)rayHitPos.x % TEXTURE_SIZE);
+            return TEXTURE_SIZE - 1 - WALL_TO_TEXTURE_X((int)rayHitPos.x % WALL_SIZE);
     } else {
-        if(ray->x > 0)
-            return (int)rayHitPos.y % TEXTURE_SIZE;
+        if(ray.x > 0)
+            return WALL_TO_TEXTURE_X((int)rayHitPos.y % WALL_SIZE);
         else
-            return TEXTURE_SIZE - 1 - ((int)rayHitPos.y % TEXTURE_SIZE);
+            return TEXTURE_SIZE - 1 - WALL_TO_TEXTURE_X((int)rayHitPos.y % WALL_SIZE);
     }
 }
 
-float getUndistortedRayLength(Vector3f* ray) {
-    Vector3f undistortedRay;
-    Vector3f proj = vectorProjection(ray, &viewplaneDir);
-    undistortedRay = vectorSubtract(ray, &proj);
+float getUndistortedRayLength(Vector2f ray, Vector2f dir) {
+    return vec2Dot(ray, dir);
+}
+
+int getWallMaterial(int mapx, int mapy) {
+    int material;
+
+    /* Rays leaving the map (the edge of a streamed world's window) hit gray */
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return W;
+    material = TILE_MATERIAL(MAP[mapy][mapx]);
+    return (material < 1 || material > 4) ? W : material;
+}
+
+void storeColumnLayer(const Camera* camera, Vector2f ray, RayType rtype, int mapx, int mapy, ColumnHits* hits, int index) {
+    int layer = hits->layerCount[index]++;
+    Vector2f hit = vec2Add(camera->pos, ray);
 
-    return homogeneousVectorMagnitude(&undistortedRay);
+    hits->layerDistance[index][layer] = distortion ? vec2Length(ray) : getUndistortedRayLength(ray, camera->dir);
+    hits->layerSide[index][layer] = rtype;
+    hits->layerMaterial[index][layer] = getWallMaterial(mapx, mapy);
+    hits->layerTextureX[index][layer] = getTextureColumnNumberForRay(camera->pos, ray, rtype);
+    if(lightingMode)
+        hits->layerLight[index][layer] = getLightLevel(mapx, mapy, rtype, ray, rtype == VERTICAL_RAY ? hit.y : hit.x);
+}
+
+void findColumnLayers(const Camera* camera, Vector2f ray, ColumnHits* hits, int index) {
+    int mapx = (int)floor(camera->pos.x / WALL_SIZE);
+    int mapy = (int)floor(camera->pos.y / WALL_SIZE);
+    int stepx = ray.x < 0 ? -1 : 1;
+    int stepy = ray.y < 0 ? -1 : 1;
+    float deltax = fabs(WALL_SIZE / MAKE_FLOAT_NONZERO(ray.x));
+    float deltay = fabs(WALL_SIZE / MAKE_FLOAT_NONZERO(ray.y));
+    float sidex = ((mapx + (stepx > 0)) * WALL_SIZE - camera->pos.x) / MAKE_FLOAT_NONZERO(ray.x);
+    float sidey = ((mapy + (stepy > 0)) * WALL_SIZE - camera->pos.y) / MAKE_FLOAT_NONZERO(ray.y);
+    char inside = FALSE;
+    RayType rtype;
+    float t;
+
+    /*
+     * Walk the cells between the camera and the wall the ray stopped at,
+     * t going from 0 to 1, and note where it enters see-through walls.
+     * A run of them is one layer. The list is full at MAX_COLUMN_LAYERS;
+     * anything further is hidden by the nearer layers often enough.
+     */
+    hits->layerCount[index] = 0;
+    while(hits->layerCount[index] < MAX_COLUMN_LAYERS) {
+        if(sidex < sidey) {
+            t = sidex;
+            sidex += deltax;
+            mapx += stepx;
+            rtype = VERTICAL_RAY;
+        } else {
+            t = sidey;
+            sidey += deltay;
+            mapy += stepy;
+            rtype = HORIZONTAL_RAY;
+        }
+        if(t >= 1.0f)
+            break;
+
+        /* The ray only got this far through opaque cells by the gap of a door */
+        if(isOpaqueTile(mapx, mapy)) {
+            if(!isInDoorGap(mapx, mapy, rtype == VERTICAL_RAY ? camera->pos.y + ray.y * t : camera->pos.x + ray.x * t))
+                break;
+            inside = FALSE;
+        } else if(!isSolidTile(mapx, mapy)) {
+            inside = FALSE;
+        } else if(!inside) {
+            storeColumnLayer(camera, vec2Scale(ray, t), rtype, mapx, mapy, hits, index);
+            inside = TRUE;
+        }
+    }
+}
+
+void storeColumnHit(const Camera* camera, const RayTuple* rayTuple, ColumnHits* hits, int index) {
+    RayType rtype;
+    Vector2f ray, coords, hit;
+
+    if(vec2LengthSquared(rayTuple->hRay) < vec2LengthSquared(rayTuple->vRay)) {
+        ray = rayTuple->hRay;
+        rtype = HORIZONTAL_RAY;
+        coords = getTileCoordinateForHorizontalRay(camera->pos, ray);
+    } else {
+        ray = rayTuple->vRay;
+        rtype = VERTICAL_RAY;
+        coords = getTileCoordinateForVerticalRay(camera->pos, ray);
+    }
+
+    hits->distance[index] = distortion ? vec2Length(ray) : getUndistortedRayLength(ray, camera->dir);
+    hits->side[index] = rtype;
+    hits->material[index] = getWallMaterial(coords.x, coords.y);
+    hits->textureX[index] = getTextureColumnNumberForRay(camera->pos, ray, rtype);
+    hits->mapx[index] = coords.x;
+    hits->mapy[index] = coords.y;
+
+    if(lightingMode) {
+        /* Faces run along y for vertical hits and along x for horizontal ones */
+        hit = vec2Add(camera->pos, ray);
+        hits->light[index] = getLightLevel(coords.x, coords.y, rtype, ray, rtype == VERTICAL_RAY ? hit.y : hit.x);
+    }
+
+    /* Most maps have no see-through walls, and then there is nothing to look for */
+    if(seeThroughTileCount)
+        findColumnLayers(camera, ray, hits, index);
+    else
+        hits->layerCount[index] = 0;
+}
+
+float getColumnDrawLength(const View* view, const ColumnHits* hits, int index) {
+    return VIEW_DIST_FROM_VIEWPLANE(view) * WALL_SIZE / hits->distance[index];
+}
+
+void shadeColumnLayers(const View* view, const ColumnHits* hits, int index, int offset) {
+    float drawLength, wallYStart, distFromViewplane = VIEW_DIST_FROM_VIEWPLANE(view);
+    int layer, material;
+    char shaded;
+
+    /* Back to front, so nearer bars cover further ones */
+    for(layer = hits->layerCount[index] - 1; layer >= 0; layer--) {
+        drawLength = distFromViewplane * WALL_SIZE / hits->layerDistance[index][layer];
+        wallYStart = (view->height / 2.0f) - (drawLength / 2.0f);
+        material = hits->layerMaterial[index][layer];
+
+        /* Shaded the way the walls around it are; the un-textured kernels darken the other side */
+        shaded = (hits->layerSide[index][layer] == HORIZONTAL_RAY) == (textureMode != 0);
+
+        if(indexedColorMode)
+            drawGrateStrip8To(indexedScreenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, hits->layerTextureX[index][layer],
+                    textureMode ? INDEXED_TEXTURES[material - 1] : NULL, INDEXED_COLORS[material - 1],
+                    lightingMode ? lightRemap[hits->layerLight[index][layer]] : shaded ? darkenRemap : NULL);
+        else
+            drawGrateStripTo(screenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, hits->layerTextureX[index][layer],
+                    textureMode ? TEXTURES[material - 1] : NULL, COLORS[material - 1],
+                    lightingMode ? LIGHT_SCALE(hits->layerLight[index][layer]) : shaded ? 128 : 256);
+    }
+}
+
+void shadeColumn(const View* view, const ColumnHits* hits, int index, int column) {
+    float drawLength = getColumnDrawLength(view, hits, index);
+    float wallYStart = (view->height / 2.0f) - (drawLength / 2.0f);
+    int offset = XY_TO_SCREEN_INDEX(view->x + column, view->y);
+    int material = hits->material[index];
+    char darken = hits->side[index] == HORIZONTAL_RAY;
+    int level = hits->light[index];
+
+    if(lightingMode) {
+        /* The light level replaces side darkening */
+        if(textureMode && indexedColorMode)
+            drawLitTexturedStrip8To(indexedScreenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, hits->textureX[index], INDEXED_TEXTURES[material - 1], level);
+        else if(textureMode)
+            drawLitTexturedStripTo(screenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, hits->textureX[index], TEXTURES[material - 1], level);
+        else if(indexedColorMode)
+            drawLitUntexturedStrip8To(indexedScreenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, INDEXED_COLORS[material - 1], level);
+        else
+            drawLitUntexturedStripTo(screenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, COLORS[material - 1], level);
+
+    } else if(textureMode) {
+        if(indexedColorMode)
+            drawTexturedStrip8To(indexedScreenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, hits->textureX[index], INDEXED_TEXTURES[material - 1], darken);
+        else
+            drawTexturedStripTo(screenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, hits->textureX[index], TEXTURES[material - 1], darken);
+
+    } else {
+        if(indexedColorMode)
+            drawUntexturedStrip8To(indexedScreenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, INDEXED_COLORS[material - 1], darken);
+        else
+            drawUntexturedStripTo(screenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, drawLength, COLORS[material - 1], darken);
+    }
+
+    if(hits->layerCount[index])
+        shadeColumnLayers(view, hits, index, offset);
+}
+
+/* Draws a group's walls with the AVX2 kernel, returning FALSE if it can't */
+int shadeColumnGroup(const View* view, const ColumnHits* hits, int index, int column) {
+    float wallYStart[SIMD_SHADE_COLUMNS], length[SIMD_SHADE_COLUMNS];
+    Uint32* textures[SIMD_SHADE_COLUMNS];
+    int textureX[SIMD_SHADE_COLUMNS];
+    char darken[SIMD_SHADE_COLUMNS];
+    int lane, offset = XY_TO_SCREEN_INDEX(view->x + column, view->y);
+
+    for(lane = 0; lane < SIMD_SHADE_COLUMNS; lane++) {
+        length[lane] = getColumnDrawLength(view, hits, index + lane);
+        wallYStart[lane] = (view->height / 2.0f) - (length[lane] / 2.0f);
+        textureX[lane] = hits->textureX[index + lane];
+        textures[lane] = TEXTURES[hits->material[index + lane] - 1];
+        darken[lane] = hits->side[index + lane] == HORIZONTAL_RAY;
+    }
+
+    if(!drawTexturedStripsAVX2To(screenBuffer + offset, WINDOW_WIDTH, view->height, wallYStart, length, textureX, textures, darken))
+        return FALSE;
+
+    for(lane = 0; lane < SIMD_SHADE_COLUMNS; lane++)
+        if(hits->layerCount[index + lane])
+            shadeColumnLayers(view, hits, index + lane, offset + lane);
+    return TRUE;
+}
+
+void shadeColumns(const View* view, const ColumnHits* hits, int index, int column, int count) {
+    int end = index + count;
+
+    /* Only plain textured walls have a vector kernel */
+    if(gfxHasAVX2 && textureMode && !indexedColorMode && !lightingMode) {
+        for(; index + SIMD_SHADE_COLUMNS <= end; index += SIMD_SHADE_COLUMNS, column += SIMD_SHADE_COLUMNS)
+            if(!shadeColumnGroup(view, hits, index, column))
+                break;
+    }
+
+    for(; index < end; index++, column++)
+        shadeColumn(view, hits, index, column);
+}
+
+void presentScreenBuffer() {
+    if(indexedColorMode)
+        displayFullscreenIndexedTexture(screenBuffer, indexedScreenBuffer, PALETTE);
+    else
+        displayFullscreenTexture(screenBuffer);
 }
 
 void renderProjectedScene() {
     int i;
+    View view;
+
+    getPlayerCamera(&view.camera);
+    view.x = 0;
+    view.y = 0;
+    view.width = WINDOW_WIDTH;
+    view.height = WINDOW_HEIGHT;
 
     if (slowRenderMode) {
         int x, y;
 
-        for(x = 0; x < WINDOW_WIDTH; x++)
-            for(y = 0; y < WINDOW_HEIGHT; y++)
+        for(x = 0; x < WINDOW_WIDTH; x++) {
+            for(y = 0; y < WINDOW_HEIGHT; y++) {
                 screenBuffer[(WINDOW_WIDTH * y) + x] = 0xFFFFFFFF;
+                indexedScreenBuffer[(WINDOW_WIDTH * y) + x] = PALETTE_SIZE - 1;
+            }
+        }
     }
 
-    for(i = 0; i < WINDOW_WIDTH; i++) {
-        int textureX = 0;
-        int mapx, mapy;
-        float drawLength;
-        RayType rtype;
-        Vector3f ray;
+    for(i = 0; i < WINDOW_WIDTH; i++)
+        storeColumnHit(&view.camera, &rays[i], &columnHits, i);
 
-        if(homogeneousVectorMagnitude(&rays[i].hRay) < homogeneousVectorMagnitude(&rays[i].vRay)) {
-            Vector3f coords;
-            ray = rays[i].hRay;
-            rtype = HORIZONTAL_RAY;
+    if (slowRenderMode) {
+        for(i = 0; i < WINDOW_WIDTH; i++) {
+            shadeColumn(&view, &columnHits, i, i);
+            clearRenderer();
+            presentScreenBuffer();
+            SDL_Delay(2);
+        }
+        slowRenderMode = 0;
+    } else {
+        shadeColumns(&view, &columnHits, 0, 0, WINDOW_WIDTH);
+    }
 
-            coords = getTileCoordinateForHorizontalRay(&ray);
-            mapx = coords.x;
-            mapy = coords.y;
-        } else {
-            Vector3f coords;
-            ray = rays[i].vRay;
-            rtype = VERTICAL_RAY;
+    clearRenderer();
+    presentScreenBuffer();
+}
 
-            coords = getTileCoordinateForVerticalRay(&ray);
-            mapx = coords.x;
-            mapy = coords.y;
-        }
 
-        if(textureMode)
-            textureX = getTextureColumnNumberForRay(&ray, rtype);
+/*========================================================
+ * Interleaved (checkerboard) rendering
+ *========================================================
+ */
 
-        if(distortion)
-            drawLength = calculateDrawHeight(homogeneousVectorMagnitude(&ray));
-        else
-            drawLength = calculateDrawHeight(getUndistortedRayLength(&ray));
+/* Everything which changes how every column looks; a change forces a full frame */
+typedef struct {
+    char textureMode;
+    char indexedColorMode;
+    char distortion;
+    char lightingMode;
+    float distFromViewplane;
+} InterleavedKey;
+
+ColumnSample columnSamples[WINDOW_WIDTH];
+ColumnSample historySamples[WINDOW_WIDTH];
+Uint32* historyBuffer = NULL;
+Uint8* indexedHistoryBuffer = NULL;
+Camera historyCamera;
+InterleavedKey historyKey;
+Uint32 historyMapVersion = 0;
+Uint32 historyLightVersion = 0;
+char historyValid = FALSE;
+int interleavedParity = 0;
+
+void resetInterleavedHistory() {
+    historyValid = FALSE;
+}
+
+float getProjectedDrawLength(const View* view, Vector2f ray) {
+    if(distortion)
+        return VIEW_DIST_FROM_VIEWPLANE(view) * WALL_SIZE / vec2Length(ray);
+    return VIEW_DIST_FROM_VIEWPLANE(view) * WALL_SIZE / getUndistortedRayLength(ray, view->camera.dir);
+}
 
-        if(textureMode) {
-            int texnum = MAP[mapy][mapx];
-            if(texnum < 1 || texnum > 4)
-                texnum = 4;
-            drawTexturedStrip(i, (WINDOW_HEIGHT / 2.0f) - (drawLength / 2.0f), drawLength, textureX, TEXTURES[texnum - 1], rtype == HORIZONTAL_RAY);
+int isSampleStale(const ColumnSample* sample) {
+    Vector2f inside;
+    int mapx, mapy;
 
+    if(!sample->valid)
+        return TRUE;
+
+    /* Step just past the hit into the wall cell and check it hasn't changed since */
+    inside = vec2Add(sample->hit, vec2Scale(vec2Normalize(vec2Sub(sample->hit, historyCamera.pos)), 0.5f));
+    mapx = (int)(inside.x / WALL_SIZE);
+    mapy = (int)(inside.y / WALL_SIZE);
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return FALSE;
+    if(lightingMode && lightCellVersion[mapy][mapx] > historyLightVersion)
+        return TRUE;
+    return mapCellVersion[mapy][mapx] > historyMapVersion;
+}
+
+void resampleColumn(int dst, int src, float scale) {
+    int y, sy;
+    float center = WINDOW_HEIGHT / 2.0f;
+    Sint32 srcY = (Sint32)((center - center / scale) * 65536.0f);
+    Sint32 step = (Sint32)(65536.0f / scale);
+
+    /*
+     * Walls are centered on the horizon and the ceiling and floor are
+     * flat, so a column seen from nearer or further is the same column
+     * stretched about the center. Rows past the ends are ceiling or floor.
+     */
+    if(indexedColorMode) {
+        for(y = 0; y < WINDOW_HEIGHT; y++, srcY += step) {
+            sy = srcY < 0 ? 0 : MIN(srcY >> 16, WINDOW_HEIGHT - 1);
+            indexedScreenBuffer[XY_TO_SCREEN_INDEX(dst, y)] = indexedHistoryBuffer[XY_TO_SCREEN_INDEX(src, sy)];
+        }
+    } else {
+        for(y = 0; y < WINDOW_HEIGHT; y++, srcY += step) {
+            sy = srcY < 0 ? 0 : MIN(srcY >> 16, WINDOW_HEIGHT - 1);
+            screenBuffer[XY_TO_SCREEN_INDEX(dst, y)] = historyBuffer[XY_TO_SCREEN_INDEX(src, sy)];
+        }
+    }
+}
+
+void interpolateColumn(int dst) {
+    int left = dst > 0 ? dst - 1 : dst + 1;
+    int right = dst < WINDOW_WIDTH - 1 ? dst + 1 : dst - 1;
+    Uint32 a, b;
+    int y;
+
+    for(y = 0; y < WINDOW_HEIGHT; y++) {
+        if(indexedColorMode) {
+            /* Indices can't be blended */
+            indexedScreenBuffer[XY_TO_SCREEN_INDEX(dst, y)] = indexedScreenBuffer[XY_TO_SCREEN_INDEX(left, y)];
         } else {
-            int color = MAP[mapy][mapx];
-            if(color < 1 || color > 4)
-                color = 4;
-            drawUntexturedStrip(i, (WINDOW_HEIGHT / 2.0f) - (drawLength / 2.0f), drawLength, COLORS[color - 1], rtype == HORIZONTAL_RAY);
+            a = screenBuffer[XY_TO_SCREEN_INDEX(left, y)];
+            b = screenBuffer[XY_TO_SCREEN_INDEX(right, y)];
+            screenBuffer[XY_TO_SCREEN_INDEX(dst, y)] = ((a >> 1) & 0x7F7F7F7F) + ((b >> 1) & 0x7F7F7F7F) + (a & b & 0x01010101);
         }
-        if (slowRenderMode) {
-            clearRenderer();
-            displayFullscreenTexture(screenBuffer);
-            SDL_Delay(2);
+    }
+}
+
+void reconstructSkippedColumns(const View* view, int parity) {
+    static int source[WINDOW_WIDTH];
+    static float sourceLength[WINDOW_WIDTH];
+    const Camera* camera = &view->camera;
+    float dist = VIEW_DIST_FROM_VIEWPLANE(view);
+    float forward, side, x, length, l, r, scale;
+    Vector2f ray;
+    int c, s;
+
+    for(c = 0; c < WINDOW_WIDTH; c++)
+        source[c] = -1;
+
+    /* Move every column of the last frame to where its hit projects now; nearest wins */
+    for(s = 0; s < WINDOW_WIDTH; s++) {
+        if(isSampleStale(&historySamples[s]))
+            continue;
+
+        ray = vec2Sub(historySamples[s].hit, camera->pos);
+        forward = vec2Dot(ray, camera->dir);
+        if(forward <= EPS)
+            continue;
+        side = vec2Dot(ray, camera->plane);
+        x = (WINDOW_WIDTH / 2) + dist * side / forward;
+        c = (int)floor(x + 0.5f);
+        if(c < 0 || c >= WINDOW_WIDTH || (c & 1) == parity)
+            continue;
+
+        length = getProjectedDrawLength(view, ray);
+        if(source[c] < 0 || length > sourceLength[c]) {
+            source[c] = s;
+            sourceLength[c] = length;
         }
     }
-    if (slowRenderMode)
-        slowRenderMode = 0;
+
+    for(c = 1 - parity; c < WINDOW_WIDTH; c += 2) {
+        s = source[c];
+
+        /* Something the fresh neighbors both disagree with was probably covered up */
+        if(s >= 0 && c > 0 && c < WINDOW_WIDTH - 1) {
+            l = columnSamples[c - 1].drawLength;
+            r = columnSamples[c + 1].drawLength;
+            length = sourceLength[c];
+            if(fabs(l - r) < 0.25f * MAX(l, r) && fabs(length - l) > 0.25f * l && fabs(length - r) > 0.25f * r)
+                s = -1;
+        }
+
+        if(s < 0) {
+            interpolateColumn(c);
+            columnSamples[c].valid = FALSE;
+            continue;
+        }
+
+        /* Rounding in the reprojection shouldn't shift a column that kept its height */
+        scale = sourceLength[c] / historySamples[s].drawLength;
+        if(fabs(scale - 1.0f) < INTERLEAVED_SCALE_EPS)
+            scale = 1.0f;
+
+        /* An unmoved column is still in the screen buffer from last frame */
+        if(s != c || scale != 1.0f)
+            resampleColumn(c, s, scale);
+        columnSamples[c] = historySamples[s];
+        columnSamples[c].drawLength *= scale;
+    }
+}
+
+void renderInterleavedScene() {
+    InterleavedKey key;
+    View view;
+    int i, step = 2, first = interleavedParity;
+
+    getPlayerCamera(&view.camera);
+    view.x = 0;
+    view.y = 0;
+    view.width = WINDOW_WIDTH;
+    view.height = WINDOW_HEIGHT;
+
+    if(!historyBuffer) historyBuffer = allocTextureMemory(DEFAULT_TEXTURE_SET, WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(Uint32));
+    if(!indexedHistoryBuffer) indexedHistoryBuffer = allocTextureMemory(DEFAULT_TEXTURE_SET, WINDOW_WIDTH * WINDOW_HEIGHT);
+
+    memset(&key, 0, sizeof(key));
+    key.textureMode = textureMode;
+    key.indexedColorMode = indexedColorMode;
+    key.distortion = distortion;
+    key.lightingMode = lightingMode;
+    key.distFromViewplane = view.camera.distFromViewplane;
+
+    getCameraRays(view.camera.distFromViewplane, WINDOW_WIDTH);
+
+    /* Without usable history every column is drawn */
+    if(!historyValid || !historyBuffer || !indexedHistoryBuffer || memcmp(&key, &historyKey, sizeof(key))) {
+        step = 1;
+        first = 0;
+    }
+
+    for(i = first; i < WINDOW_WIDTH; i += step) {
+        rays[i].vRay = rays[i].hRay = cameraRayDirection(&view.camera, i, WINDOW_WIDTH);
+        traceRay(view.camera.pos, &rays[i]);
+        storeColumnHit(&view.camera, &rays[i], &columnHits, i);
+        shadeColumn(&view, &columnHits, i, i);
+
+        /* Keep the hit itself to move the column in later frames */
+        columnSamples[i].hit = vec2Add(view.camera.pos, columnHits.side[i] == HORIZONTAL_RAY ? rays[i].hRay : rays[i].vRay);
+        columnSamples[i].drawLength = getColumnDrawLength(&view, &columnHits, i);
+        columnSamples[i].valid = TRUE;
+    }
+
+    if(step == 2)
+        reconstructSkippedColumns(&view, interleavedParity);
+
+    clearRenderer();
+    presentScreenBuffer();
+
+    if(!historyBuffer || !indexedHistoryBuffer)
+        return;
+
+    /* This frame is the next frame's history */
+    if(indexedColorMode)
+        memcpy(indexedHistoryBuffer, indexedScreenBuffer, WINDOW_WIDTH * WINDOW_HEIGHT);
+    else
+        memcpy(historyBuffer, screenBuffer, WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(Uint32));
+    memcpy(historySamples, columnSamples, sizeof(historySamples));
+    historyCamera = view.camera;
+    historyKey = key;
+    historyMapVersion = mapVersion;
+    historyLightVersion = lightVersion;
+    historyValid = TRUE;
+    interleavedParity ^= 1;
+}
+
+
+/* Work shared by the columns of a renderViews pass */
+typedef struct {
+    const View* views;
+    int count;
+    int firstColumn[MAX_VIEWS + 1];
+} ViewPass;
+
+const View* getPassView(const ViewPass* pass, int index, int* view) {
+    while(index >= pass->firstColumn[*view + 1])
+        (*view)++;
+    return &pass->views[*view];
+}
+
+void castViewColumns(int begin, int end, void* context) {
+    const ViewPass* pass = context;
+    const View* view;
+    RayTuple ray;
+    int i, v = 0;
+
+    for(i = begin; i < end; i++) {
+        view = getPassView(pass, i, &v);
+        ray.vRay = ray.hRay = cameraRayDirection(&view->camera, i - pass->firstColumn[v], view->width);
+        traceRay(view->camera.pos, &ray);
+        storeColumnHit(&view->camera, &ray, &columnHits, i);
+    }
+}
+
+void shadeViewColumns(int begin, int end, void* context) {
+    const ViewPass* pass = context;
+    const View* view;
+    int i, last, v = 0;
+
+    /* In runs which stay within one view */
+    for(i = begin; i < end; i = last) {
+        view = getPassView(pass, i, &v);
+        last = MIN(end, pass->firstColumn[v + 1]);
+        shadeColumns(view, &columnHits, i, i - pass->firstColumn[v], last - i);
+    }
+}
+
+void renderViews(const View* views, int count) {
+    ViewPass pass;
+    int v;
+
+    count = MIN(count, MAX_VIEWS);
+    pass.views = views;
+    pass.count = count;
+    pass.firstColumn[0] = 0;
+    for(v = 0; v < count; v++) {
+        pass.firstColumn[v + 1] = pass.firstColumn[v] + views[v].width;
+        getCameraRays(views[v].camera.distFromViewplane, views[v].width);
+    }
+
+    /* Every column of every view is independent: cast them all, then shade them all */
+    parallelFor(pass.firstColumn[count], VIEW_COLUMN_GRAIN, castViewColumns, &pass);
+    parallelFor(pass.firstColumn[count], VIEW_COLUMN_GRAIN, shadeViewColumns, &pass);
 
     clearRenderer();
-    displayFullscreenTexture(screenBuffer);
+    presentScreenBuffer();
 }
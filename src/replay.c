@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "header/main.h"
+
+/*
+ * Replay file layout (all multi-byte values little-endian):
+ *
+ *   "MZRP"  magic
+ *   Uint8   version
+ *   Uint8   milliseconds per tick of the recording
+ *   Uint32  number of ticks
+ *   records...
+ *
+ * Each record starts with a byte holding the INPUT_* held bits plus
+ * either REPLAY_ACTIONS_FLAG or REPLAY_RUN_FLAG. An actions record is
+ * followed by a count byte and then one byte per triggered action,
+ * holding the bit number of its ACTION_* flag. A run record is followed
+ * by a byte holding how many further ticks repeat the same held bits
+ * with no actions.
+ */
+#define REPLAY_MAGIC         "MZRP"
+#define REPLAY_VERSION       1
+#define REPLAY_HEADER_SIZE   10
+#define REPLAY_TICK_OFFSET   6
+#define REPLAY_ACTIONS_FLAG  0x20
+#define REPLAY_RUN_FLAG      0x40
+#define REPLAY_MAX_RUN       256
+
+/* Globals */
+char replayMode = REPLAY_OFF;
+FILE* replayFile = NULL;
+long replayTickCount = 0;
+Uint8 pendingHeld = 0;
+int pendingRun = 0;
+
+/* Frame timing */
+Uint64 frameStartCounter = 0;
+Uint64* frameTimes = NULL;
+long frameTimeCount = 0;
+long frameTimeCapacity = 0;
+
+
+void writeReplayHeader(long tickCount) {
+    fseek(replayFile, 0, SEEK_SET);
+    fwrite(REPLAY_MAGIC, 1, 4, replayFile);
+    fputc(REPLAY_VERSION, replayFile);
+    fputc(TICK_MS, replayFile);
+    fputc(tickCount & 0xFF, replayFile);
+    fputc((tickCount >> 8) & 0xFF, replayFile);
+    fputc((tickCount >> 16) & 0xFF, replayFile);
+    fputc((tickCount >> 24) & 0xFF, replayFile);
+}
+
+int startRecording(const char* path) {
+    if(replayMode != REPLAY_OFF) return FALSE;
+
+    replayFile = fopen(path, "wb");
+    if(!replayFile) return FALSE;
+
+    writeReplayHeader(0);
+    replayMode = REPLAY_RECORDING;
+    replayTickCount = 0;
+    pendingRun = 0;
+
+    return TRUE;
+}
+
+int startPlayback(const char* path) {
+    Uint8 header[REPLAY_HEADER_SIZE];
+
+    if(replayMode != REPLAY_OFF) return FALSE;
+
+    replayFile = fopen(path, "rb");
+    if(!replayFile) return FALSE;
+
+    if(fread(header, 1, REPLAY_HEADER_SIZE, replayFile) != REPLAY_HEADER_SIZE ||
+       header[0] != 'M' || header[1] != 'Z' || header[2] != 'R' || header[3] != 'P' ||
+       header[4] != REPLAY_VERSION) {
+        fclose(replayFile);
+        replayFile = NULL;
+        return FALSE;
+    }
+
+    replayTickCount = header[REPLAY_TICK_OFFSET] | (header[REPLAY_TICK_OFFSET + 1] << 8) |
+                      (header[REPLAY_TICK_OFFSET + 2] << 16) | ((long)header[REPLAY_TICK_OFFSET + 3] << 24);
+    replayMode = REPLAY_PLAYING;
+    pendingRun = 0;
+
+    return TRUE;
+}
+
+void flushPendingRun() {
+    if(!pendingRun) return;
+
+    if(pendingRun == 1) {
+        fputc(pendingHeld, replayFile);
+    } else {
+        fputc(pendingHeld | REPLAY_RUN_FLAG, replayFile);
+        fputc(pendingRun - 1, replayFile);
+    }
+    pendingRun = 0;
+}
+
+void recordInputFrame(InputFrame* frame) {
+    int bit, count = 0;
+
+    if(replayMode != REPLAY_RECORDING) return;
+
+    replayTickCount++;
+
+    /* Ticks with no actions are coalesced into runs of identical held bits */
+    if(!frame->actions) {
+        if(pendingRun && (pendingHeld != frame->held || pendingRun == REPLAY_MAX_RUN))
+            flushPendingRun();
+        pendingHeld = frame->held;
+        pendingRun++;
+        return;
+    }
+
+    flushPendingRun();
+    fputc(frame->held | REPLAY_ACTIONS_FLAG, replayFile);
+    for(bit = 0; bit < 32; bit++)
+        if(frame->actions & (1UL << bit)) count++;
+    fputc(count, replayFile);
+    for(bit = 0; bit < 32; bit++)
+        if(frame->actions & (1UL << bit)) fputc(bit, replayFile);
+}
+
+int readInputFrame(InputFrame* frame) {
+    int b, extra, count;
+
+    if(replayMode != REPLAY_PLAYING) return FALSE;
+
+    if(pendingRun) {
+        pendingRun--;
+        frame->held = pendingHeld;
+        frame->actions = 0;
+        return TRUE;
+    }
+
+    if((b = fgetc(replayFile)) == EOF) return FALSE;
+
+    frame->held = b & INPUT_HELD_MASK;
+    frame->actions = 0;
+
+    if(b & REPLAY_ACTIONS_FLAG) {
+        if((count = fgetc(replayFile)) == EOF) return FALSE;
+        while(count--) {
+            if((extra = fgetc(replayFile)) == EOF || extra >= 32) return FALSE;
+            frame->actions |= 1UL << extra;
+        }
+    } else if(b & REPLAY_RUN_FLAG) {
+        if((extra = fgetc(replayFile)) == EOF) return FALSE;
+        pendingHeld = frame->held;
+        pendingRun = extra;
+    }
+
+    return TRUE;
+}
+
+void stopReplay() {
+    if(replayMode == REPLAY_RECORDING) {
+        flushPendingRun();
+        writeReplayHeader(replayTickCount);
+        fprintf(stderr, "Recorded %ld ticks\n", replayTickCount);
+    }
+
+    if(replayFile)
+        fclose(replayFile);
+    replayFile = NULL;
+    replayMode = REPLAY_OFF;
+}
+
+void beginFrameTiming() {
+    frameStartCounter = SDL_GetPerformanceCounter();
+}
+
+void endFrameTiming() {
+    Uint64 elapsed = SDL_GetPerformanceCounter() - frameStartCounter;
+
+    if(frameTimeCount == frameTimeCapacity) {
+        long newCapacity = frameTimeCapacity ? frameTimeCapacity * 2 : 4096;
+        Uint64* newTimes = realloc(frameTimes, newCapacity * sizeof(Uint64));
+        if(!newTimes) return;
+        frameTimes = newTimes;
+        frameTimeCapacity = newCapacity;
+    }
+
+    frameTimes[frameTimeCount++] = elapsed;
+}
+
+int compareFrameTimes(const void* a, const void* b) {
+    Uint64 ta = *(const Uint64*)a;
+    Uint64 tb = *(const Uint64*)b;
+    return (ta > tb) - (ta < tb);
+}
+
+void printFrameTimingReport() {
+    long i;
+    Uint64 total = 0;
+    double toMs = 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    if(!frameTimeCount) return;
+
+    for(i = 0; i < frameTimeCount; i++)
+        total += frameTimes[i];
+
+    qsort(frameTimes, frameTimeCount, sizeof(Uint64), compareFrameTimes);
+
+    fprintf(stderr, "Frames: %ld\n", frameTimeCount);
+    fprintf(stderr, "Total:  %.3f ms (%.2f FPS)\n", total * toMs, frameTimeCount / (total * toMs / 1000.0));
+    fprintf(stderr, "Frame:  min %.3f ms, avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            frameTimes[0] * toMs,
+            total * toMs / frameTimeCount,
+            frameTimes[frameTimeCount / 2] * toMs,
+            frameTimes[(frameTimeCount * 99) / 100] * toMs,
+            frameTimes[frameTimeCount - 1] * toMs);
+
+    free(frameTimes);
+    frameTimes = NULL;
+    frameTimeCount = frameTimeCapacity = 0;
+}
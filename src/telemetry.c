@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "header/main.h"
+
+#ifdef RAY_TELEMETRY
+
+/*
+ * Rays are cast from the worker threads too, so every counter is an
+ * SDL atomic. Per-frame counters are folded into the session totals by
+ * beginRayTelemetryFrame on the main thread; cell visits keep adding up
+ * until clearRayTelemetry.
+ */
+
+/* Globals */
+char rayHeatmapMode = FALSE;
+RayTelemetry lastFrameTelemetry;
+RayTelemetry sessionTelemetry;
+long telemetryFrames = 0;
+
+SDL_atomic_t frameRays;
+SDL_atomic_t frameSteps;
+SDL_atomic_t frameMaxSteps;
+SDL_atomic_t frameLength;       /* Whole world units */
+SDL_atomic_t frameMaxLength;
+SDL_atomic_t cellVisits[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+
+
+void atomicMax(SDL_atomic_t* a, int value) {
+    int old;
+
+    do {
+        old = SDL_AtomicGet(a);
+        if(old >= value)
+            return;
+    } while(!SDL_AtomicCAS(a, old, value));
+}
+
+void recordCellVisit(int mapx, int mapy) {
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return;
+    SDL_AtomicAdd(&cellVisits[mapy][mapx], 1);
+}
+
+void recordRay(int steps, const RayTuple* ray) {
+    int length = (int)(sqrt(MIN(vec2LengthSquared(ray->vRay), vec2LengthSquared(ray->hRay))) + 0.5f);
+
+    SDL_AtomicAdd(&frameRays, 1);
+    SDL_AtomicAdd(&frameSteps, steps);
+    SDL_AtomicAdd(&frameLength, length);
+    atomicMax(&frameMaxSteps, steps);
+    atomicMax(&frameMaxLength, length);
+}
+
+void beginRayTelemetryFrame() {
+    RayTelemetry* frame = &lastFrameTelemetry;
+
+    frame->rays = SDL_AtomicSet(&frameRays, 0);
+    frame->steps = SDL_AtomicSet(&frameSteps, 0);
+    frame->totalLength = SDL_AtomicSet(&frameLength, 0);
+    frame->maxSteps = SDL_AtomicSet(&frameMaxSteps, 0);
+    frame->maxLength = SDL_AtomicSet(&frameMaxLength, 0);
+    if(!frame->rays)
+        return;
+
+    telemetryFrames++;
+    sessionTelemetry.rays += frame->rays;
+    sessionTelemetry.steps += frame->steps;
+    sessionTelemetry.totalLength += frame->totalLength;
+    sessionTelemetry.maxSteps = MAX(sessionTelemetry.maxSteps, frame->maxSteps);
+    sessionTelemetry.maxLength = MAX(sessionTelemetry.maxLength, frame->maxLength);
+}
+
+void clearRayTelemetry() {
+    int row, col;
+
+    for(row = 0; row < MAP_GRID_HEIGHT; row++)
+        for(col = 0; col < MAP_GRID_WIDTH; col++)
+            SDL_AtomicSet(&cellVisits[row][col], 0);
+    memset(&sessionTelemetry, 0, sizeof(sessionTelemetry));
+    telemetryFrames = 0;
+}
+
+int getCellVisits(int mapx, int mapy) {
+    return SDL_AtomicGet(&cellVisits[mapy][mapx]);
+}
+
+int getMaxCellVisits() {
+    int row, col, most = 0;
+
+    for(row = 0; row < MAP_GRID_HEIGHT; row++)
+        for(col = 0; col < MAP_GRID_WIDTH; col++)
+            most = MAX(most, getCellVisits(col, row));
+    return most;
+}
+
+void getHeatColor(int visits, int most, Uint8* r, Uint8* g, Uint8* b) {
+    /* Square root so that rarely visited cells still show up; black, red, yellow, white */
+    float heat = most > 0 ? sqrt(visits / (float)most) * 3.0f : 0.0f;
+
+    *r = (Uint8)(MIN(heat, 1.0f) * 255);
+    *g = (Uint8)(MIN(MAX(heat - 1.0f, 0.0f), 1.0f) * 255);
+    *b = (Uint8)(MIN(MAX(heat - 2.0f, 0.0f), 1.0f) * 255);
+}
+
+void drawRayHeatmap() {
+    float size = (float)HUD_MAP_SIZE / (float)MAP_GRID_WIDTH;
+    int mapXOffset = (WINDOW_WIDTH - HUD_MAP_SIZE) / 2;
+    int mapYOffset = (WINDOW_HEIGHT - HUD_MAP_SIZE) / 2;
+    int most = getMaxCellVisits();
+    int row, col, visits;
+    Uint8 r, g, b;
+
+    setDrawBlending(TRUE);
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            visits = getCellVisits(col, row);
+            if(!visits)
+                continue;
+            getHeatColor(visits, most, &r, &g, &b);
+            setDrawColor(r, g, b, RAY_HEATMAP_ALPHA);
+            fillRect((int)(col * size) + mapXOffset, (int)(row * size) + mapYOffset, (int)size, (int)size);
+        }
+    }
+    setDrawBlending(FALSE);
+}
+
+int writeRayHeatmapPPM(FILE* file) {
+    int x, y;
+    Uint8 pixel[3];
+    int most = getMaxCellVisits();
+
+    fprintf(file, "P6\n%d %d\n255\n", MAP_GRID_WIDTH * RAY_HEATMAP_CELL_PIXELS, MAP_GRID_HEIGHT * RAY_HEATMAP_CELL_PIXELS);
+    for(y = 0; y < MAP_GRID_HEIGHT * RAY_HEATMAP_CELL_PIXELS; y++) {
+        for(x = 0; x < MAP_GRID_WIDTH * RAY_HEATMAP_CELL_PIXELS; x++) {
+            getHeatColor(getCellVisits(x / RAY_HEATMAP_CELL_PIXELS, y / RAY_HEATMAP_CELL_PIXELS), most, &pixel[0], &pixel[1], &pixel[2]);
+            if(fwrite(pixel, 1, 3, file) != 3)
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+int writeRayHeatmapCSV(FILE* file) {
+    int row, col;
+
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++)
+            fprintf(file, col ? ",%d" : "%d", getCellVisits(col, row));
+        fprintf(file, "\n");
+    }
+    return !ferror(file);
+}
+
+int writeRayHeatmap(const char* path) {
+    size_t length = strlen(path);
+    FILE* file = fopen(path, "wb");
+    int ok;
+
+    if(!file)
+        return FALSE;
+
+    if(length >= 4 && !strcmp(path + length - 4, ".csv"))
+        ok = writeRayHeatmapCSV(file);
+    else
+        ok = writeRayHeatmapPPM(file);
+
+    return fclose(file) == 0 && ok;
+}
+
+void printRayTelemetry() {
+    const RayTelemetry* s = &sessionTelemetry;
+
+    if(!s->rays) return;
+
+    fprintf(stderr, "Rays:   %ld over %ld frames\n", s->rays, telemetryFrames);
+    fprintf(stderr, "Steps:  avg %.2f cells/ray, max %ld cells/ray, avg %.0f cells/frame\n",
+            s->steps / (double)s->rays, s->maxSteps, s->steps / (double)telemetryFrames);
+    fprintf(stderr, "Length: avg %.1f, max %ld\n", s->totalLength / (double)s->rays, s->maxLength);
+}
+
+#endif
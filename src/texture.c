@@ -0,0 +1,79 @@
+#include "header/main.h"
+
+/* Globals */
+int textureMipLevels = 0;
+int textureMipOffsets[MAX_TEXTURE_MIP_LEVELS];
+int textureChainLength = 0;
+
+
+void initMipLayout() {
+    int size;
+
+    textureMipLevels = 0;
+    textureChainLength = 0;
+
+    /* Levels are stored largest first, each one directly after the last */
+    for(size = TEXTURE_SIZE; size > 0 && textureMipLevels < MAX_TEXTURE_MIP_LEVELS; size >>= 1) {
+        textureMipOffsets[textureMipLevels++] = textureChainLength;
+        textureChainLength += size * size;
+    }
+}
+
+Uint32 averageTexels(Uint32 c1, Uint32 c2, Uint32 c3, Uint32 c4) {
+    Uint32 result = 0;
+    int shift;
+
+    for(shift = 0; shift < 32; shift += 8) {
+        Uint32 sum = ((c1 >> shift) & 0xFF) + ((c2 >> shift) & 0xFF) + ((c3 >> shift) & 0xFF) + ((c4 >> shift) & 0xFF);
+        result |= ((sum + 2) >> 2) << shift;
+    }
+
+    return result;
+}
+
+Uint32* createMipChain(TextureSet set, const Uint32* texture) {
+    int level, x, y, size;
+    Uint32* src;
+    Uint32* dst;
+    Uint32* chain;
+
+    if(!textureMipLevels) initMipLayout();
+
+    chain = allocTextureMemory(set, textureChainLength * sizeof(Uint32)); if(!chain) { return NULL; }
+
+    for(x = 0; x < TEXTURE_SIZE * TEXTURE_SIZE; x++)
+        chain[x] = texture[x];
+
+    /* Box filter each level down from the one above it */
+    for(level = 1; level < textureMipLevels; level++) {
+        size = TEXTURE_SIZE >> level;
+        src = chain + textureMipOffsets[level - 1];
+        dst = chain + textureMipOffsets[level];
+
+        for(x = 0; x < size; x++) {
+            for(y = 0; y < size; y++) {
+                dst[(x * size) + y] = averageTexels(
+                    src[(2 * x * 2 * size) + (2 * y)],
+                    src[(2 * x * 2 * size) + (2 * y + 1)],
+                    src[((2 * x + 1) * 2 * size) + (2 * y)],
+                    src[((2 * x + 1) * 2 * size) + (2 * y + 1)]);
+            }
+        }
+    }
+
+    return chain;
+}
+
+void destroyMipChain(void* chain) {
+    destroyTexture(chain);
+}
+
+int selectMipLevel(float length) {
+    int level = 0;
+
+    /* Use the largest level which still has at least one texel per pixel */
+    while(level + 1 < textureMipLevels && (float)(TEXTURE_SIZE >> (level + 1)) >= length)
+        level++;
+
+    return level;
+}
@@ -0,0 +1,388 @@
+#include <string.h>
+
+#include "header/main.h"
+
+/*
+ * Potentially visible sets. The open cells of the map are split into
+ * rooms, greedy rectangles which are convex, so a straight line can
+ * only pass through each once. Every door cell is a room of its own.
+ * Rooms next to each other are joined by portals, the stretches of
+ * cell edge they share.
+ *
+ * A room is visible from a cell if a line through the cell stabs every
+ * portal on some chain of rooms leading to it. Crossing a portal in a
+ * given direction puts one end of it on the line's left and the other
+ * on its right, and a line through the whole chain exists exactly when
+ * all the left ends can be split from all the right ends by a line.
+ * The cell itself is stabbed through one of its diagonals. Points on
+ * the line count as either side, so lines grazing a corner are kept
+ * and the sets never miss anything that can be seen.
+ *
+ * All coordinates are whole cells, so the tests are exact integer
+ * arithmetic.
+ *
+ * Closed doors stop the flow but are visible themselves. Any cell which
+ * sees through a door also sees the door, so when a door opens or shuts
+ * only the cells with the door's room in their set are rebuilt. Any
+ * other change to the map splits it into rooms again.
+ */
+
+/* Datatypes */
+typedef struct {
+    int x, y;               /* Top-left cell */
+    int w, h;               /* Size in cells */
+    char door;
+    int firstPortal;        /* Portals leading out of the room */
+    int portalCount;
+} VisibilityRoom;
+
+typedef struct {
+    int leftX, leftY;       /* The end on the left of a line crossing it outwards */
+    int rightX, rightY;
+    int to;                 /* The room on the other side */
+} VisibilityPortal;
+
+/* The chain of portals a line has to stab to reach the room being flowed through */
+typedef struct {
+    int count;
+    int leftX[PVS_MAX_ROOMS + 1], leftY[PVS_MAX_ROOMS + 1];
+    int rightX[PVS_MAX_ROOMS + 1], rightY[PVS_MAX_ROOMS + 1];
+    Uint8 onPath[PVS_MAX_ROOMS];
+    Uint32* bits;
+} VisibilityChain;
+
+#define CELL_OPAQUE       0
+#define CELL_OPEN         1
+#define CELL_CLOSED_DOOR  2
+#define CELL_OPEN_DOOR    3
+
+/* Globals */
+char visibilityEnabled = FALSE;
+int visibilityRoomCount = 0;
+VisibilityRoom visibilityRooms[PVS_MAX_ROOMS];
+VisibilityPortal visibilityPortals[4 * MAP_GRID_WIDTH * MAP_GRID_HEIGHT];
+int visibilityPortalCount = 0;
+Sint16 cellRoom[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];   /* -1 for opaque cells */
+Uint8 cellKind[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];    /* As of the last rebuild */
+Uint32 cellVisibleRooms[MAP_GRID_HEIGHT][MAP_GRID_WIDTH][PVS_WORDS];
+Uint8 visibilityDirty[MAP_GRID_HEIGHT][MAP_GRID_WIDTH];
+int visibilityDirtyTop = MAP_GRID_HEIGHT;
+int visibilityDirtyBottom = -1;
+
+
+int getCellKind(int mapx, int mapy) {
+    short tile;
+
+    /* The same border isSolidTile keeps */
+    if(!(mapx > 0 && mapy > 0 && mapx < MAP_GRID_WIDTH && mapy < MAP_GRID_HEIGHT))
+        return CELL_OPAQUE;
+    tile = MAP[mapy][mapx];
+
+    /* Any gap in a door can be seen through */
+    if(tile > 0 && TILE_MATERIAL(tile) == D)
+        return (doorOpenAmount[mapy][mapx] > 0 || (tile & SEE_THROUGH)) ? CELL_OPEN_DOOR : CELL_CLOSED_DOOR;
+    return (tile > 0 && !(tile & SEE_THROUGH)) ? CELL_OPAQUE : CELL_OPEN;
+}
+
+int isOpenRoomCell(int mapx, int mapy) {
+    return cellKind[mapy][mapx] == CELL_OPEN && cellRoom[mapy][mapx] < 0;
+}
+
+int addVisibilityRoom(int x, int y, int w, int h, char door) {
+    VisibilityRoom* room;
+    int row, col;
+
+    if(visibilityRoomCount == PVS_MAX_ROOMS)
+        return FALSE;
+
+    room = &visibilityRooms[visibilityRoomCount];
+    room->x = x;
+    room->y = y;
+    room->w = w;
+    room->h = h;
+    room->door = door;
+    for(row = y; row < y + h; row++)
+        for(col = x; col < x + w; col++)
+            cellRoom[row][col] = visibilityRoomCount;
+    visibilityRoomCount++;
+    return TRUE;
+}
+
+int partitionRooms() {
+    int row, col, w, h, i;
+
+    visibilityRoomCount = 0;
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            cellKind[row][col] = getCellKind(col, row);
+            cellRoom[row][col] = -1;
+        }
+    }
+
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            if(cellKind[row][col] == CELL_CLOSED_DOOR || cellKind[row][col] == CELL_OPEN_DOOR) {
+                if(!addVisibilityRoom(col, row, 1, 1, TRUE))
+                    return FALSE;
+                continue;
+            }
+            if(!isOpenRoomCell(col, row))
+                continue;
+
+            /* As wide as the row allows, then as deep as every row below stays open */
+            for(w = 1; col + w < MAP_GRID_WIDTH && isOpenRoomCell(col + w, row); w++);
+            for(h = 1; row + h < MAP_GRID_HEIGHT; h++) {
+                for(i = 0; i < w && isOpenRoomCell(col + i, row + h); i++);
+                if(i < w)
+                    break;
+            }
+            if(!addVisibilityRoom(col, row, w, h, FALSE))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void addVisibilityPortal(int ax, int ay, int bx, int by, int normalX, int normalY, int to) {
+    VisibilityPortal* portal = &visibilityPortals[visibilityPortalCount++];
+
+    /* Left of a line heading along the normal */
+    if(normalX * (by - ay) - normalY * (bx - ax) > 0) {
+        portal->leftX = bx;
+        portal->leftY = by;
+        portal->rightX = ax;
+        portal->rightY = ay;
+    } else {
+        portal->leftX = ax;
+        portal->leftY = ay;
+        portal->rightX = bx;
+        portal->rightY = by;
+    }
+    portal->to = to;
+}
+
+void addRoomSidePortals(const VisibilityRoom* room, int face) {
+    int normalX = FACE_NORMALS[face][0], normalY = FACE_NORMALS[face][1];
+    int length = normalX ? room->h : room->w;
+    int i, start, mapx, mapy, neighbour, runRoom = -1;
+
+    /* The cells just outside the side, in runs of the same room */
+    for(i = 0, start = 0; i <= length; i++) {
+        neighbour = -1;
+        if(i < length) {
+            mapx = normalX ? (normalX > 0 ? room->x + room->w : room->x - 1) : room->x + i;
+            mapy = normalY ? (normalY > 0 ? room->y + room->h : room->y - 1) : room->y + i;
+            if(mapx >= 0 && mapy >= 0 && mapx < MAP_GRID_WIDTH && mapy < MAP_GRID_HEIGHT)
+                neighbour = cellRoom[mapy][mapx];
+        }
+        if(neighbour == runRoom)
+            continue;
+
+        if(runRoom >= 0) {
+            if(normalX)
+                addVisibilityPortal(room->x + (normalX > 0 ? room->w : 0), room->y + start, room->x + (normalX > 0 ? room->w : 0), room->y + i, normalX, normalY, runRoom);
+            else
+                addVisibilityPortal(room->x + start, room->y + (normalY > 0 ? room->h : 0), room->x + i, room->y + (normalY > 0 ? room->h : 0), normalX, normalY, runRoom);
+        }
+        runRoom = neighbour;
+        start = i;
+    }
+}
+
+void findPortals() {
+    VisibilityRoom* room;
+    int i, face;
+
+    visibilityPortalCount = 0;
+    for(i = 0; i < visibilityRoomCount; i++) {
+        room = &visibilityRooms[i];
+        room->firstPortal = visibilityPortalCount;
+        for(face = 0; face < 4; face++)
+            addRoomSidePortals(room, face);
+        room->portalCount = visibilityPortalCount - room->firstPortal;
+    }
+}
+
+int isChainStabbed(const VisibilityChain* chain) {
+    int points = chain->count * 2;
+    int i, j, k, px, py, dx, dy, ok;
+
+    /* If the ends can be split at all, a line through two of them splits them */
+    for(i = 0; i < points; i++) {
+        px = (i & 1) ? chain->rightX[i >> 1] : chain->leftX[i >> 1];
+        py = (i & 1) ? chain->rightY[i >> 1] : chain->leftY[i >> 1];
+        for(j = 0; j < points; j++) {
+            dx = ((j & 1) ? chain->rightX[j >> 1] : chain->leftX[j >> 1]) - px;
+            dy = ((j & 1) ? chain->rightY[j >> 1] : chain->leftY[j >> 1]) - py;
+            if(!dx && !dy)
+                continue;
+
+            ok = TRUE;
+            for(k = 0; k < chain->count && ok; k++) {
+                ok = dx * (chain->leftY[k] - py) - dy * (chain->leftX[k] - px) >= 0 &&
+                     dx * (chain->rightY[k] - py) - dy * (chain->rightX[k] - px) <= 0;
+            }
+            if(ok)
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+int isRoomClosed(int room) {
+    const VisibilityRoom* r = &visibilityRooms[room];
+    return r->door && cellKind[r->y][r->x] == CELL_CLOSED_DOOR;
+}
+
+void flowThroughRoom(VisibilityChain* chain, int room) {
+    const VisibilityRoom* r = &visibilityRooms[room];
+    const VisibilityPortal* portal;
+    int i, n = chain->count;
+
+    for(i = 0; i < r->portalCount; i++) {
+        portal = &visibilityPortals[r->firstPortal + i];
+        if(chain->onPath[portal->to])
+            continue;
+
+        chain->leftX[n] = portal->leftX;
+        chain->leftY[n] = portal->leftY;
+        chain->rightX[n] = portal->rightX;
+        chain->rightY[n] = portal->rightY;
+        chain->count = n + 1;
+        if(isChainStabbed(chain)) {
+            chain->bits[portal->to >> 5] |= 1u << (portal->to & 31);
+            if(!isRoomClosed(portal->to)) {
+                chain->onPath[portal->to] = TRUE;
+                flowThroughRoom(chain, portal->to);
+                chain->onPath[portal->to] = FALSE;
+            }
+        }
+        chain->count = n;
+    }
+}
+
+void buildCellVisibility(int mapx, int mapy) {
+    VisibilityChain chain;
+    int room = cellRoom[mapy][mapx];
+    int diagonal;
+
+    memset(cellVisibleRooms[mapy][mapx], 0, sizeof(cellVisibleRooms[mapy][mapx]));
+    if(room < 0)
+        return;
+    cellVisibleRooms[mapy][mapx][room >> 5] |= 1u << (room & 31);
+    if(isRoomClosed(room))
+        return;
+
+    /* Any line through the cell splits the ends of one of its diagonals */
+    memset(chain.onPath, 0, sizeof(chain.onPath));
+    chain.onPath[room] = TRUE;
+    chain.bits = cellVisibleRooms[mapy][mapx];
+    for(diagonal = 0; diagonal < 4; diagonal++) {
+        chain.leftX[0] = mapx + ((diagonal == 1 || diagonal == 2) ? 1 : 0);
+        chain.leftY[0] = mapy + ((diagonal == 1 || diagonal == 3) ? 1 : 0);
+        chain.rightX[0] = 2 * mapx + 1 - chain.leftX[0];
+        chain.rightY[0] = 2 * mapy + 1 - chain.leftY[0];
+        chain.count = 1;
+        flowThroughRoom(&chain, room);
+    }
+}
+
+void buildVisibilityRows(int begin, int end, void* context) {
+    int row, col;
+    (void)context;
+
+    for(row = visibilityDirtyTop + begin; row < visibilityDirtyTop + end; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            if(!visibilityDirty[row][col])
+                continue;
+            buildCellVisibility(col, row);
+            visibilityDirty[row][col] = 0;
+        }
+    }
+}
+
+void markCellVisibilityDirty(int mapx, int mapy) {
+    visibilityDirty[mapy][mapx] = 1;
+    visibilityDirtyTop = MIN(visibilityDirtyTop, mapy);
+    visibilityDirtyBottom = MAX(visibilityDirtyBottom, mapy);
+}
+
+void buildDirtyVisibility() {
+    if(visibilityDirtyBottom < visibilityDirtyTop)
+        return;
+
+    parallelFor(visibilityDirtyBottom - visibilityDirtyTop + 1, 1, buildVisibilityRows, NULL);
+    visibilityDirtyTop = MAP_GRID_HEIGHT;
+    visibilityDirtyBottom = -1;
+}
+
+void rebuildVisibility() {
+    int row, col;
+
+    visibilityEnabled = partitionRooms();
+    if(!visibilityEnabled)
+        return;
+    findPortals();
+
+    for(row = 0; row < MAP_GRID_HEIGHT; row++)
+        for(col = 0; col < MAP_GRID_WIDTH; col++)
+            markCellVisibilityDirty(col, row);
+    buildDirtyVisibility();
+}
+
+void updateMapVisibility(const MapRegion* region, void* context) {
+    int row, col, kind, room, mapx, mapy;
+    char doorChanged = FALSE;
+    (void)context;
+
+    for(row = region->y; row < region->y + region->h; row++) {
+        for(col = region->x; col < region->x + region->w; col++) {
+            kind = getCellKind(col, row);
+            if(kind == cellKind[row][col])
+                continue;
+
+            /* Walls added or taken away change the rooms themselves */
+            if(kind == CELL_OPAQUE || kind == CELL_OPEN || cellKind[row][col] == CELL_OPAQUE || cellKind[row][col] == CELL_OPEN) {
+                rebuildVisibility();
+                return;
+            }
+
+            /* A door opening or shutting only matters to the cells which can see it */
+            cellKind[row][col] = kind;
+            if(!visibilityEnabled)
+                continue;
+            room = cellRoom[row][col];
+            for(mapy = 0; mapy < MAP_GRID_HEIGHT; mapy++)
+                for(mapx = 0; mapx < MAP_GRID_WIDTH; mapx++)
+                    if(cellVisibleRooms[mapy][mapx][room >> 5] & (1u << (room & 31)))
+                        markCellVisibilityDirty(mapx, mapy);
+            doorChanged = TRUE;
+        }
+    }
+
+    if(doorChanged)
+        buildDirtyVisibility();
+}
+
+void initVisibility() {
+    memset(visibilityDirty, 0, sizeof(visibilityDirty));
+    visibilityDirtyTop = MAP_GRID_HEIGHT;
+    visibilityDirtyBottom = -1;
+    rebuildVisibility();
+    addMapListener(updateMapVisibility, NULL);
+}
+
+int getCellRoom(int mapx, int mapy) {
+    if(mapx < 0 || mapy < 0 || mapx >= MAP_GRID_WIDTH || mapy >= MAP_GRID_HEIGHT)
+        return -1;
+    return cellRoom[mapy][mapx];
+}
+
+int isCellPotentiallyVisible(int fromx, int fromy, int tox, int toy) {
+    int room = getCellRoom(tox, toy);
+
+    /* Anything the sets don't cover is taken as visible */
+    if(!visibilityEnabled || room < 0 || getCellRoom(fromx, fromy) < 0)
+        return TRUE;
+    return (cellVisibleRooms[fromy][fromx][room >> 5] >> (room & 31)) & 1;
+}
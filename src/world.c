@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "header/main.h"
+
+/*
+ * World file layout (all multi-byte values little-endian):
+ *
+ *   "MZWD"  magic
+ *   Uint8   version
+ *   Uint8   cells along each side of a chunk
+ *   Uint16  unused
+ *   Uint32  width in chunks
+ *   Uint32  height in chunks
+ *   Uint32  spawn cell x
+ *   Uint32  spawn cell y
+ *   Uint64  offset of every chunk, row by row, then the end of the file
+ *   chunks...
+ *
+ * A chunk holds its cells row by row, run-length encoded as pairs of a
+ * Uint16 run length and a Sint16 tile.
+ */
+#define WORLD_MAGIC        "MZWD"
+#define WORLD_VERSION      1
+#define WORLD_HEADER_SIZE  24
+#define CHUNK_CELLS        (WORLD_CHUNK_SIZE * WORLD_CHUNK_SIZE)
+#define CHUNK_MAX_BYTES    (CHUNK_CELLS * 4)  /* Every run one cell long */
+
+#ifdef _WIN32
+#define seekWorldFile(F, O)  _fseeki64((F), (__int64)(O), SEEK_SET)
+#else
+#define seekWorldFile(F, O)  fseeko((F), (off_t)(O), SEEK_SET)
+#endif
+
+/*
+ * The chunk cache and its lookup table belong to the main thread. A
+ * load is handed to the loader thread as a slot index through one
+ * single-producer single-consumer ring and handed back through another,
+ * so the loader only ever touches the cells of the slot it was given.
+ */
+
+/* Datatypes */
+typedef struct {
+    short* cells;
+    Uint32 key;         /* Chunk index: y * worldChunksWide + x */
+    char state;         /* CHUNK_FREE, CHUNK_LOADING or CHUNK_READY */
+    char dirty;         /* Holds edits made through the map; kept resident */
+    Uint32 lastWanted;  /* worldTick the chunk was last wanted */
+} WorldChunk;
+
+typedef struct {
+    int slots[WORLD_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+} ChunkQueue;
+
+#define CHUNK_FREE     0
+#define CHUNK_LOADING  1
+#define CHUNK_READY    2
+
+/* Globals */
+int worldViewX = 0;
+int worldViewY = 0;
+FILE* worldFile = NULL;
+Uint32 worldChunksWide = 0;
+Uint32 worldChunksHigh = 0;
+Uint32 worldTick = 0;
+
+WorldChunk* worldChunks = NULL;
+short* worldChunkCells = NULL;
+int worldChunkCount = 0;
+int* chunkTable = NULL;     /* Slot of each resident or loading chunk, -1 if empty */
+Uint32 chunkTableMask = 0;
+
+ChunkQueue loadRequests;
+ChunkQueue loadedChunks;
+SDL_sem* loadRequested = NULL;
+SDL_Thread* loaderThread = NULL;
+SDL_atomic_t loaderQuit;
+
+long chunksLoaded = 0;
+long chunksEvicted = 0;
+long worldStalls = 0;
+
+
+/*========================================================
+ * File helpers
+ *========================================================
+ */
+
+void putU16(Uint8* out, Uint32 value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+}
+
+void putU32(Uint8* out, Uint32 value) {
+    putU16(out, value & 0xFFFF);
+    putU16(out + 2, value >> 16);
+}
+
+void putU64(Uint8* out, Uint64 value) {
+    putU32(out, (Uint32)value);
+    putU32(out + 4, (Uint32)(value >> 32));
+}
+
+Uint32 getU16(const Uint8* in) {
+    return in[0] | (in[1] << 8);
+}
+
+Uint32 getU32(const Uint8* in) {
+    return getU16(in) | (getU16(in + 2) << 16);
+}
+
+Uint64 getU64(const Uint8* in) {
+    return getU32(in) | ((Uint64)getU32(in + 4) << 32);
+}
+
+int encodeChunk(const short* cells, Uint8* out) {
+    int i = 0, run, size = 0;
+
+    while(i < CHUNK_CELLS) {
+        for(run = 1; i + run < CHUNK_CELLS && cells[i + run] == cells[i]; run++);
+        putU16(out + size, run);
+        putU16(out + size + 2, (Uint16)cells[i]);
+        size += 4;
+        i += run;
+    }
+    return size;
+}
+
+int decodeChunk(const Uint8* in, int size, short* cells) {
+    int i = 0, run, pos;
+
+    for(pos = 0; pos + 4 <= size; pos += 4) {
+        run = getU16(in + pos);
+        if(run > CHUNK_CELLS - i)
+            return FALSE;
+        while(run--)
+            cells[i++] = (short)getU16(in + pos + 2);
+    }
+    return i == CHUNK_CELLS && pos == size;
+}
+
+
+/*========================================================
+ * Loader thread
+ *========================================================
+ */
+
+int pushChunkQueue(ChunkQueue* queue, int slot) {
+    int head = SDL_AtomicGet(&queue->head);
+
+    if(head - SDL_AtomicGet(&queue->tail) >= WORLD_QUEUE_SIZE)
+        return FALSE;
+    queue->slots[head % WORLD_QUEUE_SIZE] = slot;
+    SDL_AtomicAdd(&queue->head, 1);
+    return TRUE;
+}
+
+int popChunkQueue(ChunkQueue* queue, int* slot) {
+    int tail = SDL_AtomicGet(&queue->tail);
+
+    if(tail == SDL_AtomicGet(&queue->head))
+        return FALSE;
+    *slot = queue->slots[tail % WORLD_QUEUE_SIZE];
+    SDL_AtomicAdd(&queue->tail, 1);
+    return TRUE;
+}
+
+int readChunk(Uint32 key, Uint8* buffer, short* cells) {
+    Uint8 offsets[16];
+    Uint64 start, end;
+
+    if(seekWorldFile(worldFile, WORLD_HEADER_SIZE + (Uint64)key * 8) || fread(offsets, 1, 16, worldFile) != 16)
+        return FALSE;
+    start = getU64(offsets);
+    end = getU64(offsets + 8);
+    if(end < start || end - start > CHUNK_MAX_BYTES)
+        return FALSE;
+    if(seekWorldFile(worldFile, start) || fread(buffer, 1, end - start, worldFile) != end - start)
+        return FALSE;
+    return decodeChunk(buffer, (int)(end - start), cells);
+}
+
+int worldLoaderMain(void* data) {
+    static Uint8 buffer[CHUNK_MAX_BYTES];
+    WorldChunk* chunk;
+    int slot, i;
+    (void)data;
+
+    for(;;) {
+        SDL_SemWait(loadRequested);
+        while(popChunkQueue(&loadRequests, &slot)) {
+            chunk = &worldChunks[slot];
+
+            /* A chunk which can't be read is walled off rather than retried */
+            if(!readChunk(chunk->key, buffer, chunk->cells)) {
+                fprintf(stderr, "Could not read world chunk %u!\n", (unsigned)chunk->key);
+                for(i = 0; i < CHUNK_CELLS; i++)
+                    chunk->cells[i] = R;
+            }
+
+            /* The queue has room: it holds no more than the loads in flight */
+            pushChunkQueue(&loadedChunks, slot);
+        }
+        if(SDL_AtomicGet(&loaderQuit))
+            return 0;
+    }
+}
+
+
+/*========================================================
+ * Chunk cache
+ *========================================================
+ */
+
+Uint32 hashChunkKey(Uint32 key) {
+    return (key * 2654435761u) & chunkTableMask;
+}
+
+int findChunkSlot(Uint32 key) {
+    Uint32 i;
+
+    for(i = hashChunkKey(key); chunkTable[i] >= 0; i = (i + 1) & chunkTableMask)
+        if(worldChunks[chunkTable[i]].key == key)
+            return chunkTable[i];
+    return -1;
+}
+
+void insertChunkSlot(int slot) {
+    Uint32 i;
+
+    for(i = hashChunkKey(worldChunks[slot].key); chunkTable[i] >= 0; i = (i + 1) & chunkTableMask);
+    chunkTable[i] = slot;
+}
+
+void removeChunkSlot(int slot) {
+    Uint32 i, j, home;
+
+    for(i = hashChunkKey(worldChunks[slot].key); chunkTable[i] != slot; i = (i + 1) & chunkTableMask);
+
+    /* Pull later entries of the probe run back over the hole so lookups never stop early */
+    for(j = (i + 1) & chunkTableMask; chunkTable[j] >= 0; j = (j + 1) & chunkTableMask) {
+        home = hashChunkKey(worldChunks[chunkTable[j]].key);
+        if(((j - home) & chunkTableMask) >= ((j - i) & chunkTableMask)) {
+            chunkTable[i] = chunkTable[j];
+            i = j;
+        }
+    }
+    chunkTable[i] = -1;
+}
+
+int findFreeChunkSlot() {
+    int i, oldest = -1;
+
+    for(i = 0; i < worldChunkCount; i++) {
+        if(worldChunks[i].state == CHUNK_FREE)
+            return i;
+        if(worldChunks[i].state == CHUNK_READY && !worldChunks[i].dirty && worldChunks[i].lastWanted != worldTick
+            && (oldest < 0 || worldChunks[i].lastWanted < worldChunks[oldest].lastWanted))
+            oldest = i;
+    }
+
+    if(oldest >= 0) {
+        removeChunkSlot(oldest);
+        worldChunks[oldest].state = CHUNK_FREE;
+        chunksEvicted++;
+    }
+    return oldest;
+}
+
+void takeLoadedChunks() {
+    int slot;
+
+    while(popChunkQueue(&loadedChunks, &slot)) {
+        worldChunks[slot].state = CHUNK_READY;
+        chunksLoaded++;
+    }
+}
+
+WorldChunk* wantChunk(int cx, int cy) {
+    Uint32 key;
+    int slot;
+
+    if(cx < 0 || cy < 0 || (Uint32)cx >= worldChunksWide || (Uint32)cy >= worldChunksHigh)
+        return NULL;
+
+    key = (Uint32)cy * worldChunksWide + cx;
+    slot = findChunkSlot(key);
+    if(slot < 0) {
+        if(SDL_AtomicGet(&loadRequests.head) - SDL_AtomicGet(&loadedChunks.tail) >= WORLD_QUEUE_SIZE)
+            return NULL;
+        if((slot = findFreeChunkSlot()) < 0)
+            return NULL;
+
+        worldChunks[slot].key = key;
+        worldChunks[slot].state = CHUNK_LOADING;
+        worldChunks[slot].dirty = FALSE;
+        insertChunkSlot(slot);
+        pushChunkQueue(&loadRequests, slot);
+        SDL_SemPost(loadRequested);
+    }
+
+    worldChunks[slot].lastWanted = worldTick;
+    return worldChunks[slot].state == CHUNK_READY ? &worldChunks[slot] : NULL;
+}
+
+int wantRegionChunks(int x1, int y1, int x2, int y2) {
+    int cx, cy, ready = TRUE;
+
+    /* Cells off the world need no chunk */
+    x1 = MAX(x1, 0);
+    y1 = MAX(y1, 0);
+    x2 = MIN(x2, (int)(worldChunksWide * WORLD_CHUNK_SIZE) - 1);
+    y2 = MIN(y2, (int)(worldChunksHigh * WORLD_CHUNK_SIZE) - 1);
+
+    for(cy = y1 / WORLD_CHUNK_SIZE; y1 <= y2 && cy <= y2 / WORLD_CHUNK_SIZE; cy++)
+        for(cx = x1 / WORLD_CHUNK_SIZE; x1 <= x2 && cx <= x2 / WORLD_CHUNK_SIZE; cx++)
+            ready &= wantChunk(cx, cy) != NULL;
+    return ready;
+}
+
+int wantWindowChunks(int viewx, int viewy) {
+    return wantRegionChunks(viewx, viewy, viewx + MAP_GRID_WIDTH - 1, viewy + MAP_GRID_HEIGHT - 1);
+}
+
+void prefetchAlong(Vector2f from, Vector2f dir) {
+    float dist;
+    Vector2f p;
+
+    for(dist = 0; dist <= WORLD_PREFETCH_DISTANCE; dist += WORLD_CHUNK_SIZE / 2) {
+        p = vec2Add(from, vec2Scale(dir, dist));
+        if(p.x >= 0 && p.y >= 0)
+            wantChunk((int)p.x / WORLD_CHUNK_SIZE, (int)p.y / WORLD_CHUNK_SIZE);
+    }
+}
+
+
+/*========================================================
+ * Map window
+ *========================================================
+ */
+
+short* getWorldCell(int wx, int wy) {
+    int slot;
+
+    if(wx < 0 || wy < 0 || (Uint32)wx >= worldChunksWide * WORLD_CHUNK_SIZE || (Uint32)wy >= worldChunksHigh * WORLD_CHUNK_SIZE)
+        return NULL;
+
+    slot = findChunkSlot((Uint32)(wy / WORLD_CHUNK_SIZE) * worldChunksWide + wx / WORLD_CHUNK_SIZE);
+    if(slot < 0 || worldChunks[slot].state != CHUNK_READY)
+        return NULL;
+    return &worldChunks[slot].cells[(wy % WORLD_CHUNK_SIZE) * WORLD_CHUNK_SIZE + wx % WORLD_CHUNK_SIZE];
+}
+
+void storeMapWindow() {
+    int row, col;
+    short* cell;
+
+    /* Keep edits (pushed walls, changed cells) for when the player comes back */
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            cell = getWorldCell(worldViewX + col, worldViewY + row);
+            if(cell && *cell != MAP[row][col]) {
+                *cell = MAP[row][col];
+                worldChunks[findChunkSlot((Uint32)((worldViewY + row) / WORLD_CHUNK_SIZE) * worldChunksWide + (worldViewX + col) / WORLD_CHUNK_SIZE)].dirty = TRUE;
+            }
+        }
+    }
+}
+
+void loadMapWindow(int viewx, int viewy) {
+    int row, col;
+    short* cell;
+
+    for(row = 0; row < MAP_GRID_HEIGHT; row++) {
+        for(col = 0; col < MAP_GRID_WIDTH; col++) {
+            cell = getWorldCell(viewx + col, viewy + row);
+            MAP[row][col] = cell ? *cell : R;
+        }
+    }
+}
+
+void waitForWindowChunks(int viewx, int viewy) {
+    while(!wantWindowChunks(viewx, viewy)) {
+        SDL_Delay(1);
+        takeLoadedChunks();
+    }
+}
+
+void moveMapWindow(int viewx, int viewy) {
+    int dx = viewx - worldViewX;
+    int dy = viewy - worldViewY;
+
+    /* Normally prefetched already; waiting keeps the window complete (and replays repeatable) */
+    if(!wantWindowChunks(viewx, viewy)) {
+        worldStalls++;
+        waitForWindowChunks(viewx, viewy);
+    }
+
+    storeMapWindow();
+    loadMapWindow(viewx, viewy);
+    shiftMapState(dx, dy);
+    worldViewX = viewx;
+    worldViewY = viewy;
+
+    playerPos.x -= dx * WALL_SIZE;
+    playerPos.y -= dy * WALL_SIZE;
+    markMapRegionChanged(0, 0, MAP_GRID_WIDTH, MAP_GRID_HEIGHT);
+}
+
+
+/*========================================================
+ * World
+ *========================================================
+ */
+
+int openWorld(const char* path) {
+    Uint8 header[WORLD_HEADER_SIZE];
+    Uint32 spawnx, spawny, tableSize;
+    int i, windowChunks;
+
+    if(worldFile) return FALSE;
+
+    worldFile = fopen(path, "rb");
+    if(!worldFile) return FALSE;
+
+    if(fread(header, 1, WORLD_HEADER_SIZE, worldFile) != WORLD_HEADER_SIZE || memcmp(header, WORLD_MAGIC, 4)
+        || header[4] != WORLD_VERSION || header[5] != WORLD_CHUNK_SIZE) {
+        fclose(worldFile);
+        worldFile = NULL;
+        return FALSE;
+    }
+    worldChunksWide = getU32(header + 8);
+    worldChunksHigh = getU32(header + 12);
+    spawnx = getU32(header + 16);
+    spawny = getU32(header + 20);
+
+    /* Never less than the chunks around the map which are kept every tick */
+    windowChunks = ((MAP_GRID_WIDTH + 2 * WORLD_RECENTER_DISTANCE + 2) / WORLD_CHUNK_SIZE + 2)
+                 * ((MAP_GRID_HEIGHT + 2 * WORLD_RECENTER_DISTANCE + 2) / WORLD_CHUNK_SIZE + 2);
+    worldChunkCount = MAX(WORLD_CACHE_BUDGET / (int)(CHUNK_CELLS * sizeof(short)), windowChunks + WORLD_QUEUE_SIZE);
+    for(tableSize = 1; tableSize < 2 * (Uint32)worldChunkCount; tableSize <<= 1);
+    chunkTableMask = tableSize - 1;
+
+    worldChunks = calloc(worldChunkCount, sizeof(WorldChunk));
+    worldChunkCells = malloc((size_t)worldChunkCount * CHUNK_CELLS * sizeof(short));
+    chunkTable = malloc(tableSize * sizeof(int));
+    loadRequested = SDL_CreateSemaphore(0);
+    if(!worldChunks || !worldChunkCells || !chunkTable || !loadRequested) {
+        closeWorld();
+        return FALSE;
+    }
+    for(i = 0; i < worldChunkCount; i++)
+        worldChunks[i].cells = &worldChunkCells[(size_t)i * CHUNK_CELLS];
+    for(i = 0; i < (int)tableSize; i++)
+        chunkTable[i] = -1;
+
+    SDL_AtomicSet(&loadRequests.head, 0);
+    SDL_AtomicSet(&loadRequests.tail, 0);
+    SDL_AtomicSet(&loadedChunks.head, 0);
+    SDL_AtomicSet(&loadedChunks.tail, 0);
+    SDL_AtomicSet(&loaderQuit, FALSE);
+    loaderThread = SDL_CreateThread(worldLoaderMain, "worldLoader", NULL);
+    if(!loaderThread) {
+        closeWorld();
+        return FALSE;
+    }
+
+    /* Start with the spawn point in the middle of the map */
+    worldViewX = (int)spawnx - MAP_GRID_WIDTH / 2;
+    worldViewY = (int)spawny - MAP_GRID_HEIGHT / 2;
+    waitForWindowChunks(worldViewX, worldViewY);
+    loadMapWindow(worldViewX, worldViewY);
+    shiftMapState(MAP_GRID_WIDTH, MAP_GRID_HEIGHT);  /* No door or mover of the old map carries over */
+    playerPos.x = (spawnx - worldViewX + 0.5f) * WALL_SIZE;
+    playerPos.y = (spawny - worldViewY + 0.5f) * WALL_SIZE;
+    markMapRegionChanged(0, 0, MAP_GRID_WIDTH, MAP_GRID_HEIGHT);
+
+    return TRUE;
+}
+
+void updateWorld() {
+    Camera camera;
+    Vector2f pos;
+    int cellx, celly;
+
+    if(!worldFile) return;
+
+    worldTick++;
+    takeLoadedChunks();
+
+    /*
+     * Keep what the map shows and whatever the next window could take
+     * in, whichever way the player goes; then load further ahead along
+     * the view and its edges.
+     */
+    wantWindowChunks(worldViewX, worldViewY);
+    wantRegionChunks(worldViewX - WORLD_RECENTER_DISTANCE - 1, worldViewY - WORLD_RECENTER_DISTANCE - 1,
+            worldViewX + MAP_GRID_WIDTH + WORLD_RECENTER_DISTANCE, worldViewY + MAP_GRID_HEIGHT + WORLD_RECENTER_DISTANCE);
+    getPlayerCamera(&camera);
+    pos = vec2(worldViewX + playerPos.x / WALL_SIZE, worldViewY + playerPos.y / WALL_SIZE);
+    prefetchAlong(pos, camera.dir);
+    prefetchAlong(pos, cameraRayDirection(&camera, 0, WINDOW_WIDTH));
+    prefetchAlong(pos, cameraRayDirection(&camera, WINDOW_WIDTH - 1, WINDOW_WIDTH));
+
+    cellx = (int)(playerPos.x / WALL_SIZE);
+    celly = (int)(playerPos.y / WALL_SIZE);
+    if(abs(cellx - MAP_GRID_WIDTH / 2) > WORLD_RECENTER_DISTANCE || abs(celly - MAP_GRID_HEIGHT / 2) > WORLD_RECENTER_DISTANCE)
+        moveMapWindow(worldViewX + cellx - MAP_GRID_WIDTH / 2, worldViewY + celly - MAP_GRID_HEIGHT / 2);
+}
+
+void closeWorld() {
+    if(loaderThread) {
+        SDL_AtomicSet(&loaderQuit, TRUE);
+        SDL_SemPost(loadRequested);
+        SDL_WaitThread(loaderThread, NULL);
+        fprintf(stderr, "World: %ld chunks loaded, %ld evicted, %ld stalls\n", chunksLoaded, chunksEvicted, worldStalls);
+    }
+    if(loadRequested) SDL_DestroySemaphore(loadRequested);
+    if(worldFile) fclose(worldFile);
+    free(worldChunks);
+    free(worldChunkCells);
+    free(chunkTable);
+
+    loaderThread = NULL;
+    loadRequested = NULL;
+    worldFile = NULL;
+    worldChunks = NULL;
+    worldChunkCells = NULL;
+    chunkTable = NULL;
+    worldChunkCount = 0;
+}
+
+
+/*========================================================
+ * Procedural worlds
+ *========================================================
+ */
+
+Uint32 hashCell(Uint32 x, Uint32 y, Uint32 seed) {
+    Uint32 h = x * 374761393u + y * 668265263u + seed * 2246822519u;
+
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return h ^ (h >> 16);
+}
+
+short generateCell(Uint32 x, Uint32 y, Uint32 size, Uint32 seed) {
+    Uint32 roomx = x / WORLD_ROOM_SIZE, roomy = y / WORLD_ROOM_SIZE;
+    Uint32 inx = x % WORLD_ROOM_SIZE, iny = y % WORLD_ROOM_SIZE;
+    Uint32 mid = WORLD_ROOM_SIZE / 2;
+    Uint32 h;
+
+    if(x == 0 || y == 0 || x >= size - 1 || y >= size - 1)
+        return R;
+
+    /*
+     * Rooms on a grid. A third of the walls between rooms are left out,
+     * which joins rooms into long open halls; the rest have a doorway,
+     * sometimes with a door, in the middle.
+     */
+    if(!inx || !iny) {
+        if(!inx && !iny)
+            return 1 + hashCell(roomx, roomy, seed) % 4;
+        h = hashCell(roomx * 2 + !inx, roomy * 2 + !iny, seed + 1);
+        if(h % 3 == 0)
+            return 0;
+        if((inx ? inx : iny) == mid)
+            return h % 2 ? D : 0;
+        return 1 + hashCell(roomx, roomy, seed) % 4;
+    }
+
+    /* Pillars, kept off the cross through the middle of the room so it can be walked */
+    if(inx != mid && iny != mid && hashCell(x, y, seed + 2) % 29 == 0)
+        return 1 + hashCell(x, y, seed + 3) % 4;
+
+    return 0;
+}
+
+int writeProceduralWorld(const char* path, Uint32 size, Uint32 seed) {
+    Uint8 header[WORLD_HEADER_SIZE];
+    static Uint8 data[CHUNK_MAX_BYTES];
+    static short cells[CHUNK_CELLS];
+    Uint8* offsets;
+    Uint32 chunksWide = (size + WORLD_CHUNK_SIZE - 1) / WORLD_CHUNK_SIZE;
+    Uint32 cx, cy, x, y, spawn;
+    Uint64 offset, i;
+    int bytes, ok = TRUE;
+    FILE* file;
+
+    if(size < 3) return FALSE;
+
+    file = fopen(path, "wb");
+    offsets = malloc((size_t)(chunksWide + 1) * 8);
+    if(!file || !offsets) {
+        if(file) fclose(file);
+        free(offsets);
+        return FALSE;
+    }
+
+    /* Spawn in the middle of the room nearest the middle of the world */
+    spawn = MIN((size / 2) / WORLD_ROOM_SIZE * WORLD_ROOM_SIZE + WORLD_ROOM_SIZE / 2, size - 2);
+
+    memcpy(header, WORLD_MAGIC, 4);
+    header[4] = WORLD_VERSION;
+    header[5] = WORLD_CHUNK_SIZE;
+    putU16(header + 6, 0);
+    putU32(header + 8, chunksWide);
+    putU32(header + 12, chunksWide);
+    putU32(header + 16, spawn);
+    putU32(header + 20, spawn);
+    ok &= fwrite(header, 1, WORLD_HEADER_SIZE, file) == WORLD_HEADER_SIZE;
+
+    /* Reserve the offset table; each row of it is filled in once its chunks are written */
+    memset(offsets, 0, 8);
+    for(i = 0; i <= (Uint64)chunksWide * chunksWide; i++)
+        ok &= fwrite(offsets, 1, 8, file) == 8;
+    offset = WORLD_HEADER_SIZE + ((Uint64)chunksWide * chunksWide + 1) * 8;
+
+    for(cy = 0; cy < chunksWide && ok; cy++) {
+        for(cx = 0; cx < chunksWide; cx++) {
+            for(y = 0; y < WORLD_CHUNK_SIZE; y++) {
+                for(x = 0; x < WORLD_CHUNK_SIZE; x++) {
+                    Uint32 wx = cx * WORLD_CHUNK_SIZE + x, wy = cy * WORLD_CHUNK_SIZE + y;
+                    cells[y * WORLD_CHUNK_SIZE + x] = (wx == spawn && wy == spawn) ? 0 : generateCell(wx, wy, size, seed);
+                }
+            }
+            bytes = encodeChunk(cells, data);
+            putU64(offsets + cx * 8, offset);
+            ok &= seekWorldFile(file, offset) == 0 && fwrite(data, 1, bytes, file) == (size_t)bytes;
+            offset += bytes;
+        }
+
+        /* The chunk after the last one starts at the end of the file */
+        putU64(offsets + chunksWide * 8, offset);
+        ok &= seekWorldFile(file, WORLD_HEADER_SIZE + (Uint64)cy * chunksWide * 8) == 0
+            && fwrite(offsets, 1, (size_t)(chunksWide + 1) * 8, file) == (size_t)(chunksWide + 1) * 8;
+    }
+
+    free(offsets);
+    return fclose(file) == 0 && ok;
+}